@@ -0,0 +1,77 @@
+#pragma once
+
+#include "lstd/lstd.h"
+
+//
+// A tiny benchmark harness, registered the same way as tests (see
+// test-suite/test.h). Benchmarks are meant to be built in Release,
+// run them with "./nob bench".
+//
+
+// Keeps the compiler from optimizing away the work being measured
+#if COMPILER == MSVC
+#define bench_clobber_memory() _ReadWriteBarrier()
+#else
+#define bench_clobber_memory() asm volatile("" ::: "memory")
+#endif
+
+// How long we run each measurement for at least
+inline const f64 BENCH_MIN_SECONDS = 0.05;
+
+// Calls _body_ in a loop until BENCH_MIN_SECONDS pass and returns the average
+// time a call took, in seconds
+template <typename F>
+f64 bench_measure(F body) {
+  body();  // Warm up
+
+  s64 iterations = 1;
+  while (true) {
+    time_t start = os_get_time();
+    For(range(iterations)) {
+      body();
+      bench_clobber_memory();
+    }
+    f64 elapsed = os_time_to_seconds(os_get_time() - start);
+    if (elapsed >= BENCH_MIN_SECONDS) return elapsed / iterations;
+    iterations *= 2;
+  }
+}
+
+// Prints the time per call and the throughput, _bytes_ is how many bytes
+// were processed by a single call
+inline void bench_report(string label, s64 bytes, f64 seconds) {
+  print("        {:<40} {:>12.1f} ns {:>10.2f} GB/s\n", label, seconds * 1e9,
+        (f64) bytes / seconds / 1e9);
+}
+
+// Prints the time per item and the item throughput, _items_ is how many
+// items (lookups, inserts, ...) a single call processed
+inline void bench_report_items(string label, s64 items, f64 seconds) {
+  print("        {:<40} {:>12.2f} ns/item {:>8.1f} M items/s\n", label,
+        seconds * 1e9 / items, (f64) items / seconds / 1e6);
+}
+
+using bench_func = void (*)();
+
+struct bench_entry {
+  const char *File;
+  const char *Name;
+  bench_func Function;
+};
+
+constexpr u32 LSTD_MAX_BENCHMARKS = 1024;
+extern bench_entry g_AllBenchmarks[LSTD_MAX_BENCHMARKS];
+extern u32 g_AllBenchmarksCount;
+
+#define BENCH(name)                                                         \
+  static void bench_##name();                                               \
+  struct _lstd_bench_registrar_##name {                                     \
+    _lstd_bench_registrar_##name() {                                        \
+      if (g_AllBenchmarksCount < LSTD_MAX_BENCHMARKS) {                     \
+        g_AllBenchmarks[g_AllBenchmarksCount++] =                           \
+            bench_entry{__FILE__, #name, &bench_##name};                    \
+      }                                                                     \
+    }                                                                       \
+  };                                                                        \
+  static _lstd_bench_registrar_##name _lstd_bench_registrar_inst_##name;    \
+  static void bench_##name()
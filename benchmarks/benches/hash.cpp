@@ -0,0 +1,75 @@
+#include "../bench.h"
+
+//
+// String/byte hashing throughput: the old defaults (murmur_32 for strings,
+// xxhash64 for arrays) against get_hash_bytes(), get_hash_long() with every
+// implementation the CPU supports, and hash_state fed in chunks.
+//
+
+static const s64 HASH_BENCH_SIZES[] = {4, 8, 16, 32, 64, 128, 256, 1_KiB, 2_KiB, 4_KiB, 64_KiB, 1_MiB};
+
+static const char *HASH_FUNCTIONS_IMPL_NAMES[] = {"scalar", "sse2", "avx2"};
+
+// The results go here so the calls aren't optimized away
+static volatile u64 HashBenchSink;
+
+BENCH(hash_bytes) {
+  s64 maxSize = 1_MiB;
+  auto *data = (byte *) os_allocate_block(maxSize);
+  defer(os_free_block(data));
+  For(range(maxSize)) data[it] = (byte) (it * 31 + 7);
+
+  For_as(size, HASH_BENCH_SIZES) {
+    f64 t = bench_measure([&]() { HashBenchSink = get_hash_murmur_32(data, size); });
+    bench_report(sprint("murmur_32 {}", size), size, t);
+
+    t = bench_measure([&]() { HashBenchSink = get_hash_xxhash64(data, size); });
+    bench_report(sprint("xxhash64 {}", size), size, t);
+
+    t = bench_measure([&]() { HashBenchSink = get_hash_bytes(data, size); });
+    bench_report(sprint("get_hash_bytes {}", size), size, t);
+  }
+}
+
+BENCH(hash_long) {
+  s64 maxSize = 1_MiB;
+  auto *data = (byte *) os_allocate_block(maxSize);
+  defer(os_free_block(data));
+  For(range(maxSize)) data[it] = (byte) (it * 31 + 7);
+
+  auto best = hash_functions_set_impl(hash_functions_impl::AVX2);
+  For_as(size, HASH_BENCH_SIZES) {
+    if (size <= 64) continue;
+
+    f64 t = bench_measure([&]() { HashBenchSink = get_hash_rapid(data, size); });
+    bench_report(sprint("rapid {}", size), size, t);
+
+    For(range((s32) best + 1)) {
+      hash_functions_set_impl((hash_functions_impl) it);
+      t = bench_measure([&]() { HashBenchSink = get_hash_long(data, size); });
+      bench_report(sprint("long {} {}", HASH_FUNCTIONS_IMPL_NAMES[it], size), size, t);
+    }
+  }
+  hash_functions_set_impl(best);
+}
+
+BENCH(hash_state) {
+  s64 size = 1_MiB;
+  auto *data = (byte *) os_allocate_block(size);
+  defer(os_free_block(data));
+  For(range(size)) data[it] = (byte) (it * 31 + 7);
+
+  f64 t = bench_measure([&]() { HashBenchSink = get_hash_bytes(data, size); });
+  bench_report(sprint("get_hash_bytes {}", size), size, t);
+
+  s64 chunks[] = {4, 64, 4_KiB, 64_KiB};
+  For_as(chunk, chunks) {
+    t = bench_measure([&]() {
+      hash_state state;
+      hash_init(state);
+      for (s64 i = 0; i < size; i += chunk) hash_update(state, data + i, min(chunk, size - i));
+      HashBenchSink = hash_finalize(state);
+    });
+    bench_report(sprint("hash_state chunks of {}", chunk), size, t);
+  }
+}
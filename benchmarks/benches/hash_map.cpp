@@ -0,0 +1,166 @@
+#include "../bench.h"
+
+//
+// hash_table against swiss_table, with small (8 byte) and big (64 byte)
+// values. Keys are random so the trivial integer hash doesn't help either.
+//
+
+static const s64 HASH_MAP_BENCH_SIZES[] = {1000, 64000, 1000000};
+
+struct hash_map_bench_big_value {
+  s64 Data[8];
+};
+
+// splitmix64
+static u64 hash_map_bench_random(u64 ref state) {
+  u64 z = (state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+template <typename Table>
+static void hash_map_bench_run(const char *tableName, const char *valueName) {
+  using V = table_value_t<Table>;
+
+  // Tables allocate from the Context, give them an arena we can reset
+  // between runs so the insert runs don't pile up memory.
+  arena_allocator_data arena;
+  defer(arena_allocator_release(&arena));
+  allocator arenaAlloc = {arena_allocator, &arena};
+
+  For_as(size, HASH_MAP_BENCH_SIZES) {
+    auto *keys = (u64 *) os_allocate_block(size * sizeof(u64));
+    auto *missingKeys = (u64 *) os_allocate_block(size * sizeof(u64));
+    defer(os_free_block(keys));
+    defer(os_free_block(missingKeys));
+
+    u64 state = 42;
+    For(range(size)) keys[it] = hash_map_bench_random(state);
+    For(range(size)) missingKeys[it] = hash_map_bench_random(state);
+
+    V value = {};
+
+    PUSH_ALLOC(arenaAlloc) {
+      f64 t = bench_measure([&]() {
+        Table table;
+        For(range(size)) add(table, keys[it], value);
+        free_all(arenaAlloc);
+      });
+      bench_report_items(sprint("{} {} insert {}", tableName, valueName, size),
+                         size, t);
+
+      Table table;
+      For(range(size)) add(table, keys[it], value);
+
+      volatile s64 sink;
+      t = bench_measure([&]() {
+        s64 found = 0;
+        For(range(size)) found += search(table, keys[it]).Value != null;
+        sink = found;
+      });
+      bench_report_items(sprint("{} {} hit {}", tableName, valueName, size),
+                         size, t);
+
+      t = bench_measure([&]() {
+        s64 found = 0;
+        For(range(size)) found += search(table, missingKeys[it]).Value != null;
+        sink = found;
+      });
+      bench_report_items(sprint("{} {} miss {}", tableName, valueName, size),
+                         size, t);
+
+      free_all(arenaAlloc);
+    }
+  }
+}
+
+BENCH(hash_map_small_values) {
+  hash_map_bench_run<hash_table<u64, s64>>("hash_table", "s64");
+  hash_map_bench_run<swiss_table<u64, s64>>("swiss_table", "s64");
+}
+
+BENCH(hash_map_big_values) {
+  hash_map_bench_run<hash_table<u64, hash_map_bench_big_value>>("hash_table",
+                                                                "64B");
+  hash_map_bench_run<swiss_table<u64, hash_map_bench_big_value>>("swiss_table",
+                                                                 "64B");
+}
+
+// The slowest single add while filling a table, which is the one that grows
+// it (unless the table grows incrementally)
+static void hash_map_bench_latency(bool incremental) {
+  arena_allocator_data arena;
+  defer(arena_allocator_release(&arena));
+  allocator arenaAlloc = {arena_allocator, &arena};
+
+  s64 size = 4000000;
+  auto *keys = (u64 *) os_allocate_block(size * sizeof(u64));
+  defer(os_free_block(keys));
+
+  u64 state = 42;
+  For(range(size)) keys[it] = hash_map_bench_random(state);
+
+  PUSH_ALLOC(arenaAlloc) {
+    hash_table<u64, s64> table;
+    table.Incremental = incremental;
+
+    f64 worst = 0;
+    time_t start = os_get_time();
+    For(range(size)) {
+      time_t addStart = os_get_time();
+      add(table, keys[it], it);
+      worst = max(worst, os_time_to_seconds(os_get_time() - addStart));
+    }
+    f64 total = os_time_to_seconds(os_get_time() - start);
+
+    print("        {:<40} {:>12.1f} us max {:>10.2f} ns/item\n",
+          incremental ? "hash_table incremental" : "hash_table", worst * 1e6,
+          total * 1e9 / size);
+    free_all(arenaAlloc);
+  }
+}
+
+BENCH(hash_map_insert_latency) {
+  hash_map_bench_latency(false);
+  hash_map_bench_latency(true);
+}
+
+// search() one key at a time against search_batch()
+BENCH(hash_map_batch_lookup) {
+  arena_allocator_data arena;
+  defer(arena_allocator_release(&arena));
+  allocator arenaAlloc = {arena_allocator, &arena};
+
+  For_as(size, HASH_MAP_BENCH_SIZES) {
+    auto *keys = (u64 *) os_allocate_block(size * sizeof(u64));
+    auto *results = (key_value_pair<hash_table<u64, s64>> *) os_allocate_block(
+        size * sizeof(key_value_pair<hash_table<u64, s64>>));
+    defer(os_free_block(keys));
+    defer(os_free_block(results));
+
+    u64 state = 42;
+    For(range(size)) keys[it] = hash_map_bench_random(state);
+
+    PUSH_ALLOC(arenaAlloc) {
+      hash_table<u64, s64> table;
+      For(range(size)) add(table, keys[it], it);
+
+      volatile s64 sink;
+      f64 t = bench_measure([&]() {
+        For(range(size)) results[it] = search(table, keys[it]);
+        sink = results[size - 1].Value != null;
+      });
+      bench_report_items(sprint("hash_table search {}", size), size, t);
+
+      t = bench_measure([&]() {
+        search_batch(table, array<u64>(keys, size),
+                     array<key_value_pair<hash_table<u64, s64>>>(results, size));
+        sink = results[size - 1].Value != null;
+      });
+      bench_report_items(sprint("hash_table search_batch {}", size), size, t);
+
+      free_all(arenaAlloc);
+    }
+  }
+}
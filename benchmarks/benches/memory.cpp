@@ -0,0 +1,113 @@
+#include "../bench.h"
+
+//
+// lstd_mem* (every implementation the CPU supports) against the C runtime.
+// Note: With LSTD_NO_CRT the "crt" rows call our own functions.
+//
+
+static const s64 MEMORY_BENCH_SIZES[] = {8,     16,    64,      256,     1_KiB,
+                                         4_KiB, 64_KiB, 1_MiB, 16_MiB};
+static const s64 MEMORY_BENCH_MAX_SIZE = 16_MiB;
+
+static const char *MEMORY_FUNCTIONS_IMPL_NAMES[] = {"scalar", "sse2", "avx2"};
+
+// Calls _body_ once for the C runtime (impl == -1) and then once for every
+// implementation of the lstd functions the CPU supports
+template <typename F>
+static void for_each_memory_bench_impl(F body) {
+  auto best = memory_functions_set_impl(memory_functions_impl::AVX2);
+  For(range(-1, (s32) best + 1)) body(it);
+  memory_functions_set_impl(best);
+}
+
+static string memory_bench_label(const char *function, s32 impl, s64 size) {
+  const char *implName = impl == -1 ? "crt" : MEMORY_FUNCTIONS_IMPL_NAMES[impl];
+  return sprint("{} {} {}", function, implName, size);
+}
+
+BENCH(memcpy) {
+  s64 maxSize = MEMORY_BENCH_MAX_SIZE;
+  auto *src = (byte *) os_allocate_block(maxSize + 64);
+  auto *dst = (byte *) os_allocate_block(maxSize + 64);
+  defer(os_free_block(src));
+  defer(os_free_block(dst));
+  memset(src, 1, maxSize + 64);
+
+  For_as(size, MEMORY_BENCH_SIZES) {
+    for_each_memory_bench_impl([&](s32 impl) {
+      // Misalign the destination a bit, that's the common case
+      f64 t = bench_measure([&]() {
+        if (impl == -1) {
+          memcpy(dst + 3, src, size);
+        } else {
+          lstd_memcpy(dst + 3, src, size);
+        }
+      });
+      bench_report(memory_bench_label("memcpy", impl, size), size, t);
+    });
+  }
+}
+
+BENCH(memmove_overlapping) {
+  s64 maxSize = MEMORY_BENCH_MAX_SIZE;
+  auto *buffer = (byte *) os_allocate_block(maxSize + 64);
+  defer(os_free_block(buffer));
+  memset(buffer, 1, maxSize + 64);
+
+  For_as(size, MEMORY_BENCH_SIZES) {
+    for_each_memory_bench_impl([&](s32 impl) {
+      f64 t = bench_measure([&]() {
+        if (impl == -1) {
+          memmove(buffer + 24, buffer, size);
+        } else {
+          lstd_memmove(buffer + 24, buffer, size);
+        }
+      });
+      bench_report(memory_bench_label("memmove", impl, size), size, t);
+    });
+  }
+}
+
+BENCH(memset) {
+  s64 maxSize = MEMORY_BENCH_MAX_SIZE;
+  auto *dst = (byte *) os_allocate_block(maxSize + 64);
+  defer(os_free_block(dst));
+
+  For_as(size, MEMORY_BENCH_SIZES) {
+    for_each_memory_bench_impl([&](s32 impl) {
+      f64 t = bench_measure([&]() {
+        if (impl == -1) {
+          memset(dst + 1, 0x2A, size);
+        } else {
+          lstd_memset(dst + 1, 0x2A, size);
+        }
+      });
+      bench_report(memory_bench_label("memset", impl, size), size, t);
+    });
+  }
+}
+
+BENCH(memcmp) {
+  s64 maxSize = MEMORY_BENCH_MAX_SIZE;
+  auto *a = (byte *) os_allocate_block(maxSize + 64);
+  auto *b = (byte *) os_allocate_block(maxSize + 64);
+  defer(os_free_block(a));
+  defer(os_free_block(b));
+  memset(a, 7, maxSize + 64);
+  memset(b, 7, maxSize + 64);
+
+  // Equal buffers, so the whole range gets compared
+  For_as(size, MEMORY_BENCH_SIZES) {
+    for_each_memory_bench_impl([&](s32 impl) {
+      volatile int sink;
+      f64 t = bench_measure([&]() {
+        if (impl == -1) {
+          sink = memcmp(a, b + 5, size);
+        } else {
+          sink = lstd_memcmp(a, b + 5, size);
+        }
+      });
+      bench_report(memory_bench_label("memcmp", impl, size), size, t);
+    });
+  }
+}
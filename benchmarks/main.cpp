@@ -0,0 +1,30 @@
+// Benchmark runner, benchmarks register themselves with the BENCH macro
+#include "bench.h"
+
+bench_entry g_AllBenchmarks[LSTD_MAX_BENCHMARKS];
+u32 g_AllBenchmarksCount = 0;
+
+// Unity includes of benchmark sources (manual)
+#include "benches/memory.cpp"
+#include "benches/hash_map.cpp"
+#include "benches/hash.cpp"
+
+s32 main() {
+  platform_state_init();
+  time_t start = os_get_time();
+
+  auto newContext = Context;
+  newContext.Alloc = TemporaryAllocator;
+  newContext.AllocAlignment = 16;
+  OVERRIDE_CONTEXT(newContext);
+
+  for (u32 i = 0; i < g_AllBenchmarksCount; ++i) {
+    print("{}:\n", g_AllBenchmarks[i].Name);
+    g_AllBenchmarks[i].Function();
+    print("\n");
+  }
+
+  print("Finished benchmarks, time taken: {:f} seconds\n\n",
+        os_time_to_seconds(os_get_time() - start));
+  return 0;
+}
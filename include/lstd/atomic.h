@@ -4,7 +4,7 @@
 
 //
 // Atomic operations: atomic_inc, atomic_add, atomic_swap,
-// atomic_compare_and_swap
+// atomic_compare_and_swap, and cpu_pause for spin-wait loops
 //
 
 LSTD_BEGIN_NAMESPACE
@@ -40,6 +40,10 @@ long __cdecl _InterlockedCompareExchange(long volatile *_Destination,
 long long __cdecl _InterlockedCompareExchange64(
     long long volatile *_Destination, long long _Exchange,
     long long _Comparand);
+
+#if ARCH == X86
+void __cdecl _mm_pause(void);
+#endif
 }
 
 // Returns the initial value in _ptr_
@@ -158,4 +162,19 @@ T atomic_compare_and_swap(T *ptr, T oldValue, T newValue) {
 }
 #endif
 
+// Call in spin-wait loops which expect the wait to be short. Tells the CPU we
+// are spinning, which saves power and gives the other hyper-thread a chance
+// to run. Unlike thread_sleep(0) it doesn't go to the OS.
+inline void cpu_pause() {
+#if ARCH == X86
+#if COMPILER == MSVC
+  _mm_pause();
+#else
+  __builtin_ia32_pause();
+#endif
+#elif ARCH == ARM && COMPILER != MSVC
+  __asm__ volatile("yield");
+#endif
+}
+
 LSTD_END_NAMESPACE
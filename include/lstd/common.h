@@ -872,6 +872,19 @@ constexpr u128 u128::operator%(u128 v) const { return u128_rem(*this, v); }
 #define bswap64(x) _byteswap_uint64(x)
 #endif
 
+/* Cache hints */
+
+// Asks the CPU to start loading the cache line at _x_, so it's (hopefully)
+// there by the time we read it. Only worth it with enough independent work
+// to do in the meantime.
+#if COMPILER == GCC || COMPILER == CLANG
+#define prefetch_for_read(x) __builtin_prefetch(x, 0, 3)
+#elif COMPILER == MSVC && ARCH == X86
+#define prefetch_for_read(x) _mm_prefetch((const char *) (x), _MM_HINT_T0)
+#else
+#define prefetch_for_read(x) ((void) (x))
+#endif
+
 
 /* 64-bit 128-bit compiler intrinsics */
 
@@ -0,0 +1,364 @@
+#pragma once
+
+#include "hash_table.h"
+#include "os/memory.h"
+#include "os/thread.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// A hash map which can be used from many threads at once.
+//
+// The keys are split between SHARD_COUNT hash_tables (shards) by the high bits
+// of their (mixed) hash, each with its own reader-writer spin lock. Lookups
+// take the lock shared, so readers never wait for each other, and writers only
+// block the shard they touch. Each shard grows on its own.
+//
+// Since another thread may change or remove an entry as soon as we unlock,
+// nothing here hands out pointers into the table. search() copies the value
+// out instead, and get_or_insert() and update() run your code under the lock.
+//
+// All the _prehashed_ variants take the result of get_hash(key), so callers
+// which already have a hash (or call several functions) don't hash twice.
+//
+// The Context (and its allocator) is per thread, so shards don't allocate
+// from the Context of whichever thread happens to make them grow, but from
+// _Alloc_, which must be thread-safe. If it's null we use the platform's
+// persistent allocator. The shard arrays are allocated with direct calls to
+// the allocator, because with DEBUG_MEMORY a block may only be freed by the
+// thread which allocated it.
+//
+// Note: There are no optimistic (seqlock) reads. A reader racing with an
+// insert could see a torn key (e.g. a string pointing to garbage) or an
+// entries array which a resize just freed, so they would only be safe for
+// scalar keys and with deferred freeing of old arrays. Shared locks are a
+// couple of atomics per lookup and keep it simple.
+//
+template <typename K_, typename V_, s64 SHARD_BITS_ = 6>
+struct concurrent_hash_table {
+  using K = K_;
+  using V = V_;
+
+  static const s64 SHARD_BITS = SHARD_BITS_;
+  static const s64 SHARD_COUNT = 1ll << SHARD_BITS;
+
+  // Each shard is on its own cache line(s), so threads working on
+  // different shards don't fight over the locks.
+  using table_t = hash_table<K, V>;
+
+  struct alignas(64) shard {
+    table_t Table;
+
+    s32 Lock = 0;  // Number of readers, or -1 while a writer holds it
+    s32 WritersWaiting = 0;  // New readers back off while this is non-zero
+  };
+  shard Shards[SHARD_COUNT];
+
+  // Used for all allocations, must be thread-safe.
+  // If null we use the platform's persistent allocator.
+  allocator Alloc;
+};
+
+template <typename>
+const bool is_concurrent_hash_table = false;
+
+template <typename K, typename V, s64 SHARD_BITS>
+const bool is_concurrent_hash_table<concurrent_hash_table<K, V, SHARD_BITS>> =
+    true;
+
+template <typename T>
+concept any_concurrent_hash_table = is_concurrent_hash_table<T>;
+
+template <typename V>
+struct concurrent_search_result {
+  V Value;
+  bool Found;
+};
+
+template <typename V>
+struct concurrent_insert_result {
+  V Value;        // The value in the table after the call
+  bool Inserted;  // False if the key was already there
+};
+
+template <any_concurrent_hash_table T>
+auto *concurrent_hash_table_get_shard(T ref table, u64 hash) {
+  // Trivial hashes (e.g. of small integers) have no high bits, mix first.
+  // The shard's table uses the low bits, so they don't correlate.
+  u64 mixed = hash * 0x9E3779B97F4A7C15ull;
+  return &table.Shards[mixed >> (64 - T::SHARD_BITS)];
+}
+
+// Lock waits are expected to be short, so we only give up the time slice
+// while a writer holds the lock or is waiting for it. Losing a race with
+// another reader (or waiting for readers to leave) just spins.
+inline void concurrent_hash_table_read_lock(auto *shard) {
+  while (true) {
+    s32 readers = shard->Lock;
+    if (readers < 0 || shard->WritersWaiting) {
+      thread_sleep(0);
+      continue;
+    }
+    if (atomic_compare_and_swap(&shard->Lock, readers, readers + 1) == readers)
+      return;
+    cpu_pause();
+  }
+}
+
+inline void concurrent_hash_table_read_unlock(auto *shard) {
+  atomic_add(&shard->Lock, -1);
+}
+
+inline void concurrent_hash_table_write_lock(auto *shard) {
+  if (atomic_compare_and_swap(&shard->Lock, 0, -1) == 0) return;
+
+  // New readers back off while we wait, so the ones inside leave soon.
+  // Another writer may take a while though.
+  atomic_inc(&shard->WritersWaiting);
+  while (atomic_compare_and_swap(&shard->Lock, 0, -1) != 0) {
+    if (shard->Lock < 0 || shard->WritersWaiting > 1) {
+      thread_sleep(0);
+    } else {
+      cpu_pause();
+    }
+  }
+  atomic_add(&shard->WritersWaiting, -1);
+}
+
+inline void concurrent_hash_table_write_unlock(auto *shard) {
+  atomic_swap(&shard->Lock, 0);
+}
+
+template <any_concurrent_hash_table T>
+allocator concurrent_hash_table_allocator(T ref table) {
+  return table.Alloc ? table.Alloc : platform_get_persistent_allocator();
+}
+
+// Grows the shard (if needed) before we add an entry. Call with the write
+// lock held.
+template <any_concurrent_hash_table T>
+void concurrent_hash_table_maybe_grow(T ref table, auto *shard) {
+  auto ref t = shard->Table;
+  if ((t.Count + 1) * 100 < t.Allocated * t.LOAD_FACTOR_PERCENT) return;
+
+  using entry = typename remove_cvref_t<decltype(t)>::entry;
+
+  s64 target = max<s64>(ceil_pow_of_2((t.Count + 1) * 2), t.MINIMUM_SIZE);
+
+  allocator alloc = concurrent_hash_table_allocator(table);
+  auto *entries = (entry *) alloc.Function(allocator_mode::ALLOCATE, alloc.Context,
+                                           target * sizeof(entry), null, 0, 0);
+  assert(entries && "Allocator failed");
+  memset0(entries, target * sizeof(entry));
+
+  auto *oldEntries = t.Entries.Data;
+  s64 oldAllocated = t.Allocated;
+
+  t.Entries.Data = entries;
+  t.Allocated = target;
+  t.Count = 0;
+
+  For(range(oldAllocated)) {
+    if (oldEntries[it].Hash) hash_table_insert_entry(t, oldEntries[it]);
+  }
+
+  if (oldEntries) {
+    alloc.Function(allocator_mode::FREE, alloc.Context, 0, oldEntries,
+                   oldAllocated * sizeof(entry), 0);
+  }
+}
+
+// Copies the value out, so it stays valid after other threads modify the table
+template <any_concurrent_hash_table T>
+concurrent_search_result<table_value_t<T>> search_prehashed(
+    T ref table, u64 hash, table_key_t<T> no_copy key) {
+  auto *shard = concurrent_hash_table_get_shard(table, hash);
+
+  concurrent_hash_table_read_lock(shard);
+  defer(concurrent_hash_table_read_unlock(shard));
+
+  auto [kp, vp] = search_prehashed(shard->Table, hash, key);
+  if (!vp) return {{}, false};
+  return {*vp, true};
+}
+
+template <any_concurrent_hash_table T>
+auto search_opt(T ref table, table_key_t<T> no_copy key,
+                table_search_options options = {}) {
+  return search_prehashed(table, get_hash(key), key);
+}
+
+template <any_concurrent_hash_table T>
+bool has_prehashed(T ref table, u64 hash, table_key_t<T> no_copy key) {
+  auto *shard = concurrent_hash_table_get_shard(table, hash);
+
+  concurrent_hash_table_read_lock(shard);
+  defer(concurrent_hash_table_read_unlock(shard));
+
+  return has_prehashed(shard->Table, hash, key);
+}
+
+template <any_concurrent_hash_table T>
+bool has(T ref table, table_key_t<T> no_copy key) {
+  return has_prehashed(table, get_hash(key), key);
+}
+
+// Adds the key or overwrites its value. Returns true if the key is new.
+template <any_concurrent_hash_table T>
+bool set_prehashed(T ref table, u64 hash, table_key_t<T> no_copy key,
+                   table_value_t<T> no_copy value) {
+  auto *shard = concurrent_hash_table_get_shard(table, hash);
+
+  concurrent_hash_table_write_lock(shard);
+  defer(concurrent_hash_table_write_unlock(shard));
+
+  auto [kp, vp] = search_prehashed(shard->Table, hash, key);
+  if (vp) {
+    *vp = value;
+    return false;
+  }
+
+  concurrent_hash_table_maybe_grow(table, shard);
+  hash_table_insert_entry(
+      shard->Table, {hash_table_valid_hash<typename T::table_t>(hash), key, value});
+  return true;
+}
+
+// Adds the key or overwrites its value. Returns true if the key is new.
+template <any_concurrent_hash_table T>
+bool set(T ref table, table_key_t<T> no_copy key,
+         table_value_t<T> no_copy value) {
+  return set_prehashed(table, get_hash(key), key, value);
+}
+
+// Returns the value of _key_, adding it with the value returned by _make()_
+// first if it's not in the table. _make_ is called under the shard's lock,
+// only if the key is missing, so it's only ever called once per key.
+//
+// We first look with the shared lock (the common case for caches), and only
+// if the key is missing take the write lock and look again.
+//
+// _key_ is read again after _make_ returns, so _make_ may replace the object
+// it refers to with an equal key, e.g. a copy which outlives the caller's
+// (see intern_table.h).
+template <any_concurrent_hash_table T>
+concurrent_insert_result<table_value_t<T>> get_or_insert_prehashed(
+    T ref table, u64 hash, table_key_t<T> no_copy key, auto make) {
+  auto *shard = concurrent_hash_table_get_shard(table, hash);
+
+  concurrent_hash_table_read_lock(shard);
+  auto [kp, vp] = search_prehashed(shard->Table, hash, key);
+  if (vp) {
+    concurrent_insert_result<table_value_t<T>> result = {*vp, false};
+    concurrent_hash_table_read_unlock(shard);
+    return result;
+  }
+  concurrent_hash_table_read_unlock(shard);
+
+  concurrent_hash_table_write_lock(shard);
+  defer(concurrent_hash_table_write_unlock(shard));
+
+  // Another thread may have added it in between
+  auto [kp2, vp2] = search_prehashed(shard->Table, hash, key);
+  if (vp2) return {*vp2, false};
+
+  concurrent_hash_table_maybe_grow(table, shard);
+  auto value = make();
+  hash_table_insert_entry(
+      shard->Table, {hash_table_valid_hash<typename T::table_t>(hash), key, value});
+  return {value, true};
+}
+
+template <any_concurrent_hash_table T>
+concurrent_insert_result<table_value_t<T>> get_or_insert(
+    T ref table, table_key_t<T> no_copy key, auto make) {
+  return get_or_insert_prehashed(table, get_hash(key), key, make);
+}
+
+// Calls _modify(V *value)_ under the shard's write lock if the key is in the
+// table, e.g. for incrementing counters. Returns false if it's not.
+template <any_concurrent_hash_table T>
+bool update_prehashed(T ref table, u64 hash, table_key_t<T> no_copy key,
+                      auto modify) {
+  auto *shard = concurrent_hash_table_get_shard(table, hash);
+
+  concurrent_hash_table_write_lock(shard);
+  defer(concurrent_hash_table_write_unlock(shard));
+
+  auto [kp, vp] = search_prehashed(shard->Table, hash, key);
+  if (!vp) return false;
+
+  modify(vp);
+  return true;
+}
+
+template <any_concurrent_hash_table T>
+bool update(T ref table, table_key_t<T> no_copy key, auto modify) {
+  return update_prehashed(table, get_hash(key), key, modify);
+}
+
+// Returns true if the key was found and removed.
+template <any_concurrent_hash_table T>
+bool remove_prehashed(T ref table, u64 hash, table_key_t<T> no_copy key) {
+  auto *shard = concurrent_hash_table_get_shard(table, hash);
+
+  concurrent_hash_table_write_lock(shard);
+  defer(concurrent_hash_table_write_unlock(shard));
+
+  return remove_prehashed(shard->Table, hash, key);
+}
+
+template <any_concurrent_hash_table T>
+bool remove(T ref table, table_key_t<T> no_copy key) {
+  return remove_prehashed(table, get_hash(key), key);
+}
+
+// The number of entries. Shards are counted one at a time, so if other
+// threads are modifying the table this is only a snapshot of each shard.
+s64 concurrent_hash_table_count(any_concurrent_hash_table auto ref table) {
+  s64 result = 0;
+  For_as(shard, table.Shards) {
+    concurrent_hash_table_read_lock(&shard);
+    result += shard.Table.Count;
+    concurrent_hash_table_read_unlock(&shard);
+  }
+  return result;
+}
+
+// Calls _visitor(K *key, V *value)_ for each entry, holding each shard's lock
+// shared while visiting it. Don't call other functions on the table from the
+// visitor.
+void concurrent_hash_table_visit(any_concurrent_hash_table auto ref table,
+                                 auto visitor) {
+  For_as(shard, table.Shards) {
+    concurrent_hash_table_read_lock(&shard);
+    for (auto [k, v] : shard.Table) visitor(k, v);
+    concurrent_hash_table_read_unlock(&shard);
+  }
+}
+
+// Removes all entries but keeps the memory
+void reset(any_concurrent_hash_table auto ref table) {
+  For_as(shard, table.Shards) {
+    concurrent_hash_table_write_lock(&shard);
+    reset(shard.Table);
+    concurrent_hash_table_write_unlock(&shard);
+  }
+}
+
+// Not thread-safe, no other thread may be using the table
+void free(any_concurrent_hash_table auto ref table) {
+  allocator alloc = concurrent_hash_table_allocator(table);
+  For_as(shard, table.Shards) {
+    auto ref t = shard.Table;
+    if (t.Entries.Data) {
+      alloc.Function(allocator_mode::FREE, alloc.Context, 0, t.Entries.Data,
+                     t.Allocated * sizeof(t.Entries.Data[0]), 0);
+    }
+    t.Entries.Data = null;
+    t.Allocated = 0;
+    t.Count = 0;
+  }
+}
+
+LSTD_END_NAMESPACE
@@ -118,6 +118,10 @@ struct context {
   // is made, logs info about it.
   bool LogAllAllocations;  // = false;     by default
 
+  // Attribute every allocation made on this thread to its call site, see
+  // memory_profiler.h
+  bool ProfileAllocations;  // = false;     by default
+
   //
   // Gets called when the program encounters an unhandled exception.
   // This can be used to view the stack trace before the program terminates.
@@ -148,13 +152,13 @@ struct context {
   bool FmtDisableAnsiCodes;  // = false;     by default
 
 #if defined DEBUG_MEMORY
-  // After every allocation we check the heap for corruption.
-  // The problem is that this involves iterating over a possibly
-  // large linked list of every allocation made. We use the frequency
-  // variable below to specify how often we perform that expensive
-  // operation. By default we check the heap every 255 allocations,
-  // but if a problem is found you may want to decrease
-  // this to 1 so you catch the corruption at just the right time.
+  // On allocations we check the heap for corruption. To keep that cheap
+  // with a lot of live blocks we check only a slice of them at a time (see
+  // debug_memory_maybe_verify_heap()). We use the frequency variable below
+  // to specify how often we verify a slice. By default we do that every 255
+  // allocations, but if a problem is found you may want to decrease this to
+  // 1 (or call debug_memory_verify_heap() directly) so you catch the
+  // corruption closer to the right time.
   u8 DebugMemoryHeapVerifyFrequency;  // = 255;     by default
 
   // Self-explanatory
@@ -239,10 +243,13 @@ inline void panic(string message) {
 // memory is no longer used you call free_all(TemporaryAllocator) (both allocate
 // and free all are extremely cheap - they bump a single pointer).
 //
-// You must initialize this by saying what block of memory to use as an arena
-// before using it in a thread
-// e.g.:       TemporaryAllocator.Block = os_allocate_block(poolSize);
-//             TemporaryAllocator.Size = poolSize;
+// By default the arena reserves ARENA_DEFAULT_RESERVE bytes of address space
+// on first use and commits memory as it grows, so there is nothing to
+// initialize. A thread which needs more can reserve it up front with
+//             arena_allocator_reserve(&TemporaryAllocatorData, 64_GiB);
+// or provide its own block, e.g.:
+//             TemporaryAllocatorData.Block = os_allocate_block(poolSize);
+//             TemporaryAllocatorData.Size = poolSize;
 //
 inline thread_local arena_allocator_data TemporaryAllocatorData;
 inline const thread_local allocator TemporaryAllocator =
@@ -250,6 +257,57 @@ inline const thread_local allocator TemporaryAllocator =
                                          // this gets initialized with the
                                          // Context. See hack note above.
 
+//
+// :ScratchArenas:
+//
+// A small per-thread pool of arenas for temporaries which don't outlive a
+// function. Unlike the temporary allocator these are scoped: scratch_begin()
+// takes a checkpoint and scratch_end() pops everything allocated since.
+//
+// A function which returns memory usually gets the arena for the result from
+// its caller. If that arena happens to be a scratch arena and the function
+// also takes that same arena for its own temporaries, popping them would
+// free the result too. That's why you pass the arenas which must not be used
+// (e.g. the output allocator) as _conflicts_ and we hand out a different one:
+//
+//     string join_paths(allocator out, ...) {
+//         PUSH_SCRATCH(scratch, out);
+//         ... temporaries in scratch.Alloc, result in out ...
+//     }
+//
+// The arenas are 0-initialized so they reserve ARENA_DEFAULT_RESERVE bytes of
+// address space on first use (call arena_allocator_reserve() on them before
+// that if a thread needs bigger ones).
+//
+inline const s64 SCRATCH_ARENA_COUNT = 2;
+inline thread_local arena_allocator_data ScratchArenas[SCRATCH_ARENA_COUNT];
+
+struct scratch_arena {
+  allocator Alloc;
+  arena_checkpoint Checkpoint;
+};
+
+template <typename... Conflicts>
+requires(is_same<Conflicts, allocator> &&...)
+scratch_arena scratch_begin(Conflicts... conflicts) {
+  For(range(SCRATCH_ARENA_COUNT)) {
+    auto *data = &ScratchArenas[it];
+    if (((conflicts.Context == data) || ...)) continue;
+
+    return {allocator(arena_allocator, data), arena_mark(data)};
+  }
+  assert(false && "All scratch arenas conflict. Increase SCRATCH_ARENA_COUNT.");
+  return {};
+}
+
+inline void scratch_end(scratch_arena scratch) {
+  arena_restore(scratch.Checkpoint);
+}
+
+#define PUSH_SCRATCH(name, ...)                                   \
+  auto name = LSTD_NAMESPACE::scratch_begin(__VA_ARGS__); \
+  defer(LSTD_NAMESPACE::scratch_end(name))
+
 // Allocates a buffer, copies the string's contents and also appends a zero
 // terminator. Uses the temporary allocator.
 inline char *to_c_string_temp(string s) {
@@ -3,6 +3,7 @@
 #include "bits.h"
 #include "common.h"
 #include "string.h"
+#include "xar.h"
 
 //
 // !!! THESE ARE NOT SUPPOSED TO BE CRYPTOGRAPHICALLY SECURE !!!
@@ -37,7 +38,7 @@ inline u64 get_hash_xxhash64(const byte *key, s64 len, u64 hash_so_far = 0)
   for (int i = 0; i < (len / 32); i++)
   {
     u64 b[4];
-    memcpy(b, key + 4 * i, sizeof(b));
+    memcpy(b, key + 32 * i, sizeof(b));
 
     for (int j = 0; j < 4; j++)
       b[j] = b[j] * p2 + s[j];
@@ -133,11 +134,252 @@ inline u32 get_hash_murmur_32(const byte *key, s64 len, u32 hash_so_far = 0)
   return h ^ (h >> 16);
 }
 
+//
+// The default hash for strings and arrays (see get_hash_bytes() below).
+//
+// Short inputs (hash table keys, identifiers) go through get_hash_rapid(),
+// a wyhash/rapidhash-style hash: it reads 16 bytes per step and mixes with
+// a 64x64->128 bit multiply folded back to 64 bits, which passes SMHasher
+// and is a handful of cycles for keys up to 16 bytes. Unlike murmur_32 all
+// 64 bits of the result are usable.
+//
+// Long inputs go through get_hash_long() (in hash.cpp), which is structured
+// like XXH3: 8 independent 64-bit lanes, each 64 byte stripe is xor-ed with
+// a secret and multiplied 32x32->64 per lane, and the lanes are scrambled
+// every 1 KiB. That maps directly onto SSE2/AVX2 and is picked at runtime
+// like the lstd_mem* functions (see hash_functions_impl). Only the AVX2
+// version beats get_hash_rapid(), so get_hash_bytes() uses it only on CPUs
+// which have AVX2.
+//
+// Neither of these produces the same values as the reference rapidhash or
+// XXH3 implementations, don't persist the results.
+//
+
+// Multiplies _a_ and _b_ to 128 bits, the low half goes in _a_ and the high half in _b_
+always_inline void hash_mum(u64 *a, u64 *b)
+{
+  u128 r = u128_mul(u128_from_u64(*a), u128_from_u64(*b));
+  *a = r.lo;
+  *b = r.hi;
+}
+
+always_inline u64 hash_mix(u64 a, u64 b)
+{
+  hash_mum(&a, &b);
+  return a ^ b;
+}
+
+always_inline u64 hash_read64(const byte *p)
+{
+  u64 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+always_inline u64 hash_read32(const byte *p)
+{
+  u32 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline const u64 HASH_RAPID_SECRET[3] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull};
+
+// The pieces of get_hash_rapid(), shared with hash_state (see below).
+// The length only goes into the final mix, so the bulk loop can run before
+// we know how long the input is.
+
+always_inline u64 hash_rapid_seed(u64 seed)
+{
+  return seed ^ hash_mix(seed ^ HASH_RAPID_SECRET[0], HASH_RAPID_SECRET[1]);
+}
+
+inline const s64 HASH_RAPID_ROUND_LEN = 48;
+
+// One step of the bulk loop, mixes 48 bytes at _p_ into 3 independent _seeds_
+always_inline void hash_rapid_round(u64 *seeds, const byte *p)
+{
+  const u64 *secret = HASH_RAPID_SECRET;
+  seeds[0] = hash_mix(hash_read64(p) ^ secret[0], hash_read64(p + 8) ^ seeds[0]);
+  seeds[1] = hash_mix(hash_read64(p + 16) ^ secret[1], hash_read64(p + 24) ^ seeds[1]);
+  seeds[2] = hash_mix(hash_read64(p + 32) ^ secret[2], hash_read64(p + 40) ^ seeds[2]);
+}
+
+always_inline u64 hash_rapid_final(u64 a, u64 b, u64 seed, s64 len)
+{
+  a ^= HASH_RAPID_SECRET[1];
+  b ^= seed;
+  hash_mum(&a, &b);
+  return hash_mix(a ^ HASH_RAPID_SECRET[0] ^ (u64) len, b ^ HASH_RAPID_SECRET[1]);
+}
+
+// Mixes the last 1..48 bytes (at _p_) of an input longer than 16 bytes.
+// Reads the last 16 bytes of the input, so the bytes before _p_ (which the
+// bulk loop already mixed) must be readable if _i_ < 16.
+always_inline u64 hash_rapid_tail(u64 seed, const byte *p, s64 i, s64 len)
+{
+  const u64 *secret = HASH_RAPID_SECRET;
+  if (i > 16)
+  {
+    seed = hash_mix(hash_read64(p) ^ secret[2], hash_read64(p + 8) ^ seed ^ secret[1]);
+    if (i > 32)
+      seed = hash_mix(hash_read64(p + 16) ^ secret[2], hash_read64(p + 24) ^ seed);
+  }
+  return hash_rapid_final(hash_read64(p + i - 16), hash_read64(p + i - 8), seed, len);
+}
+
+inline u64 get_hash_rapid(const byte *key, s64 len, u64 seed = 0)
+{
+  const byte *p = key;
+  seed = hash_rapid_seed(seed);
+
+  if (len <= 16)
+  {
+    u64 a = 0, b = 0;
+    if (len >= 4)
+    {
+      // Two (possibly overlapping) pairs of 4 byte reads cover 4..16 bytes
+      const byte *last = p + len - 4;
+      u64 delta = (len & 24) >> (len >> 3);
+      a = (hash_read32(p) << 32) | hash_read32(last);
+      b = (hash_read32(p + delta) << 32) | hash_read32(last - delta);
+    }
+    else if (len > 0)
+    {
+      a = ((u64) p[0] << 56) | ((u64) p[len >> 1] << 32) | p[len - 1];
+    }
+    return hash_rapid_final(a, b, seed, len);
+  }
+
+  // The bulk loop always leaves 1..48 bytes for hash_rapid_tail()
+  u64 seeds[3] = {seed, seed, seed};
+  s64 i = len;
+  while (i > HASH_RAPID_ROUND_LEN)
+  {
+    hash_rapid_round(seeds, p);
+    p += HASH_RAPID_ROUND_LEN;
+    i -= HASH_RAPID_ROUND_LEN;
+  }
+  return hash_rapid_tail(seeds[0] ^ seeds[1] ^ seeds[2], p, i, len);
+}
+
+// Inputs at least this long may be hashed with get_hash_long(). Below this
+// get_hash_rapid() is faster even against the AVX2 version (they cross over
+// between 1.5 and 2 KiB, see benchmarks/benches/hash.cpp).
+inline const s64 HASH_LONG_INPUT_THRESHOLD = 2_KiB;
+
+// Defined in hash.cpp, _len_ must be more than 64. Gives the same result
+// with every implementation.
+u64 get_hash_long(const byte *key, s64 len, u64 seed = 0);
+
+// Defined in hash.cpp. get_hash_long() if the CPU supports AVX2, otherwise
+// get_hash_rapid(), which is faster than the SSE2 and scalar versions of
+// get_hash_long(). This depends only on the CPU (not on what
+// hash_functions_set_impl() forced), so it's stable for the whole run
+// unless a test overrides it with hash_bytes_set_use_long().
+u64 get_hash_bytes_long(const byte *key, s64 len, u64 seed = 0);
+
+// Whether get_hash_bytes_long() (and so get_hash_bytes() and hash_state)
+// currently runs get_hash_long() rather than get_hash_rapid().
+bool hash_bytes_get_use_long();
+
+// Forces the choice above, so tests can cover both on any CPU. Hashes of
+// long inputs change with it, don't use it outside of tests. Returns the
+// previous choice.
+bool hash_bytes_set_use_long(bool useLong);
+
+enum class hash_functions_impl : s32 { SCALAR, SSE2, AVX2 };
+
+// Returns the implementation get_hash_long() currently uses
+hash_functions_impl hash_functions_get_impl();
+
+// Forces an implementation, e.g. to compare them in tests and benchmarks. If
+// the CPU doesn't support _impl_ we pick the best one it does support.
+// Returns the implementation which was selected.
+hash_functions_impl hash_functions_set_impl(hash_functions_impl impl);
+
+// 64-bit hash of _len_ bytes, this is what get_hash() uses for strings and arrays
+inline u64 get_hash_bytes(const byte *key, s64 len, u64 seed = 0)
+{
+  if (len >= HASH_LONG_INPUT_THRESHOLD) [[unlikely]]
+    return get_hash_bytes_long(key, len, seed);
+  return get_hash_rapid(key, len, seed);
+}
+
+//
+// Streaming version of get_hash_bytes(). Hashing bytes with any number of
+// hash_update() calls gives the same result as get_hash_bytes() of all of
+// them at once, no matter where the chunks are split, so e.g. a big file
+// can be hashed while it's read without loading all of it.
+//
+//      hash_state state;
+//      hash_init(state);
+//      hash_update(state, header);
+//      hash_update(state, body);
+//      u64 hash = hash_finalize(state);
+//
+// Until there are more than HASH_LONG_INPUT_THRESHOLD bytes the state just
+// collects them, because we don't know yet which hash get_hash_bytes() would
+// use. After that the bulk loop of that hash runs on whole units (48 bytes
+// for get_hash_rapid(), 64 byte stripes for get_hash_long()), a block of
+// them at a time. The state always holds back the last unit, which both
+// hashes treat differently, together with the bytes before it (the final
+// reads may overlap with them).
+//
+
+inline const s64 HASH_STRIPE_LEN = 64;   // get_hash_long() reads stripes of this size
+inline const s64 HASH_SECRET_SIZE = 192;  // Size of the get_hash_long() secret
+
+inline const s64 HASH_STATE_PENDING_SIZE = 1_KiB;  // At most this many bytes are held back
+
+struct hash_state {
+  u64 Seed;
+  s64 Count;  // Number of bytes hashed so far
+
+  // When false the bytes so far are all in _Buffer_
+  bool Streaming;
+  bool Long;  // Whether we are running get_hash_long() or get_hash_rapid()
+
+  // The held back bytes are at Tail + HASH_STRIPE_LEN, the end of the
+  // last unit that went through the bulk loop is right before them
+  byte Tail[HASH_STRIPE_LEN + HASH_STATE_PENDING_SIZE];
+  s64 Pending;
+
+  // The lanes of get_hash_long(), the first 3 are the seeds of get_hash_rapid()
+  u64 Lanes[8];
+  s64 StripeInBlock;
+  byte Secret[HASH_SECRET_SIZE];
+
+  byte Buffer[HASH_LONG_INPUT_THRESHOLD];
+};
+
+// Defined in hash.cpp
+void hash_init(hash_state ref state, u64 seed = 0);
+void hash_update(hash_state ref state, const byte *data, s64 len);
+
+// Returns the hash of all bytes so far. Doesn't change the state, so you
+// can keep adding bytes afterwards.
+u64 hash_finalize(hash_state no_copy state);
+
+inline void hash_update(hash_state ref state, string no_copy s)
+{
+  hash_update(state, (const byte *) s.Data, s.Count);
+}
+
+// Hashes the elements of an exponential array chunk by chunk, without
+// flattening it first (e.g. a string_builder)
+inline void hash_update(hash_state ref state, any_xar auto ref arr)
+{
+  exponential_array_visit_chunks(arr, [&](auto *chunk, usize count, usize) {
+    hash_update(state, (const byte *) chunk, (s64) (count * sizeof(*chunk)));
+    return true;
+  });
+}
+
 // Good enough hash for arrays of any type
-// Note: If u have short low-entropy arrays, murmur might be better
 inline u64 get_hash(any_array_like auto ref array)
 {
-  return get_hash_xxhash64(array.Data, array.Count * sizeof(array[0]));
+  return get_hash_bytes((const byte *) array.Data, array.Count * sizeof(array[0]));
 }
 
 // Hashes for integer types
@@ -158,11 +400,18 @@ TRIVIAL_HASH(u64);
 
 TRIVIAL_HASH(bool);
 
-// Hashing strings, based on murmur
-// For larger strings, xxhash64 might be better
 inline u64 get_hash(string value)
 {
-  return get_hash_murmur_32((const byte *) value.Data, value.Count, 0);
+  return get_hash_bytes((const byte *) value.Data, value.Count);
+}
+
+// Same as get_hash() of the flattened array, e.g. of builder_to_string()
+inline u64 get_hash(any_xar auto ref arr)
+{
+  hash_state state;
+  hash_init(state);
+  hash_update(state, arr);
+  return hash_finalize(state);
 }
 
 // Partial specialization for pointers
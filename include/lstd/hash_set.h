@@ -0,0 +1,249 @@
+#pragma once
+
+#include "hash_table.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// A set of keys, using the same storage and probing as hash_table (see the
+// comment there) without the value, so a set of small keys doesn't pay for
+// the padding of a dummy value.
+//
+// _Hash_ is the type of the stored hashes. Use u32 to make entries even
+// smaller, e.g. hash_set<s32, u32> has 8 byte entries instead of 16. The
+// stored hash is just the truncated result of get_hash(), which is fine for
+// tables with less than 4 billion slots.
+//
+// Unlike hash_table, add() doesn't add a key twice.
+//
+// You can iterate over the set like this:
+//
+//      for (auto key : set) {
+//          ...
+//      }
+//
+template <typename K_, typename Hash_ = u64>
+struct hash_set {
+  static const s64 FIRST_VALID_HASH = 1;
+
+  static const s64 MINIMUM_SIZE = 32;
+  static const s64 LOAD_FACTOR_PERCENT = 60;
+
+  using K = K_;
+  using hash_t = Hash_;
+
+  static_assert(is_same<hash_t, u64> || is_same<hash_t, u32>);
+
+  struct entry {
+    hash_t Hash;
+    K Key;
+  };
+  array<entry> Entries;
+
+  s64 Count = 0;      // Number of slots in use
+  s64 Allocated = 0;  // Number of slots allocated in total
+
+  hash_set() = default;
+
+  hash_set(initializer_list<K> init) {
+    for (const auto &k : init) {
+      add(*this, k);
+    }
+  }
+};
+
+template <typename>
+const bool is_hash_set = false;
+
+template <typename K, typename Hash>
+const bool is_hash_set<hash_set<K, Hash>> = true;
+
+template <typename T>
+concept any_hash_set = is_hash_set<T>;
+
+template <typename K, typename Hash>
+const bool is_hash_table_like<hash_set<K, Hash>> = true;
+
+// Returns true if the key wasn't in the set already.
+template <any_hash_set T>
+bool add_prehashed(T ref set, u64 hash, table_key_t<T> no_copy key) {
+  u64 valid = hash_table_valid_hash<T>(hash);
+  if (hash_table_find_index(set, valid, key) != -1) return false;
+
+  hash_table_maybe_grow(set);
+  hash_table_insert_entry(set, {(typename T::hash_t) valid, key});
+  return true;
+}
+
+// Returns true if the key wasn't in the set already.
+template <any_hash_set T>
+bool add(T ref set, table_key_t<T> no_copy key) {
+  return add_prehashed(set, get_hash(key), key);
+}
+
+// Returns true if the set has the given key.
+template <any_hash_set T>
+bool has_prehashed(T ref set, u64 hash, table_key_t<T> no_copy key) {
+  return hash_table_find_index(set, hash_table_valid_hash<T>(hash), key) != -1;
+}
+
+// Returns true if the set has the given key.
+template <any_hash_set T>
+bool has(T ref set, table_key_t<T> no_copy key) {
+  return has_prehashed(set, get_hash(key), key);
+}
+
+// Returns true if the key was found and removed.
+template <any_hash_set T>
+bool remove_prehashed(T ref set, u64 hash, table_key_t<T> no_copy key) {
+  s64 index = hash_table_find_index(set, hash_table_valid_hash<T>(hash), key);
+  if (index == -1) return false;
+
+  hash_table_remove_index(set, index);
+  return true;
+}
+
+// Returns true if the key was found and removed.
+template <any_hash_set T>
+bool remove(T ref set, table_key_t<T> no_copy key) {
+  return remove_prehashed(set, get_hash(key), key);
+}
+
+//
+// Set algebra. These reserve the space they need once up front and reuse the
+// stored hashes, so no key gets hashed again.
+//
+
+// Adds all keys of _other_ to _set_
+template <any_hash_set T>
+void add_all(T ref set, T ref other) {
+  hash_table_maybe_grow(set, other.Count);
+
+  For(range(other.Allocated)) {
+    auto *entry = other.Entries.Data + it;
+    if (entry->Hash) add_prehashed(set, entry->Hash, entry->Key);
+  }
+}
+
+// Removes all keys which are not in _other_ from _set_
+template <any_hash_set T>
+void retain_all(T ref set, T ref other) {
+  // Removing shifts the next entry back into the current slot, so we look at
+  // the same slot again. Entries from the start of the array may wrap around
+  // to the end and get looked at twice, which is harmless.
+  s64 i = 0;
+  while (i < set.Allocated) {
+    auto *entry = set.Entries.Data + i;
+    if (entry->Hash && !has_prehashed(other, entry->Hash, entry->Key)) {
+      hash_table_remove_index(set, i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+// Returns a new set with the keys which are in _a_ or _b_
+template <any_hash_set T>
+T set_union(T ref a, T ref b) {
+  T result;
+  resize(result, (a.Count + b.Count) * 100 / T::LOAD_FACTOR_PERCENT + 1);
+  add_all(result, a);
+  add_all(result, b);
+  return result;
+}
+
+// Returns a new set with the keys which are in both _a_ and _b_
+template <any_hash_set T>
+T set_intersection(T ref a, T ref b) {
+  // Look up the keys of the smaller set in the bigger one
+  auto *smaller = &a, *bigger = &b;
+  if (smaller->Count > bigger->Count) smaller = &b, bigger = &a;
+
+  T result;
+  resize(result, smaller->Count * 100 / T::LOAD_FACTOR_PERCENT + 1);
+
+  For(range(smaller->Allocated)) {
+    auto *entry = smaller->Entries.Data + it;
+    if (entry->Hash && has_prehashed(*bigger, entry->Hash, entry->Key)) {
+      hash_table_insert_entry(result, *entry);
+    }
+  }
+  return result;
+}
+
+// Returns a new set with the keys which are in _a_ but not in _b_
+template <any_hash_set T>
+T set_difference(T ref a, T ref b) {
+  T result;
+  resize(result, a.Count * 100 / T::LOAD_FACTOR_PERCENT + 1);
+
+  For(range(a.Allocated)) {
+    auto *entry = a.Entries.Data + it;
+    if (entry->Hash && !has_prehashed(b, entry->Hash, entry->Key)) {
+      hash_table_insert_entry(result, *entry);
+    }
+  }
+  return result;
+}
+
+template <any_hash_set T>
+bool operator==(T ref a, T ref b) {
+  if (a.Count != b.Count) return false;
+
+  For(range(a.Allocated)) {
+    auto *entry = a.Entries.Data + it;
+    if (entry->Hash && !has_prehashed(b, entry->Hash, entry->Key)) return false;
+  }
+  return true;
+}
+
+template <any_hash_set T>
+bool operator!=(T ref a, T ref b) {
+  return !(a == b);
+}
+
+template <any_hash_set T>
+T clone(T ref src) {
+  T set;
+  add_all(set, src);
+  return set;
+}
+
+template <any_hash_set T>
+struct hash_set_iterator {
+  using hash_set_t = T;
+
+  hash_set_t ref Set;
+  s64 Index;
+
+  hash_set_iterator(T ref set, s64 index = 0) : Set(set), Index(index) {
+    skip_empty_slots();
+  }
+
+  hash_set_iterator &operator++() { return ++Index, skip_empty_slots(), *this; }
+
+  hash_set_iterator operator++(s32) {
+    hash_set_iterator pre = *this;
+    return ++*this, pre;
+  }
+
+  bool operator==(hash_set_iterator other) const {
+    return &Set == &other.Set && Index == other.Index;
+  }
+  bool operator!=(hash_set_iterator other) const { return !(*this == other); }
+
+  table_key_t<T> no_copy operator*() { return Set.Entries.Data[Index].Key; }
+
+  void skip_empty_slots() {
+    for (; Index < Set.Allocated; ++Index) {
+      if (Set.Entries.Data[Index].Hash) break;
+    }
+  }
+};
+
+auto begin(any_hash_set auto ref set) { return hash_set_iterator(set); }
+auto end(any_hash_set auto ref set) {
+  return hash_set_iterator(set, set.Allocated);
+}
+
+LSTD_END_NAMESPACE
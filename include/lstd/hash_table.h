@@ -26,20 +26,29 @@ using table_value_t = HashTableT::V;
 //
 // When looking up a value we perform the same process to find the correct slot.
 //
-// We use hash values to indicate whether slots are empty of removed. A hash of
-// 0 means that slot is not used, so new values an be put there. A hash of 1
-// means that slot used to be valid, but has been removed. A hash of 2 or higher
-// (FIRST_VALID_HASH) means this is a currently used slot.
+// We use the hash value to indicate whether a slot is empty. A hash of 0 means
+// that slot is not used, anything else (FIRST_VALID_HASH or higher) means this
+// is a currently used slot. When we hash a key and the result is 0, we just
+// use FIRST_VALID_HASH instead. This means that one value of the hash range
+// has double probabilty of collisions, but it's a small price to pay.
 //
-// Whether we hash a key, if the result is less than 2, we just add 2 to it to
-// put it in the valid range. This means that 4 values of the hash range have
-// double probabilty of collisions, but it's a small price to pay.
+// We can't use keys/values to indicate whether slots are empty, because they
+// can be of arbitrary type.
 //
-// We can't use keys/values to indicate whether slots are empty or removed,
-// because they can be of arbitrary type.
+// The probing is "Robin Hood" style: the distance of an entry from the slot its
+// hash maps to (its probe length) is known from the stored hash, and when
+// inserting we take the slot of any entry which is closer to home than the one
+// we are inserting, then continue inserting the displaced entry. This evens out
+// the probe lengths of all entries, and lets lookups stop early, as soon as
+// they see an entry closer to home than the key would be at that point.
+//
+// Removing shifts the following entries of the cluster back by one slot
+// (until an empty slot or an entry which is already at home), so there are no
+// "removed" markers which fill up the table and make lookups slower. Use
+// get_probe_stats() to see how well the table and the hash function do.
 //
 // This is a simple implementation, but still fast because we try to keep only
-// 70% of the table full at any time. If you are not memory constrained, just
+// 60% of the table full at any time. If you are not memory constrained, just
 // make the table bigger and it will get faster. Most of the queries are
 // satisfied in the first found slot. The hashing function is also very
 // important for this.
@@ -49,6 +58,18 @@ using table_value_t = HashTableT::V;
 // arrays that store data in the form hash-hash-hash, key-key-key leads to way
 // more constant number of cache misses.
 //
+// Growing normally moves every entry to the new array in one go, which for
+// big tables is a noticeable stall. Setting _Incremental_ to true instead
+// keeps the old array around after growing and moves a few of its entries on
+// every add/remove (see hash_table_migrate), lookups check both arrays until
+// it's empty. Searching doesn't move anything, so pointers from search() stay
+// valid until the next add/remove, same as without it.
+//
+// Zeroing a big new array is a stall too (mostly the OS faulting in fresh
+// pages), so once an incremental table is halfway to growing it allocates the
+// next array and zeroes a part of it on every add. This keeps up to three
+// arrays alive at a time, so it costs memory.
+//
 // Simple pair struct for initializer lists
 template <typename K, typename V>
 struct pair {
@@ -58,27 +79,58 @@ struct pair {
   pair(const K& k, const V& v) : first(k), second(v) {}
 };
 
+template <typename K, typename V>
+struct hash_table_entry {
+  u64 Hash;
+  K Key;
+  V Value;
+};
+
+// The old array of an incrementally growing hash_table. Has the same members
+// as the table, so the probing code below works on both.
+template <typename K_, typename V_>
+struct hash_table_migration {
+  static const s64 FIRST_VALID_HASH = 1;
+
+  using K = K_;
+  using V = V_;
+  using hash_t = u64;
+
+  using entry = hash_table_entry<K, V>;
+  array<entry> Entries;
+
+  s64 Count = 0;      // Entries which haven't been moved yet
+  s64 Allocated = 0;
+
+  s64 Index = 0;  // Slots before this one have been moved (and are empty)
+};
+
 template <typename K_, typename V_>
 struct hash_table {
-  static const s64 FIRST_VALID_HASH = 2;
+  static const s64 FIRST_VALID_HASH = 1;
 
   static const s64 MINIMUM_SIZE = 32;
   static const s64 LOAD_FACTOR_PERCENT = 60;
 
   using K = K_;
   using V = V_;
+  using hash_t = u64;
 
-  struct entry {
-    u64 Hash;
-    K Key;
-    V Value;
-  };
+  using entry = hash_table_entry<K, V>;
   array<entry> Entries;
 
-  s64 Count = 0;  // Number of slots in use
-  s64 SlotsFilled = 0;  // Number of slots that can't be used (valid + removed items)
+  s64 Count = 0;  // Number of slots in use (in both arrays when migrating)
   s64 Allocated = 0;  // Number of slots allocated in total, @Cleanup
 
+  // Grow without moving all entries at once, see the comment above
+  bool Incremental = false;
+  hash_table_migration<K, V> Migration;
+
+  // The array we grow into next, prepared ahead of time when _Incremental_,
+  // slots before _NextZeroed_ are ready to use
+  array<entry> NextEntries;
+  s64 NextZeroed = 0;
+
   // Default constructor
   hash_table() = default;
   
@@ -108,7 +160,30 @@ const bool is_hash_table<hash_table<K, V>> = true;
 template <typename T>
 concept any_hash_table = is_hash_table<T>;
 
+// Containers which share the probing code below (hash_table and hash_set,
+// see hash_set.h). They have an array of _Entries_, each with a _Hash_ of
+// type _hash_t_ and a _Key_.
+template <typename T>
+const bool is_hash_table_like = is_hash_table<T>;
+
+template <typename K, typename V>
+const bool is_hash_table_like<hash_table_migration<K, V>> = true;
+
+template <typename T>
+concept any_hash_table_like = is_hash_table_like<T>;
+
+// How many entries (or empty slots) of the old array a single add/remove
+// moves (or skips) while migrating. Moving a slot costs about as much as an
+// insert, so this bounds the extra work per operation. Values of 3 and up
+// finish the migration before the new array fills up (see
+// hash_table_grow_incrementally).
+inline const s64 HASH_TABLE_MIGRATE_STEPS = 16;
+
 template <any_hash_table T>
+void hash_table_migrate(T ref table, s64 steps = HASH_TABLE_MIGRATE_STEPS);
+
+// Also returned by the other hash maps (see swiss_table.h)
+template <typename T>
 struct key_value_pair {
   table_key_t<T> *Key;
   table_value_t<T> *Value;
@@ -125,7 +200,11 @@ struct key_value_pair {
 // _MINIMUM_SIZE_ and no specified alignment. You can call this before using the
 // hash table to initialize the arrays with a custom alignment (if that's
 // required).
-void resize(any_hash_table auto ref table, s64 slotsToAllocate, u32 alignment = 0) {
+void resize(any_hash_table_like auto ref table, s64 slotsToAllocate, u32 alignment = 0) {
+  if constexpr (is_hash_table<remove_cvref_t<decltype(table)>>) {
+    hash_table_migrate(table, numeric<s64>::max());
+  }
+
   if (slotsToAllocate < table.Allocated) return;
 
   s64 target = max<s64>(ceil_pow_of_2(slotsToAllocate), table.MINIMUM_SIZE);
@@ -138,30 +217,42 @@ void resize(any_hash_table auto ref table, s64 slotsToAllocate, u32 alignment =
 
   s64 oldAllocated = table.Allocated;
   table.Allocated = target;
+  table.Count = 0;
 
   // Add the old items
   For_as(it_index, range(oldAllocated)) {
     auto it = oldEntries.Data + it_index;
-    if (it->Hash >= table.FIRST_VALID_HASH)
-      add_prehashed(table, it->Hash, it->Key, it->Value);
+    if (it->Hash >= table.FIRST_VALID_HASH) hash_table_insert_entry(table, *it);
   }
 
   if (oldAllocated) free(oldEntries);
 }
 
 // Free any memory allocated by this object and reset count
-void free(any_hash_table auto ref table) {
+void free(any_hash_table_like auto ref table) {
+  if constexpr (is_hash_table<remove_cvref_t<decltype(table)>>) {
+    free(table.Migration);
+    table.Migration = {};
+    free(table.NextEntries);
+    table.NextZeroed = 0;
+  }
+
   free(table.Entries);
   table.Allocated = 0;
   table.Count = 0;
-  table.SlotsFilled = 0;
 }
 
 // Don't free the hash table, just destroy contents and reset count
-void reset(any_hash_table auto ref table) {
+void reset(any_hash_table_like auto ref table) {
+  if constexpr (is_hash_table<remove_cvref_t<decltype(table)>>) {
+    free(table.Migration);
+    table.Migration = {};
+    free(table.NextEntries);
+    table.NextZeroed = 0;
+  }
+
   For(range(table.Allocated)) { (table.Entries.Data + it)->Hash = 0; }
   table.Count = 0;
-  table.SlotsFilled = 0;
 }
 
 template <typename T>
@@ -173,25 +264,233 @@ bool compare_equals(T no_copy a, T no_copy b) {
   }
 }
 
+// Maps a hash to the range of stored hashes (0 marks empty slots),
+// truncating it first if the table stores smaller hashes
+template <any_hash_table_like T>
+u64 hash_table_valid_hash(u64 hash) {
+  hash = (typename T::hash_t) hash;
+  return hash < T::FIRST_VALID_HASH ? hash + T::FIRST_VALID_HASH : hash;
+}
+
+// How far the entry at _index_ is from the slot its hash maps to
+template <any_hash_table_like T>
+s64 hash_table_probe_length(T ref table, s64 index, u64 hash) {
+  return (index - (s64) hash) & (table.Allocated - 1);
+}
+
+// Returns the slot index of _key_ or -1. _hash_ must already be valid
+// (see hash_table_valid_hash).
+template <any_hash_table_like T>
+s64 hash_table_find_index(T ref table, u64 hash, table_key_t<T> no_copy key) {
+  if (!table.Count) return -1;
+
+  s64 mask = table.Allocated - 1;
+  s64 index = hash & mask;
+  for (s64 distance = 0;; ++distance) {
+    auto it = table.Entries.Data + index;
+
+    // Empty slot - not found
+    if (!it->Hash) return -1;
+
+    // Everything from here on is closer to home than our key would be,
+    // if it was in the table we would have put it here.
+    if (hash_table_probe_length(table, index, it->Hash) < distance) return -1;
+
+    if (it->Hash == hash && compare_equals(it->Key, key)) return index;
+
+    index = (index + 1) & mask;
+  }
+}
+
+// Puts _entry_ in the table, displacing entries which are closer to their
+// home slot than the one we are carrying (Robin Hood). Doesn't grow the
+// table, there must be space. Returns the slot index where _entry_ ended up.
+template <any_hash_table_like T>
+s64 hash_table_insert_entry(T ref table, typename T::entry no_copy entry) {
+  assert(table.Count < table.Allocated);
+
+  auto carry = entry;
+
+  s64 result = -1;
+
+  s64 mask = table.Allocated - 1;
+  s64 index = carry.Hash & mask;
+  for (s64 distance = 0;; ++distance) {
+    auto it = table.Entries.Data + index;
+
+    if (!it->Hash) {
+      *it = carry;
+      ++table.Count;
+      return result == -1 ? index : result;
+    }
+
+    s64 itDistance = hash_table_probe_length(table, index, it->Hash);
+    if (itDistance < distance) {
+      auto displaced = *it;
+      *it = carry;
+      carry = displaced;
+      distance = itDistance;
+      if (result == -1) result = index;
+    }
+
+    index = (index + 1) & mask;
+  }
+}
+
+// Removes the entry at _index_ by shifting the rest of its cluster back one
+// slot, so no "removed" markers are needed.
+template <any_hash_table_like T>
+void hash_table_remove_index(T ref table, s64 index) {
+  s64 mask = table.Allocated - 1;
+
+  while (true) {
+    s64 next = (index + 1) & mask;
+
+    auto nextEntry = table.Entries.Data + next;
+    if (!nextEntry->Hash ||
+        hash_table_probe_length(table, next, nextEntry->Hash) == 0)
+      break;
+
+    table.Entries.Data[index] = *nextEntry;
+    index = next;
+  }
+
+  table.Entries.Data[index].Hash = 0;
+  --table.Count;
+}
+
+// Moves up to _steps_ entries (or empty slots) from the old array of an
+// incrementally growing table to the new one, and frees the old array once
+// it's empty. Does nothing if the table isn't migrating.
+template <any_hash_table T>
+void hash_table_migrate(T ref table, s64 steps) {
+  auto ref old = table.Migration;
+
+  // Removing shifts the rest of the cluster back into the slot at _Index_,
+  // so we only move on once that slot is empty. The slots before _Index_ stay
+  // empty, removals never shift entries into them.
+  while (old.Count && steps--) {
+    auto *it = old.Entries.Data + old.Index;
+    if (!it->Hash) {
+      ++old.Index;
+      continue;
+    }
+
+    auto entry = *it;
+    hash_table_remove_index(old, old.Index);
+    --table.Count;  // The insert counts it again
+    hash_table_insert_entry(table, entry);
+  }
+
+  if (!old.Count && old.Allocated) {
+    free(old.Entries);
+    old = {};
+  }
+}
+
+// Once the table is halfway to growing, allocates the array it will grow
+// into and zeroes a part of it, paced so that it's done by the time we grow.
+template <any_hash_table T>
+void hash_table_prepare_next(T ref table) {
+  if (!table.Allocated || table.Migration.Count) return;
+
+  s64 growAt = table.Allocated * T::LOAD_FACTOR_PERCENT / 100;
+  if (!table.NextEntries.Allocated) {
+    if (table.Count < growAt / 2) return;
+    reserve(table.NextEntries, table.Allocated * 2);
+    table.NextZeroed = 0;
+  }
+
+  s64 left = table.NextEntries.Allocated - table.NextZeroed;
+  s64 addsLeft = max<s64>(growAt - table.Count, 1);
+  s64 n = (left + addsLeft - 1) / addsLeft;
+
+  memset0(table.NextEntries.Data + table.NextZeroed, n * sizeof(table.NextEntries.Data[0]));
+  table.NextZeroed += n;
+}
+
+// Like resize() but leaves the entries in the old array to be moved by later
+// calls to hash_table_migrate.
+template <any_hash_table T>
+void hash_table_grow_incrementally(T ref table, s64 fit) {
+  hash_table_migrate(table);
+  hash_table_prepare_next(table);
+  if ((table.Count + fit) * 100 < table.Allocated * T::LOAD_FACTOR_PERCENT)
+    return;
+
+  // The new array is at least twice as big as the old one, so it takes as
+  // many adds as the old one had entries to fill it up. The migration goes
+  // through all slots of the old array and moves each entry, which at the
+  // load factor is (100 + LOAD_FACTOR_PERCENT) / LOAD_FACTOR_PERCENT steps
+  // per entry, so we only get here with the last migration still running when
+  // adding a lot at once (big _fit_). Finish it, it's as much work as resize().
+  hash_table_migrate(table, numeric<s64>::max());
+
+  if (!table.Count) {
+    resize(table, (table.Count + fit) * 2);  // Nothing to move
+    return;
+  }
+
+  auto ref old = table.Migration;
+  old.Entries = table.Entries;
+  old.Allocated = table.Allocated;
+  old.Count = table.Count;
+  old.Index = 0;
+
+  s64 target = max<s64>(ceil_pow_of_2((table.Count + fit) * 2), T::MINIMUM_SIZE);
+
+  auto ref next = table.NextEntries;
+  if (next.Allocated == target) {
+    // Normally there is nothing left to zero
+    memset0(next.Data + table.NextZeroed, (target - table.NextZeroed) * sizeof(next.Data[0]));
+    table.Entries = next;
+  } else {
+    // Not prepared or prepared for a different size (after a resize() or when
+    // adding a lot at once)
+    free(next);
+    table.Entries = {};
+    reserve(table.Entries, target);
+    memset0(table.Entries.Data, target * sizeof(table.Entries.Data[0]));
+  }
+  next = {};
+  table.NextZeroed = 0;
+  table.Allocated = target;
+
+  hash_table_migrate(table);
+}
+
+// Grows the table if adding _fit_ more entries would go over the load factor
+template <any_hash_table_like T>
+void hash_table_maybe_grow(T ref table, s64 fit = 1) {
+  static_assert(T::LOAD_FACTOR_PERCENT < 100);  // 100 percent will cause infinite loop
+
+  if constexpr (is_hash_table<T>) {
+    if (table.Incremental) {
+      hash_table_grow_incrementally(table, fit);
+      return;
+    }
+  }
+
+  if ((table.Count + fit) * 100 >= table.Allocated * T::LOAD_FACTOR_PERCENT)
+    resize(table, (table.Count + fit) * 2);  // Double size
+}
+
 // Looks for key in the hash table using the given hash
 template <any_hash_table T>
 key_value_pair<T> search_prehashed(T ref table, u64 hash,
                                    table_key_t<T> no_copy key) {
-  if (!table.Count) return {null, null};
+  u64 valid = hash_table_valid_hash<T>(hash);
 
-  s64 index = hash & (table.Allocated - 1);
-  For_as(_, range(table.Allocated)) {
+  s64 index = hash_table_find_index(table, valid, key);
+  if (index != -1) {
     auto it = table.Entries.Data + index;
-    
-    // Empty slot - not found
-    if (it->Hash == 0)
-      return {null, null};
-    
-    if (it->Hash == hash && compare_equals(it->Key, key))
-      return {&it->Key, &it->Value};
-
-    ++index;
-    if (index >= table.Allocated) index = 0;
+    return {&it->Key, &it->Value};
+  }
+
+  index = hash_table_find_index(table.Migration, valid, key);
+  if (index != -1) {
+    auto it = table.Migration.Entries.Data + index;
+    return {&it->Key, &it->Value};
   }
   return {null, null};
 }
@@ -206,28 +505,11 @@ auto search_opt(T ref table, table_key_t<T> no_copy key, table_search_options op
 // Returns pointers to the added key and value.
 template <any_hash_table T>
 key_value_pair<T> add_prehashed(T ref table, u64 hash, table_key_t<T> no_copy key, table_value_t<T> no_copy value) {
-  static_assert(T::LOAD_FACTOR_PERCENT < 100);  // 100 percent will cause infinite loop
-
-  // The + 1 here handles the case when the hash table size is 1 and you add the
-  // first item.
-  if ((table.SlotsFilled + 1) * 100 >= table.Allocated * T::LOAD_FACTOR_PERCENT)
-    resize(table, table.SlotsFilled * 2);  // Double size
+  hash_table_maybe_grow(table);
 
-  assert(table.SlotsFilled < table.Allocated);
-
-  if (hash < table.FIRST_VALID_HASH) hash += table.FIRST_VALID_HASH;
-
-  s64 index = hash & (table.Allocated - 1);
-  while ((table.Entries.Data + index)->Hash) {
-    ++index;
-    if (index >= table.Allocated) index = 0;
-  }
-
-  ++table.Count;
-  ++table.SlotsFilled;
+  s64 index = hash_table_insert_entry(table, {hash_table_valid_hash<T>(hash), key, value});
 
   auto *entry = table.Entries.Data + index;
-  *entry = {hash, key, value};
   return {&entry->Key, &entry->Value};
 }
 
@@ -257,10 +539,20 @@ key_value_pair<T> set(T ref table, table_key_t<T> no_copy key,
 // Returns true if the key was found and removed.
 template <any_hash_table T>
 bool remove_prehashed(T ref table, u64 hash, table_key_t<T> no_copy key) {
-  auto [kp, vp] = search_prehashed(table, hash, key);
-  if (vp) {
-    s64 index = vp - table.Values;
-    table.Hashes[index] = 1;
+  hash_table_migrate(table);
+
+  u64 valid = hash_table_valid_hash<T>(hash);
+
+  s64 index = hash_table_find_index(table, valid, key);
+  if (index != -1) {
+    hash_table_remove_index(table, index);
+    return true;
+  }
+
+  index = hash_table_find_index(table.Migration, valid, key);
+  if (index != -1) {
+    hash_table_remove_index(table.Migration, index);
+    --table.Count;
     return true;
   }
   return false;
@@ -281,12 +573,122 @@ bool has(T ref table, table_key_t<T> no_copy key) {
 // Returns true if the hash table has the given key.
 template <any_hash_table T>
 bool has_prehashed(T ref table, u64 hash, table_key_t<T> no_copy key) {
-  return search_prehashed(table, hash, key) != null;
+  return search_prehashed(table, hash, key).Key != null;
+}
+
+// How many lookups search_batch/has_batch have in flight at once
+inline const s64 HASH_TABLE_BATCH_SIZE = 16;
+
+// Tables smaller than this (in bytes) are probably in the cache already,
+// the batched lookups just look the keys up one by one
+inline const s64 HASH_TABLE_BATCH_MIN_BYTES = 256_KiB;
+
+// Looks up every key of _keys_ and calls _found_(index, key_value_pair).
+//
+// For tables much bigger than the cache, each search() waits on its own
+// cache miss. This hashes keys HASH_TABLE_BATCH_SIZE ahead of the one being
+// looked up and prefetches their home slots, so the misses overlap.
+template <any_hash_table T>
+void hash_table_search_batch(T ref table, array<table_key_t<T>> keys, auto found) {
+  s64 bytes = (table.Allocated + table.Migration.Allocated) * sizeof(typename T::entry);
+  if (bytes < HASH_TABLE_BATCH_MIN_BYTES) {
+    For(range(keys.Count)) found(it, search(table, keys.Data[it]));
+    return;
+  }
+
+  // Indexed by key index modulo the batch size
+  u64 hashes[HASH_TABLE_BATCH_SIZE];
+
+  auto hash_and_prefetch = [&](s64 index) {
+    u64 hash = get_hash(keys.Data[index]);
+    hashes[index % HASH_TABLE_BATCH_SIZE] = hash;
+
+    u64 valid = hash_table_valid_hash<T>(hash);
+    prefetch_for_read(table.Entries.Data + (valid & (table.Allocated - 1)));
+    if (table.Migration.Count) {
+      auto ref old = table.Migration;
+      prefetch_for_read(old.Entries.Data + (valid & (old.Allocated - 1)));
+    }
+  };
+
+  For(range(min(keys.Count, HASH_TABLE_BATCH_SIZE))) hash_and_prefetch(it);
+
+  For(range(keys.Count)) {
+    u64 hash = hashes[it % HASH_TABLE_BATCH_SIZE];
+    if (it + HASH_TABLE_BATCH_SIZE < keys.Count) {
+      hash_and_prefetch(it + HASH_TABLE_BATCH_SIZE);
+    }
+    found(it, search_prehashed(table, hash, keys.Data[it]));
+  }
+}
+
+// Looks up every key of _keys_ and puts the result at the same index in
+// _results_ (which must be at least as long). Faster than calling search()
+// in a loop for tables which don't fit in the cache, see
+// hash_table_search_batch.
+template <any_hash_table T>
+void search_batch(T ref table, array<table_key_t<T>> keys,
+                  array<key_value_pair<T>> results) {
+  assert(results.Count >= keys.Count);
+  hash_table_search_batch(table, keys, [&](s64 index, key_value_pair<T> result) {
+    results.Data[index] = result;
+  });
+}
+
+// Like search_batch() but only says whether each key is in the table.
+// Returns how many were.
+template <any_hash_table T>
+s64 has_batch(T ref table, array<table_key_t<T>> keys, array<bool> results) {
+  assert(results.Count >= keys.Count);
+
+  s64 count = 0;
+  hash_table_search_batch(table, keys, [&](s64 index, key_value_pair<T> result) {
+    results.Data[index] = result.Key != null;
+    count += result.Key != null;
+  });
+  return count;
+}
+
+// Probe length is how many slots after its home slot an entry ended up in,
+// a lookup of that key looks at (probe length + 1) entries.
+struct hash_table_probe_stats {
+  s64 Count;
+  s64 Allocated;
+
+  s64 MaxProbeLength;
+  f64 AverageProbeLength;
+
+  // Histogram[i] is the number of entries with probe length i,
+  // the last bucket counts everything longer too.
+  s64 Histogram[16];
+};
+
+// Walks the whole table, meant for tuning and debugging
+template <any_hash_table_like T>
+hash_table_probe_stats get_probe_stats(T ref table) {
+  hash_table_probe_stats result = {};
+  result.Count = table.Count;
+  result.Allocated = table.Allocated;
+
+  // Only looks at the new array of an incrementally growing hash_table
+  s64 total = 0, count = 0;
+  For(range(table.Allocated)) {
+    auto entry = table.Entries.Data + it;
+    if (!entry->Hash) continue;
+
+    s64 length = hash_table_probe_length(table, it, entry->Hash);
+    result.MaxProbeLength = max(result.MaxProbeLength, length);
+    result.Histogram[min<s64>(length, 15)]++;
+    total += length;
+    ++count;
+  }
+  if (count) result.AverageProbeLength = (f64) total / count;
+  return result;
 }
 
 template <any_hash_table T>
 bool operator==(T ref t, T ref u) {
-  if (t.Entries.Count != u.Entries.Count) return false;
+  if (t.Count != u.Count) return false;
 
   for (auto [k, v] : t) {
     if (!has(u, *k)) return false;
@@ -303,6 +705,7 @@ bool operator!=(T ref t, T ref u) {
 template <any_hash_table T>
 T clone(T ref src) {
   T table;
+  table.Incremental = src.Incremental;
   for (auto [k, v] : src) add(table, *k, *v);
   return table;
 }
@@ -332,20 +735,27 @@ struct hash_table_iterator {
   bool operator!=(hash_table_iterator other) const { return !(*this == other); }
 
   key_value_pair<hash_table_t> operator*() {
-    auto *entry = Table.Entries.Data + Index;
+    auto *entry = get_entry();
     return {&entry->Key, &entry->Value};
   }
 
+  // Indices past the new array are in the old one (when migrating)
+  auto *get_entry() {
+    if (Index < Table.Allocated) return Table.Entries.Data + Index;
+    return Table.Migration.Entries.Data + (Index - Table.Allocated);
+  }
+
   void skip_empty_slots() {
-    for (; Index < Table.Allocated; ++Index) {
-      if ((Table.Entries.Data + Index)->Hash >= Table.FIRST_VALID_HASH) break;
+    for (; Index < Table.Allocated + Table.Migration.Allocated; ++Index) {
+      if (get_entry()->Hash >= Table.FIRST_VALID_HASH) break;
     }
   }
 };
 
 auto begin(any_hash_table auto ref table) { return hash_table_iterator(table); }
 auto end(any_hash_table auto ref table) {
-  return hash_table_iterator(table, table.Allocated);
+  return hash_table_iterator(table,
+                             table.Allocated + table.Migration.Allocated);
 }
 
 // Helper function to create hash tables from initializer lists
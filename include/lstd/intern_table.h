@@ -0,0 +1,161 @@
+#pragma once
+
+#include "concurrent_hash_table.h"
+#include "xar.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// Interning maps each unique string to a small integer (an atom). The first
+// time a string is interned it's copied into the table's arena and gets the
+// next atom (atoms are dense, starting at 0), after that interning an equal
+// string returns the same atom. Comparing atoms is an integer compare, and
+// the string of an atom is an O(1) lookup, so identifiers can be hashed and
+// compared once when they come in and never again.
+//
+//      intern_table names;
+//      defer(free(names));
+//
+//      u32 a = intern(names, "foo");
+//      u32 b = intern(names, some_string);  // == a if some_string is "foo"
+//      string s = intern_get(names, a);      // "foo"
+//
+// The strings are never freed individually, so they (and the chunks of
+// _Strings_) are bump allocated straight from the arena, without the
+// allocation header that malloc adds. Strings returned by intern_get() stay
+// valid until the table is freed.
+//
+// concurrent_intern_table (below) is the variant for symbol tables shared
+// between threads.
+//
+
+// Allocates _size_ bytes from _arena_, aligned to _alignment_
+inline void *intern_table_arena_allocate(arena_allocator_data *arena, s64 size, s64 alignment = 1) {
+  void *block = arena_allocator(allocator_mode::ALLOCATE, arena, size + alignment - 1, null, 0, 0);
+  assert(block && "Arena is full");
+  return (void *) (((u64) block + alignment - 1) & ~(u64) (alignment - 1));
+}
+
+// Copies _s_ into _arena_, appends it to _strings_ and returns its index,
+// which is the new atom. Chunks of _strings_ also come from the arena.
+inline u32 intern_table_add_string(exponential_array<string> ref strings,
+                                   arena_allocator_data *arena, string no_copy s) {
+  assert(strings.Count < (u32) -1 && "Too many interned strings");
+
+  using strings_t = remove_cvref_t<decltype(strings)>;
+
+  usize index = strings.Count;
+  usize chunk = strings_t::chunk_index(index);
+  if (!strings.Chunks[chunk]) {
+    usize capacity = strings_t::chunk_capacity(chunk);
+    strings.Chunks[chunk] = (string *) intern_table_arena_allocate(
+        arena, capacity * sizeof(string), alignof(string));
+  }
+
+  string copy;
+  copy.Data = (char *) intern_table_arena_allocate(arena, s.Count);
+  copy.Count = s.Count;
+  memcpy(copy.Data, s.Data, s.Count);
+
+  ++strings.Count;
+  strings.get(index) = copy;
+  return (u32) index;
+}
+
+struct intern_table {
+  hash_table<string, u32> Atoms;  // Keys point into _Arena_
+
+  exponential_array<string> Strings;  // Indexed by atom, never moves
+  arena_allocator_data Arena;
+};
+
+// Returns the atom of _s_, adding it if it's not in the table yet
+inline u32 intern(intern_table ref table, string no_copy s) {
+  u64 hash = get_hash(s);
+
+  auto [key, value] = search_prehashed(table.Atoms, hash, s);
+  if (value) return *value;
+
+  u32 atom = intern_table_add_string(table.Strings, &table.Arena, s);
+  add_prehashed(table.Atoms, hash, table.Strings[atom], atom);
+  return atom;
+}
+
+// Returns the atom of _s_ or -1 if it hasn't been interned, without adding it
+inline s64 intern_search(intern_table ref table, string no_copy s) {
+  auto [key, value] = search(table.Atoms, s);
+  return value ? (s64) *value : -1;
+}
+
+// Returns the interned string of _atom_ (which points into the table's arena)
+inline string intern_get(intern_table ref table, u32 atom) {
+  return table.Strings[atom];
+}
+
+// Number of unique strings interned so far
+inline s64 intern_count(intern_table ref table) { return table.Strings.Count; }
+
+inline void free(intern_table ref table) {
+  free(table.Atoms);
+  table.Strings = {};
+  arena_allocator_release(&table.Arena);
+  table.Arena = {};
+}
+
+//
+// Like intern_table but safe to use from many threads at once.
+//
+// Atoms are looked up in a concurrent_hash_table, so interning strings which
+// are already in the table only takes a shared lock on one shard. Adding a
+// new string additionally takes _Lock_ for the arena and _Strings_.
+//
+// intern_get() takes no locks at all: _Strings_ is an exponential array
+// whose elements never move, and an atom is only handed out after its
+// string has been written.
+//
+struct concurrent_intern_table {
+  concurrent_hash_table<string, u32> Atoms;  // Keys point into _Arena_
+
+  exponential_array<string> Strings;  // Indexed by atom, never moves
+  arena_allocator_data Arena;
+
+  fast_mutex Lock;  // Guards _Arena_ and adding to _Strings_
+};
+
+inline u32 intern(concurrent_intern_table ref table, string no_copy s) {
+  // The table stores the key after make() returns, so make() swaps it for
+  // the copy in the arena (which has the same hash).
+  string key = s;
+  auto [atom, inserted] = get_or_insert(table.Atoms, key, [&]() {
+    lock(&table.Lock);
+    defer(unlock(&table.Lock));
+
+    u32 result = intern_table_add_string(table.Strings, &table.Arena, s);
+    key = table.Strings[result];
+    return result;
+  });
+  return atom;
+}
+
+inline s64 intern_search(concurrent_intern_table ref table, string no_copy s) {
+  auto [atom, found] = search(table.Atoms, s);
+  return found ? (s64) atom : -1;
+}
+
+inline string intern_get(concurrent_intern_table ref table, u32 atom) {
+  return table.Strings[atom];
+}
+
+inline s64 intern_count(concurrent_intern_table ref table) {
+  return concurrent_hash_table_count(table.Atoms);
+}
+
+// Not thread-safe, no other thread may use the table while it's freed
+inline void free(concurrent_intern_table ref table) {
+  free(table.Atoms);
+  table.Strings = {};
+  arena_allocator_release(&table.Arena);
+  table.Arena = {};
+}
+
+LSTD_END_NAMESPACE
@@ -6,18 +6,25 @@
 #include "bits.h"
 #include "clap.h"
 #include "common.h"
+#include "concurrent_hash_table.h"
 #include "context.h"
 #include "delegate.h"
 #include "fmt.h"
+#include "hash_set.h"
 #include "hash_table.h"
+#include "intern_table.h"
 #include "linked_list_like.h"
 #include "memory.h"
+#include "memory_profiler.h"
 #include "os.h"
 #include "parse.h"
 #include "qsort.h"
+#include "slot_map.h"
 #include "stack_array.h"
+#include "static_perfect_map.h"
 #include "string.h"
 #include "string_builder.h"
+#include "swiss_table.h"
 #include "variant.h"
 #include "writer.h"
 
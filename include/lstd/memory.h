@@ -1,5 +1,6 @@
 #pragma once
 
+#include "atomic.h"
 #include "common.h"
 #include "vendor/tlsf/tlsf.h"
 
@@ -147,9 +148,8 @@ LSTD_BEGIN_NAMESPACE
 // For each allocation we reserve a bit of space before a block to store a
 // header with information (the size of the allocation, the alignment, the
 // allocator with which it was allocated, and debugging info if DEBUG_MEMORY is
-// defined - see comments in allocator.h).
-//              (@TODO * this overhead should become smaller, right now we
-//              haven't bothered yet!)
+// defined - see comments in allocator.h). Most blocks get a compact header of
+// just a few bytes, see :CompactHeader:.
 //
 // There is one big assumption we make:
 //   Your types are "trivially copyable" which means that they can be copied
@@ -186,11 +186,11 @@ LSTD_BEGIN_NAMESPACE
 //
 // Allocators in this library are a pair of a function pointer and a data
 // pointer. The single function is responsible for doing all stuff (ALLOCATE,
-// RESIZE, FREE, FREE_ALL). The data pointer can point to any custom structure
-// or data the allocator needs in order to do it's job.
+// RESIZE, FREE, FREE_ALL, TRIM, QUERY_STATS). The data pointer can point to
+// any custom structure or data the allocator needs in order to do it's job.
 //
 
-enum class allocator_mode { ALLOCATE, RESIZE, FREE, FREE_ALL };
+enum class allocator_mode { ALLOCATE, RESIZE, FREE, FREE_ALL, TRIM, QUERY_STATS };
 
 // :AllocationFlags:
 // Allocations marked explicitly as leaks don't get reported when calling
@@ -203,9 +203,13 @@ inline const u64 LEAK = 1ull << 63;
 // like.
 //
 // _mode_ is what we are doing currently: allocating, resizing, freeing a
-// block or freeing everything
+// block, freeing everything or trimming (giving unused memory back to the OS)
 //      Note: * Implementing FREE_ALL is not a requirement, some allocators
 //      can't support this by design.
+//            * TRIM is a hint, allocators which don't keep memory around can
+//      just ignore it.
+//            * QUERY_STATS passes an allocator_stats in _oldMemory_. Return
+//      it after filling it in, or null if you don't keep stats.
 //
 // _context_ is used as a pointer to any data the allocator needs as state
 // _size_ is the size of the allocation
@@ -271,6 +275,28 @@ struct allocator {
 
 void free_all(allocator alloc, u64 options = 0);
 
+// Asks the allocator to give memory it doesn't use back to the OS, e.g. empty
+// TLSF pools or the committed tail of an arena past its used part. Call this
+// after a load spike so the resident memory of the process can fall again.
+void trim(allocator alloc, u64 options = 0);
+
+// What an allocator reports for QUERY_STATS. Sizes are in bytes as the
+// allocator sees them, i.e. including allocation headers and rounding.
+// Keeping these up to date costs a few adds per call, so they are cheap
+// enough to poll (e.g. export as metrics every second).
+struct allocator_stats {
+  s64 Used;       // In blocks handed out right now
+  s64 PeakUsed;   // The highest _Used_ has been
+  s64 Committed;  // Memory the allocator holds (used or not)
+
+  s64 FreeBlockCount;
+  s64 LargestFreeBlock;  // Requests up to this size succeed without growing
+};
+
+// Asks the allocator how full it is. Returns false if it doesn't support
+// QUERY_STATS (_stats_ is then left zeroed).
+bool query_stats(allocator alloc, allocator_stats *stats);
+
 template <typename T>
 struct allocator_with_context {
   allocator_func_t Function;
@@ -402,11 +428,39 @@ requires(!is_const<T>) void free(
 //   specialized allocator (arena allocator, pool allocator, etc.)
 //
 
+// Prefixed to pools which we allocated from the OS ourselves
+struct tlsf_os_pool {
+  tlsf_os_pool *Next;
+  pool_t Pool;  // The handle from the tlsf library
+};
+
 struct tlsf_allocator_data {
   tlsf_t State =
       null;  // We use a vendor library that implements the algorithm.
+
+  // Pools allocated by tlsf_allocator_add_pool() with _osOptions_. TRIM gives
+  // back the ones which are empty, tlsf_allocator_release() frees all of them.
+  tlsf_os_pool *OSPools = null;
+
+  // For QUERY_STATS. _Committed_ counts the bytes of the pools which can be
+  // handed out (without tlsf's own bookkeeping).
+  s64 Used = 0, PeakUsed = 0, Committed = 0;
 };
 
+inline void tlsf_count_used_blocks(void *ptr, u64 size, int used, void *user) {
+  if (used) *(s64 *)user += 1;
+}
+
+inline void tlsf_sum_block_sizes(void *ptr, u64 size, int used, void *user) {
+  *(s64 *)user += size;
+}
+
+inline s64 tlsf_pool_capacity(pool_t pool) {
+  s64 result = 0;
+  tlsf_walk_pool(pool, tlsf_sum_block_sizes, &result);
+  return result;
+}
+
 //
 // Two-Level Segregated Fit memory allocator implementation. Wrapper around
 // tlsf.h/cpp (in vendor folder), written by Matthew Conte (matt@baisoku.org).
@@ -417,6 +471,9 @@ struct tlsf_allocator_data {
 // * Low overhead per TLSF management of pools (~3kB)
 // * Low fragmentation
 //
+// TRIM gives empty pools which were allocated from the OS back to it (except
+// the pool which holds the allocator's control structure).
+//
 inline void *tlsf_allocator(allocator_mode mode, void *context, s64 size,
                             void *oldMemory, s64 oldSize, u64 options) {
   assert(context);
@@ -431,11 +488,26 @@ inline void *tlsf_allocator(allocator_mode mode, void *context, s64 size,
   }
 
   switch (mode) {
-    case allocator_mode::ALLOCATE:
-      return tlsf_malloc(data->State, size);
-    case allocator_mode::RESIZE:
-      return tlsf_resize(data->State, oldMemory, size);
+    case allocator_mode::ALLOCATE: {
+      void *result = tlsf_malloc(data->State, size);
+      if (result) {
+        data->Used += tlsf_block_size(result);
+        data->PeakUsed = max(data->PeakUsed, data->Used);
+      }
+      return result;
+    }
+    case allocator_mode::RESIZE: {
+      s64 before = tlsf_block_size(oldMemory);
+
+      void *result = tlsf_resize(data->State, oldMemory, size);
+      if (result) {
+        data->Used += tlsf_block_size(result) - before;
+        data->PeakUsed = max(data->PeakUsed, data->Used);
+      }
+      return result;
+    }
     case allocator_mode::FREE: {
+      data->Used -= tlsf_block_size(oldMemory);
       tlsf_free(data->State, oldMemory);
       return null;
     }
@@ -443,31 +515,306 @@ inline void *tlsf_allocator(allocator_mode mode, void *context, s64 size,
       assert(false);  // Some allocators can't support this by design
       return null;
     }
+    case allocator_mode::TRIM: {
+      void os_free_block(void *);
+
+      pool_t controlPool = tlsf_get_pool(data->State);
+
+      auto **link = &data->OSPools;
+      while (*link) {
+        auto *p = *link;
+
+        s64 used = 0;
+        if (p->Pool != controlPool) {
+          tlsf_walk_pool(p->Pool, tlsf_count_used_blocks, &used);
+        }
+
+        if (p->Pool == controlPool || used) {
+          link = &p->Next;
+          continue;
+        }
+
+        data->Committed -= tlsf_pool_capacity(p->Pool);
+        tlsf_remove_pool(data->State, p->Pool);
+        *link = p->Next;
+        os_free_block(p);
+      }
+      return null;
+    }
+    case allocator_mode::QUERY_STATS: {
+      auto *stats = (allocator_stats *)oldMemory;
+      stats->Used = data->Used;
+      stats->PeakUsed = data->PeakUsed;
+      stats->Committed = data->Committed;
+
+      u64 freeBlockCount, largestFreeBlock;
+      tlsf_free_stats(data->State, &freeBlockCount, &largestFreeBlock);
+      stats->FreeBlockCount = (s64)freeBlockCount;
+      stats->LargestFreeBlock = (s64)largestFreeBlock;
+      return stats;
+    }
   }
   return null;
 }
 
 inline void tlsf_allocator_add_pool(tlsf_allocator_data *data, void *block,
                                     s64 size) {
+  pool_t pool;
   if (!data->State) {
     data->State = tlsf_create_with_pool(block, (u64)size);
+    pool = tlsf_get_pool(data->State);
   } else {
-    tlsf_add_pool(data->State, block, (u64)size);
+    pool = tlsf_add_pool(data->State, block, (u64)size);
   }
+  data->Committed += tlsf_pool_capacity(pool);
 }
 
 // Assumes the block exists
 inline void tlsf_allocator_remove_pool(tlsf_allocator_data *data, void *block) {
+  data->Committed -= tlsf_pool_capacity(block);
   tlsf_remove_pool(data->State, block);
 }
 
+//
+// Options for os_allocate_block() and os_commit_block(). Arenas pass them
+// when committing (see arena_allocator_data::PageOptions) and the platform
+// allocators use PLATFORM_MEMORY_OPTIONS (see os/memory.h).
+//
+// OS_ALLOCATE_HUGE_PAGES asks for 2 MiB pages, which cuts down TLB misses
+// for large pools and arenas. On Linux we first try MAP_HUGETLB (which needs
+// pages reserved by the admin) and fall back to madvise(MADV_HUGEPAGE)
+// (transparent huge pages). Sizes get rounded up to OS_HUGE_PAGE_SIZE.
+//
+// OS_ALLOCATE_POPULATE prefaults the pages (MAP_POPULATE) so the first
+// touch of each page doesn't take a page fault.
+//
+// Both are hints, if the OS can't do them we silently get normal pages.
+//
+inline const u64 OS_ALLOCATE_HUGE_PAGES = 1ull << 0;
+inline const u64 OS_ALLOCATE_POPULATE = 1ull << 1;
+
+inline const s64 OS_HUGE_PAGE_SIZE = 2_MiB;
+
+// os_allocate_block() stores the size of the mapping in front of the block
+// (so os_free_block() can unmap all of it). Subtract OS_BLOCK_HEADER_SIZE from
+// the requested size to make the mapping a whole number of pages.
+struct os_block_header {
+  s64 Size;  // Of the whole mapping, including this header
+  u64 Options;
+};
+inline const s64 OS_BLOCK_HEADER_SIZE = sizeof(os_block_header);
+
+// Returns how many bytes of a block from os_allocate_block() are usable.
+// May be more than requested since the mapping is a whole number of pages.
+inline s64 os_block_size(void *ptr) {
+  return ((os_block_header *)ptr - 1)->Size - OS_BLOCK_HEADER_SIZE;
+}
+
+// Allocates a pool from the OS (with _osOptions_, see OS_ALLOCATE_HUGE_PAGES)
+// and adds it to the TLSF. The allocator owns the pool, see _OSPools_.
+// Returns false if the OS is out of memory. With huge pages the pool gets
+// rounded up to whole huge pages.
+inline bool tlsf_allocator_add_pool(tlsf_allocator_data *data, s64 size,
+                                    u64 osOptions) {
+  void *os_allocate_block(s64, u64);
+
+  auto *p = (tlsf_os_pool *)os_allocate_block(sizeof(tlsf_os_pool) + size,
+                                              osOptions);
+  if (!p) return false;
+
+  void *block = p + 1;
+  size = os_block_size(p) - sizeof(tlsf_os_pool);
+
+  if (!data->State) {
+    data->State = tlsf_create_with_pool(block, (u64)size);
+    p->Pool = tlsf_get_pool(data->State);
+  } else {
+    p->Pool = tlsf_add_pool(data->State, block, (u64)size);
+  }
+  data->Committed += tlsf_pool_capacity(p->Pool);
+
+  p->Next = data->OSPools;
+  data->OSPools = p;
+  return true;
+}
+
+// Gives all pools allocated by the allocator back to the OS. Pools which you
+// added yourself are left alone, but if the control structure lived in one of
+// ours they can't be used anymore. The allocator can be used again after
+// adding a pool.
+inline void tlsf_allocator_release(tlsf_allocator_data *data) {
+  void os_free_block(void *);
+  void allocator_registry_remove(void *);
+
+  allocator_registry_remove(data);
+
+  // The control structure lives in the first pool, free that one last
+  pool_t controlPool = data->State ? tlsf_get_pool(data->State) : null;
+
+  tlsf_os_pool *control = null;
+
+  auto *p = data->OSPools;
+  while (p) {
+    auto *next = p->Next;
+    if (p->Pool == controlPool) {
+      control = p;
+    } else {
+      os_free_block(p);
+    }
+    p = next;
+  }
+  if (control) os_free_block(control);
+
+  data->State = null;
+  data->OSPools = null;
+  data->Used = 0;
+  data->Committed = 0;
+}
+
+// Arenas which reserve their address space (see arena_allocator_reserve())
+// commit memory in steps of this size as the bump pointer advances.
+inline const s64 ARENA_COMMIT_GRANULARITY = 64_KiB;
+
+// How much address space a 0-initialized arena reserves on first use.
+// Reserving doesn't cost physical memory, only page table bookkeeping, but
+// every thread gets such arenas (the temporary allocator and the scratch
+// arenas, see context.h), so this is kept modest. Arenas which need more
+// call arena_allocator_reserve() with a bigger size before first use.
+#if BITS == 64
+inline const s64 ARENA_DEFAULT_RESERVE = 8_GiB;
+#else
+inline const s64 ARENA_DEFAULT_RESERVE = 8_MiB;
+#endif
+
+// By default how much committed memory an arena keeps after FREE_ALL.
+inline const s64 ARENA_DEFAULT_HIGH_WATER_MARK = 1_MiB;
+
 struct arena_allocator_data {
   void *Block = null; 
   s64 Size = 0;
 
   s64 Used = 0;
+  s64 PeakUsed = 0;  // For QUERY_STATS
+
+  // Set when _Block_ is a reserved range of address space (which we own)
+  // rather than memory provided by the user. In that case only the first
+  // _Committed_ bytes are backed by memory and we commit more on demand.
+  bool Virtual = false;
+  s64 Committed = 0;
+
+  // On FREE_ALL virtual arenas decommit everything above this, so a single
+  // spike doesn't keep physical memory around forever.
+  s64 HighWaterMark = ARENA_DEFAULT_HIGH_WATER_MARK;
+
+  // Passed to os_commit_block() by virtual arenas, e.g. to back the arena
+  // with huge pages. See OS_ALLOCATE_HUGE_PAGES.
+  u64 PageOptions = 0;
+
+  // The range we got from the OS, which is what we give back on release.
+  // With huge pages _Block_ starts at the first huge page boundary in it.
+  void *ReservedBlock = null;
+  s64 ReservedSize = 0;
 };
 
+// Virtual arenas with huge pages commit whole huge pages at a time
+inline s64 arena_commit_granularity(arena_allocator_data *data) {
+  if (data->PageOptions & OS_ALLOCATE_HUGE_PAGES) return OS_HUGE_PAGE_SIZE;
+  return ARENA_COMMIT_GRANULARITY;
+}
+
+// Reserves _reserve_ bytes of address space for the arena. Memory is then
+// committed as the arena grows (in steps of ARENA_COMMIT_GRANULARITY, or
+// OS_HUGE_PAGE_SIZE with huge pages, see _PageOptions_), which makes the
+// arena practically unbounded without ever moving memory.
+// Returns false if the OS refused to reserve the range.
+inline bool arena_allocator_reserve(arena_allocator_data *data,
+                                    s64 reserve = ARENA_DEFAULT_RESERVE) {
+  void *os_reserve_block(s64);
+
+  assert(!data->Block && "Arena already has a block");
+
+  // The OS can only back huge page aligned ranges with huge pages, so we
+  // reserve an extra huge page and start the arena at the first boundary
+  s64 alignment = 0;
+  if (data->PageOptions & OS_ALLOCATE_HUGE_PAGES) {
+    alignment = OS_HUGE_PAGE_SIZE;
+  }
+
+  data->ReservedBlock = os_reserve_block(reserve + alignment);
+  if (!data->ReservedBlock) return false;
+  data->ReservedSize = reserve + alignment;
+
+  data->Block = data->ReservedBlock;
+  if (alignment) {
+    u64 base = (u64)data->ReservedBlock;
+    data->Block = (void *)((base + alignment - 1) & -alignment);
+  }
+
+  data->Size = reserve;
+  data->Used = 0;
+  data->Virtual = true;
+  data->Committed = 0;
+  return true;
+}
+
+// Gives the reserved range back to the OS. For arenas with a block provided
+// by the user (you own that) this only frees the arena's slot in the
+// allocator registry, see :AllocatorRegistry:. With DEBUG_MEMORY call
+// free_all before this, otherwise live allocations in the arena stay in the
+// debug list and verifying the heap touches released memory.
+inline void arena_allocator_release(arena_allocator_data *data) {
+  void os_release_block(void *, s64);
+  void allocator_registry_remove(void *);
+
+  allocator_registry_remove(data);
+  if (!data->Virtual) return;
+
+  os_release_block(data->ReservedBlock, data->ReservedSize);
+  data->ReservedBlock = null;
+  data->ReservedSize = 0;
+  data->Block = null;
+  data->Size = 0;
+  data->Used = 0;
+  data->Virtual = false;
+  data->Committed = 0;
+}
+
+// Gives the committed memory of a virtual arena past the first _keep_ bytes
+// (rounded up to the commit granularity) back to the OS
+inline void arena_allocator_decommit_above(arena_allocator_data *data,
+                                           s64 keep) {
+  void os_decommit_block(void *, s64);
+
+  if (!data->Virtual) return;
+
+  s64 granularity = arena_commit_granularity(data);
+
+  keep = (keep + granularity - 1) & -granularity;
+  if (keep < data->Committed) {
+    os_decommit_block((byte *)data->Block + keep, data->Committed - keep);
+    data->Committed = keep;
+  }
+}
+
+// Makes sure the first _required_ bytes of a virtual arena are committed
+inline bool arena_allocator_commit(arena_allocator_data *data, s64 required) {
+  bool os_commit_block(void *, s64, u64);
+
+  if (!data->Virtual || required <= data->Committed) return true;
+
+  s64 granularity = arena_commit_granularity(data);
+
+  s64 target = (required + granularity - 1) & -granularity;
+  if (target > data->Size) target = data->Size;
+
+  if (!os_commit_block((byte *)data->Block + data->Committed,
+                       target - data->Committed, data->PageOptions)) {
+    return false;
+  }
+  data->Committed = target;
+  return true;
+}
+
 //
 // Arena allocator.
 //
@@ -477,36 +824,43 @@ struct arena_allocator_data {
 // anymore. Note that free_all doesn't free the added block, but instead
 // resets its pointer to the beginning of the buffer.
 //
-// The arena allocator doesn't handle overflows (when the block doesn't have
-// enough space for an allocation). When out of memory, you should resize or
-// provide another block.
+// When you provide the block yourself the arena doesn't handle overflows (when
+// the block doesn't have enough space for an allocation). When out of memory,
+// you should resize or provide another block.
 //
-// 0-initialized arena is valid, since in that case we just virtual alloc a 
-// block on the first allocation request.
+// 0-initialized arena is valid, since in that case we reserve a large range of
+// address space (ARENA_DEFAULT_RESERVE) on the first allocation request and
+// commit memory as needed. See arena_allocator_reserve().
+//
+// TRIM decommits everything past the used part of a virtual arena.
 //
 inline void *arena_allocator(allocator_mode mode, void *context, s64 size, void *oldMemory, s64 oldSize, u64 options) {
   auto *data = (arena_allocator_data *)context;
-  if (!data->Block) {
-    void *os_allocate_block(s64);
-
-    data->Block = os_allocate_block(8_GiB);
-    data->Size = 8_GiB;
-    data->Used = 0;
+  if (!data->Block && mode != allocator_mode::QUERY_STATS) {
+    if (mode == allocator_mode::TRIM) return null;
+    if (!arena_allocator_reserve(data)) return null;
   }
 
   switch (mode) {
     case allocator_mode::ALLOCATE: {
       if (data->Used + size >= data->Size) return null;  // Not enough space
+      if (!arena_allocator_commit(data, data->Used + size)) return null;
 
       void *result = (byte *)data->Block + data->Used;
       data->Used += size;
+      data->PeakUsed = max(data->PeakUsed, data->Used);
       return result;
     }
     case allocator_mode::RESIZE: {
       void *p = (byte *)data->Block + data->Used - oldSize;
       if (oldMemory == p) {
         // We can resize only if it's the last allocation
-        data->Used += size - oldSize;
+        s64 newUsed = data->Used + size - oldSize;
+        if (newUsed >= data->Size) return null;
+        if (!arena_allocator_commit(data, newUsed)) return null;
+
+        data->Used = newUsed;
+        data->PeakUsed = max(data->PeakUsed, data->Used);
         return oldMemory;
       }
       return null;
@@ -517,12 +871,66 @@ inline void *arena_allocator(allocator_mode mode, void *context, s64 size, void
     }
     case allocator_mode::FREE_ALL: {
       data->Used = 0;
+      arena_allocator_decommit_above(data, data->HighWaterMark);
+      return null;
+    }
+    case allocator_mode::TRIM: {
+      arena_allocator_decommit_above(data, data->Used);
       return null;
     }
+    case allocator_mode::QUERY_STATS: {
+      auto *stats = (allocator_stats *)oldMemory;
+      stats->Used = data->Used;
+      stats->PeakUsed = data->PeakUsed;
+      stats->Committed = data->Virtual ? data->Committed : data->Size;
+
+      // The free space is one block at the end (see the check in ALLOCATE)
+      s64 free = data->Size - data->Used;
+      stats->FreeBlockCount = free > 0;
+      stats->LargestFreeBlock = free > 0 ? free - 1 : 0;
+      return stats;
+    }
   }
   return null;
 }
 
+//
+// Arena checkpoints.
+//
+// An arena can only be reset as a whole with free_all. That's fine at the end
+// of a frame, but nested code often wants to throw away just the temporaries
+// it made itself. Take a checkpoint with arena_mark() and later call
+// arena_restore() to pop everything allocated after it, e.g.
+//
+//     PUSH_ARENA_SCOPE(&TemporaryAllocatorData);
+//     ... allocations here are freed when the scope exits ...
+//
+// Checkpoints must be restored in LIFO order (restoring an older checkpoint
+// also pops the newer ones).
+//
+struct arena_checkpoint {
+  arena_allocator_data *Arena;
+  s64 Used;
+};
+
+inline arena_checkpoint arena_mark(arena_allocator_data *data) {
+  return {data, data->Used};
+}
+
+// Frees everything allocated in the arena after the checkpoint was taken.
+// With DEBUG_MEMORY it also marks those allocations as freed.
+void arena_restore(arena_checkpoint checkpoint);
+
+// Treats the blocks in [begin, end) made with the allocator with _allocContext_
+// as freed (for DEBUG_MEMORY and the allocation profiler) without calling the
+// allocator. For allocators which reuse memory on their own, see
+// arena_restore() and platform_temp_alloc().
+void forget_allocations_in_range(void *allocContext, void *begin, void *end);
+
+#define PUSH_ARENA_SCOPE(arenaData)                                   \
+  auto LINE_NAME(arenaCheckpoint) = LSTD_NAMESPACE::arena_mark(arenaData); \
+  defer(LSTD_NAMESPACE::arena_restore(LINE_NAME(arenaCheckpoint)))
+
 // Hack, the default constructor would otherwise zero init the debug memory
 // pool's members, which is set before global constructors run. Similar thing
 // happens with context.
@@ -553,7 +961,16 @@ struct pool_allocator_data {
   };
   chunk *FreeList;
 
-  pool_allocator_data() : ElementSize(0), Base(null), FreeList(null) {}
+  // For QUERY_STATS
+  s64 ChunkCount, FreeCount, PeakUsedCount;
+
+  pool_allocator_data()
+      : ElementSize(0),
+        Base(null),
+        FreeList(null),
+        ChunkCount(0),
+        FreeCount(0),
+        PeakUsedCount(0) {}
   pool_allocator_data(pool_allocator_dont_init_t) {}
 };
 
@@ -568,6 +985,8 @@ inline void pool_allocator_add_free_chunks(pool_allocator_data *data, void *bloc
   auto *oldFreeList = data->FreeList;
   data->FreeList = c;
 
+  data->FreeCount += size / data->ElementSize;
+
   For(range(size / data->ElementSize - 1)) {
     c->Next = (pool_allocator_data::chunk *)((byte *)c + data->ElementSize);
     c = c->Next;
@@ -591,6 +1010,7 @@ inline void pool_allocator_provide_block(pool_allocator_data *data, void *block,
   b->Next = data->Base;
   data->Base = b;
 
+  data->ChunkCount += b->Size / data->ElementSize;
   pool_allocator_add_free_chunks(data, b + 1, b->Size);
 }
 
@@ -605,6 +1025,10 @@ inline void *pool_allocator(allocator_mode mode, void *context, s64 size,
       if (data->FreeList) {
         auto *block = data->FreeList;
         data->FreeList = block->Next;
+
+        --data->FreeCount;
+        data->PeakUsedCount =
+            max(data->PeakUsedCount, data->ChunkCount - data->FreeCount);
         return block;
       }
       return null;
@@ -617,10 +1041,12 @@ inline void *pool_allocator(allocator_mode mode, void *context, s64 size,
       auto *c = (pool_allocator_data::chunk *)oldMemory;
       c->Next = data->FreeList;
       data->FreeList = c;
+      ++data->FreeCount;
       return null;
     }
     case allocator_mode::FREE_ALL: {
       data->FreeList = null;
+      data->FreeCount = 0;
 
       auto *b = data->Base;
       while (b) {
@@ -629,10 +1055,413 @@ inline void *pool_allocator(allocator_mode mode, void *context, s64 size,
       }
       return null;
     }
+    case allocator_mode::TRIM: {
+      return null;  // The blocks are provided by the user
+    }
+    case allocator_mode::QUERY_STATS: {
+      auto *stats = (allocator_stats *)oldMemory;
+      stats->Used = (data->ChunkCount - data->FreeCount) * data->ElementSize;
+      stats->PeakUsed = data->PeakUsedCount * data->ElementSize;
+      stats->Committed = data->ChunkCount * data->ElementSize;
+      stats->FreeBlockCount = data->FreeCount;
+      stats->LargestFreeBlock = data->FreeCount ? data->ElementSize : 0;
+      return stats;
+    }
   }
   return null;
 }
 
+//
+// Concurrent pool allocator.
+//
+// Like the pool allocator, but blocks can be allocated and freed from any
+// number of threads at the same time without a mutex, e.g. messages which are
+// allocated by a producer thread and freed by a consumer.
+//
+// The free list is a lock-free (Treiber) stack. To avoid the ABA problem the
+// head is a tagged pointer: the low 48 bits hold the pointer to the first
+// chunk and the high 16 bits hold a counter which is bumped on every change,
+// so a CAS fails if the head was popped and pushed back in the meantime
+// (unless that happened exactly 65536 times in between, which we ignore).
+// Chunks are never given back to the OS while the pool is alive, so reading
+// the next pointer of a chunk which another thread just popped is harmless,
+// our CAS fails anyway.
+//
+// Blocks may be provided concurrently too. FREE_ALL is not thread-safe.
+//
+inline const u64 CONCURRENT_POOL_POINTER_MASK = (1ull << 48) - 1;
+
+struct concurrent_pool_allocator_data {
+  s64 ElementSize = 0;  // You must set this before using the allocator
+
+  pool_allocator_data::block *Base = null;
+
+  // Tagged pointer to the first free pool_allocator_data::chunk,
+  // see note above.
+  u64 FreeList = 0;
+};
+
+inline pool_allocator_data::chunk *concurrent_pool_untag(u64 head) {
+  return (pool_allocator_data::chunk *)(head & CONCURRENT_POOL_POINTER_MASK);
+}
+
+inline u64 concurrent_pool_tag(pool_allocator_data::chunk *c, u64 oldHead) {
+  assert(((u64)c & ~CONCURRENT_POOL_POINTER_MASK) == 0);
+  return (u64)c | ((oldHead & ~CONCURRENT_POOL_POINTER_MASK) +
+                   (1ull << 48));  // Bump the counter, overflow wraps
+}
+
+// Pushes a chain of chunks from _first_ to _last_ on the free list
+inline void concurrent_pool_push(concurrent_pool_allocator_data *data,
+                                 pool_allocator_data::chunk *first,
+                                 pool_allocator_data::chunk *last) {
+  while (true) {
+    u64 head = atomic_compare_and_swap(&data->FreeList, 0ull, 0ull);
+    last->Next = concurrent_pool_untag(head);
+    if (atomic_compare_and_swap(&data->FreeList, head,
+                                concurrent_pool_tag(first, head)) == head) {
+      return;
+    }
+  }
+}
+
+inline void concurrent_pool_add_free_chunks(
+    concurrent_pool_allocator_data *data, void *block, s64 size) {
+  auto *first = (pool_allocator_data::chunk *)block;
+
+  auto *c = first;
+  For(range(size / data->ElementSize - 1)) {
+    c->Next = (pool_allocator_data::chunk *)((byte *)c + data->ElementSize);
+    c = c->Next;
+  }
+  concurrent_pool_push(data, first, c);
+}
+
+// Same requirements as pool_allocator_provide_block().
+inline void concurrent_pool_allocator_provide_block(
+    concurrent_pool_allocator_data *data, void *block, s64 size) {
+  assert(size >= (s64)sizeof(pool_allocator_data::block) + data->ElementSize);
+  assert(data->ElementSize >= (s64)sizeof(pool_allocator_data::chunk));
+
+  auto *b = (pool_allocator_data::block *)block;
+  b->Size = size - sizeof(pool_allocator_data::block);
+  assert(b->Size % data->ElementSize == 0);
+
+  while (true) {
+    pool_allocator_data::block *base = data->Base;
+    b->Next = base;
+    if (atomic_compare_and_swap(&data->Base, base, b) == base) break;
+  }
+
+  concurrent_pool_add_free_chunks(data, b + 1, b->Size);
+}
+
+inline void *concurrent_pool_allocator(allocator_mode mode, void *context,
+                                       s64 size, void *oldMemory, s64 oldSize,
+                                       u64 options) {
+  auto *data = (concurrent_pool_allocator_data *)context;
+
+  switch (mode) {
+    case allocator_mode::ALLOCATE: {
+      assert(size == data->ElementSize);
+
+      while (true) {
+        u64 head = atomic_compare_and_swap(&data->FreeList, 0ull, 0ull);
+
+        auto *c = concurrent_pool_untag(head);
+        if (!c) return null;
+
+        // See note above about why this is safe
+        auto *next = c->Next;
+        if (atomic_compare_and_swap(&data->FreeList, head,
+                                    concurrent_pool_tag(next, head)) == head) {
+          return c;
+        }
+      }
+    }
+    case allocator_mode::RESIZE: {
+      assert(false && "Can't do that");
+      return null;
+    }
+    case allocator_mode::FREE: {
+      auto *c = (pool_allocator_data::chunk *)oldMemory;
+      concurrent_pool_push(data, c, c);
+      return null;
+    }
+    case allocator_mode::FREE_ALL: {
+      data->FreeList = 0;
+
+      auto *b = data->Base;
+      while (b) {
+        concurrent_pool_add_free_chunks(data, b + 1, b->Size);
+        b = b->Next;
+      }
+      return null;
+    }
+    case allocator_mode::TRIM: {
+      return null;  // The blocks are provided by the user
+    }
+    case allocator_mode::QUERY_STATS: {
+      // Keeping counts would add contended atomics to every call
+      return null;
+    }
+  }
+  return null;
+}
+
+//
+// Slab allocator.
+//
+// Routes small requests to a set of pools, one per size class, so we get O(1)
+// allocation and freeing of differently sized objects without setting up a
+// pool for every type by hand. Each size class grows by pulling slabs of
+// _SlabSize_ bytes (including the OS block header) from the OS (see
+// os_allocate_block()), so objects of the same class end up next to each
+// other in memory.
+//
+// Size classes are 16 bytes apart up to 128, after that there are 4 classes
+// per power of two up to SLAB_MAX_SIZE, which keeps the internal fragmentation
+// below 25%. Larger requests are passed to _Backing_ (e.g. a tlsf allocator),
+// which you must set before using the allocator.
+//
+// Since the allocator protocol passes the size of the block when freeing, we
+// don't need to store anything next to the objects to know which pool they
+// came from.
+//
+// FREE_ALL resets the pools (keeping their slabs) and calls FREE_ALL on
+// _Backing_ as well. Call slab_allocator_release() to give the slabs back to
+// the OS.
+//
+// Note: This allocator is not thread-safe.
+//
+inline const s64 SLAB_SIZE_CLASSES[] = {
+    16,  32,  48,  64,  80,  96,   112,  128,  160,  192,  224,  256,
+    320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048};
+inline const s64 SLAB_CLASS_COUNT =
+    sizeof(SLAB_SIZE_CLASSES) / sizeof(SLAB_SIZE_CLASSES[0]);
+inline const s64 SLAB_MAX_SIZE = 2048;
+
+inline const s64 SLAB_DEFAULT_SIZE = 64_KiB;
+
+struct slab_allocator_data {
+  allocator Backing;  // For requests larger than SLAB_MAX_SIZE
+
+  // How many bytes to request from the OS when a size class runs out.
+  // Should be a multiple of the page size.
+  s64 SlabSize = SLAB_DEFAULT_SIZE;
+
+  pool_allocator_data Pools[SLAB_CLASS_COUNT];
+};
+
+// Returns the index of the smallest size class which fits _size_
+inline s64 slab_size_class(s64 size) {
+  assert(size > 0 && size <= SLAB_MAX_SIZE);
+
+  if (size <= 128) return (size + 15) / 16 - 1;
+
+  // 4 classes per power of two
+  s32 power = internal::msb((u64)(size - 1));
+  return 8 + (power - 7) * 4 + ((size - 1) >> (power - 2)) - 4;
+}
+
+// Gives all slabs back to the OS. The allocator can be used again afterwards.
+inline void slab_allocator_release(slab_allocator_data *data) {
+  void os_free_block(void *);
+  void allocator_registry_remove(void *);
+
+  allocator_registry_remove(data);
+
+  For_as(pool, data->Pools) {
+    auto *b = pool.Base;
+    while (b) {
+      auto *next = b->Next;
+      os_free_block(b);
+      b = next;
+    }
+    pool.Base = null;
+    pool.FreeList = null;
+    pool.ChunkCount = pool.FreeCount = pool.PeakUsedCount = 0;
+  }
+}
+
+inline void *slab_allocator(allocator_mode mode, void *context, s64 size,
+                            void *oldMemory, s64 oldSize, u64 options) {
+  auto *data = (slab_allocator_data *)context;
+
+  switch (mode) {
+    case allocator_mode::ALLOCATE: {
+      if (size > SLAB_MAX_SIZE) {
+        assert(data->Backing && "Slab allocator needs a backing allocator");
+        return data->Backing.Function(mode, data->Backing.Context, size, null,
+                                      0, options);
+      }
+
+      s64 c = slab_size_class(size);
+      auto *pool = &data->Pools[c];
+
+      if (!pool->FreeList) {
+        void *os_allocate_block(s64, u64);
+
+        pool->ElementSize = SLAB_SIZE_CLASSES[c];
+
+        // Keep the mapping at exactly _SlabSize_ bytes
+        s64 slabSize = data->SlabSize - OS_BLOCK_HEADER_SIZE;
+
+        s64 blockHeader = sizeof(pool_allocator_data::block);
+        assert(slabSize >= blockHeader + SLAB_MAX_SIZE);
+
+        void *slab = os_allocate_block(slabSize, 0);
+        if (!slab) return null;
+
+        s64 usable = (slabSize - blockHeader) / pool->ElementSize *
+                     pool->ElementSize;
+        pool_allocator_provide_block(pool, slab, blockHeader + usable);
+      }
+      return pool_allocator(mode, pool, pool->ElementSize, null, 0, options);
+    }
+    case allocator_mode::RESIZE: {
+      if (size > SLAB_MAX_SIZE && oldSize > SLAB_MAX_SIZE) {
+        return data->Backing.Function(mode, data->Backing.Context, size,
+                                      oldMemory, oldSize, options);
+      }
+
+      // We can resize in place only within the same size class
+      if (size <= SLAB_MAX_SIZE && oldSize <= SLAB_MAX_SIZE &&
+          slab_size_class(size) == slab_size_class(oldSize)) {
+        return oldMemory;
+      }
+      return null;
+    }
+    case allocator_mode::FREE: {
+      if (oldSize > SLAB_MAX_SIZE) {
+        return data->Backing.Function(mode, data->Backing.Context, 0,
+                                      oldMemory, oldSize, options);
+      }
+      return pool_allocator(mode, &data->Pools[slab_size_class(oldSize)], 0,
+                            oldMemory, oldSize, options);
+    }
+    case allocator_mode::FREE_ALL: {
+      For_as(pool, data->Pools) {
+        pool_allocator(mode, &pool, 0, null, 0, options);
+      }
+
+      if (data->Backing) {
+        data->Backing.Function(mode, data->Backing.Context, 0, null, 0,
+                               options);
+      }
+      return null;
+    }
+    case allocator_mode::TRIM: {
+      // Slabs are shared by all objects of a class, so we keep them and
+      // only trim the backing allocator
+      if (data->Backing) {
+        data->Backing.Function(mode, data->Backing.Context, 0, null, 0,
+                               options);
+      }
+      return null;
+    }
+    case allocator_mode::QUERY_STATS: {
+      // The sum over the size classes and the backing allocator (if it keeps
+      // stats). _PeakUsed_ is the sum of their peaks, so an upper bound.
+      auto *stats = (allocator_stats *)oldMemory;
+
+      if (data->Backing) {
+        data->Backing.Function(mode, data->Backing.Context, 0, stats, 0,
+                               options);
+      }
+
+      For_as(pool, data->Pools) {
+        allocator_stats p;
+        pool_allocator(mode, &pool, 0, &p, 0, options);
+
+        stats->Used += p.Used;
+        stats->PeakUsed += p.PeakUsed;
+        stats->Committed += p.Committed;
+        stats->FreeBlockCount += p.FreeBlockCount;
+        stats->LargestFreeBlock = max(stats->LargestFreeBlock, p.LargestFreeBlock);
+      }
+      return stats;
+    }
+  }
+  return null;
+}
+
+//
+// Electric fence allocator (for debugging).
+//
+// Every allocation gets pages of its own which sit right next to an
+// inaccessible guard page, so an out of bounds access faults at the bad
+// instruction, instead of being found later by debug_memory_verify_heap()
+// (see NO_MANS_LAND_FILL). By default allocations alternate which side the
+// guard is on:
+// * after - the block ends right before the guard and overflows fault.
+//   Its start is rounded down to _Alignment_ (1 by default, so even an
+//   overflow by one byte faults). The general allocation functions may add
+//   alignment padding after the block, so they can miss overflows by a few
+//   bytes. With DEBUG_MEMORY the no man's land sits between the block and
+//   the guard.
+// * before - the block starts right after the guard and underflows fault
+//   (once they get past the allocation header).
+//
+// Freed pages are made inaccessible as well and their address range isn't
+// given back until _QuarantineSize_ more blocks have been freed, so using
+// memory after freeing it faults too.
+//
+// Each allocation costs at least two pages of address space and a couple of
+// syscalls, but almost no CPU otherwise, so this is fine for running
+// production-like loads. Select it for a scope with PUSH_ALLOC:
+//
+//     electric_fence_allocator_data fence;
+//     defer(electric_fence_allocator_release(&fence));
+//
+//     PUSH_ALLOC({electric_fence_allocator, &fence}) {
+//         ...
+//     }
+//
+// Thread-safe. RESIZE always moves the block, FREE_ALL isn't supported.
+//
+enum class electric_fence_guard : s32 { ALTERNATE, AFTER, BEFORE };
+
+struct electric_fence_allocator_data {
+  electric_fence_guard Guard = electric_fence_guard::ALTERNATE;
+
+  // Blocks with the guard after start at a multiple of this
+  s64 Alignment = 1;
+
+  // How many freed blocks stay reserved (and inaccessible)
+  s64 QuarantineSize = 1024;
+
+  struct range {
+    void *Base;
+    s64 Size;
+  };
+  range *Quarantine = null;  // Ring of _QuarantineSize_, from the OS
+  s64 QuarantineNext = 0;
+
+  // The pages (including the guard) of every live block, so we know which
+  // side the guard is on when freeing. Open addressing with linear probing,
+  // allocated from the OS.
+  struct live_block {
+    void *Block;
+    range Pages;
+  };
+  live_block *Live = null;
+  s64 LiveCount = 0, LiveCapacity = 0;
+
+  u64 AllocationCount = 0;  // Used to alternate the guard side
+  s32 Lock = 0;
+
+  // For QUERY_STATS, _Committed_ counts the accessible pages
+  s64 Used = 0, PeakUsed = 0, Committed = 0;
+};
+
+void *electric_fence_allocator(allocator_mode mode, void *context, s64 size,
+                               void *oldMemory, s64 oldSize, u64 options);
+
+// Gives the quarantined address ranges back to the OS. Blocks which are still
+// allocated stay valid, but can't be freed anymore.
+void electric_fence_allocator_release(electric_fence_allocator_data *data);
+
 // Calculates the required padding in bytes which needs to be added to _ptr_
 // in order to be aligned
 inline u16 calculate_padding_for_pointer(void *ptr, s32 alignment) {
@@ -701,9 +1530,24 @@ inline const byte CLEAN_LAND_FILL = 0xCD;
 // in the header itself. Right now this uses 32 bytes when DEBUG_MEMORY is not
 // defined, 96 bytes when storing debug info.
 //
-// @TODO: This may be too big of an overhead. We can make this smaller!
-//        We can split allocations into small/medium/large, and use different
-//        headers (like https://nothings.org/stb/stb_malloc.h).
+// :CompactHeader:
+// That's a lot of overhead for small blocks, so when DEBUG_MEMORY is not
+// defined, blocks smaller than 4 GiB with alignment <= 16 (made with an
+// allocator which fits in the registry, see :AllocatorRegistry:) get a compact
+// header instead. It's laid out right before the returned pointer like this:
+//
+//     [..padding..][size: 1-4 bytes][allocator index: 1 byte][flags: 1 byte]
+//
+// flags: bit 0         - always set for the compact header
+//        bit 1         - alignment is 16 (otherwise 8)
+//        bits 2-3      - how many bytes the size takes - 1
+//        bits 4-7      - the padding before the header (< 16)
+//
+// The size is stored in little endian using as few bytes as possible, so a
+// 40 byte block costs 3 bytes of header (+ alignment padding).
+//
+// The last byte of the full header is always 0 (see _Kind_) which is how we
+// tell the two apart. With DEBUG_MEMORY we always use the full header.
 //
 struct allocation_header {
   // The allocator used when allocating the memory. We need this when
@@ -742,6 +1586,13 @@ struct allocation_header {
   u16 AlignmentPadding;  // Offset from the block that needs to be there in
                          // order for the result to be aligned
 
+#if !defined DEBUG_MEMORY
+  // The byte right before the returned pointer. 0 for the full header,
+  // see :CompactHeader:.
+  byte Reserved[3];
+  byte Kind;
+#endif
+
 #if defined DEBUG_MEMORY
   // This is used to detect buffer underruns.
   // There may be padding after this member, but we treat this region as
@@ -758,11 +1609,17 @@ struct allocation_header {
 #if defined DEBUG_MEMORY
 inline thread_local s64 AllocationCount;
 
-// The node of a linked list, see comment below this struct.
+// The node of a linked list (and a tree), see comment below this struct.
 struct debug_memory_node {
   debug_memory_node *Next;
   debug_memory_node *Prev;
 
+  // Children in the tree which indexes the nodes by header address
+  // (a treap, ordered by _Header_ and heap-ordered by _Priority_).
+  debug_memory_node *Left;
+  debug_memory_node *Right;
+  u64 Priority;
+
   allocation_header *Header;
 
   //
@@ -830,7 +1687,8 @@ struct debug_memory_node {
 
   //
   // When calling general_free() we free the block with the allocator
-  // implementation but keep the node live in the list. We do this in order to
+  // implementation but keep the node around (moved from the list of live
+  // allocations to a seperate tree of freed ones). We do this in order to
   // detect freeing the same pointer twice. If the program requests a new
   // block and the allocator implementation returns the same memory address
   // then we reuse this node and clear the flag.
@@ -868,7 +1726,9 @@ struct debug_memory_node {
 // memory, freeing the same pointer twice, etc.).
 //
 // The list is doubly-linked and sorted by the value of the pointer of the
-// allocation (in increasing order).
+// allocation (in increasing order). It contains only live allocations. The
+// same nodes are indexed by a balanced tree, so finding a block on every
+// (re)allocation and free is O(log n) and doesn't walk the list.
 //
 // We also detect if allocator implementations return overlapping blocks,
 // which may happen if two allocators use the same pool, or the implementation
@@ -905,10 +1765,65 @@ void debug_memory_report_leaks();
 // Verifies the integrity of headers in all allocations.
 void debug_memory_verify_heap();
 
+// How many live blocks debug_memory_maybe_verify_heap() checks at a time.
+inline const s64 DEBUG_MEMORY_HEAP_VERIFY_SLICE = 64;
+
+// Verifies the next DEBUG_MEMORY_HEAP_VERIFY_SLICE blocks (wrapping around)
+// every Context.DebugMemoryHeapVerifyFrequency allocations, so the cost per
+// allocation is bounded no matter how many blocks are live.
 // See :MemoryVerifyHeapFrequency:
 void debug_memory_maybe_verify_heap();
 #endif
 
+// :AllocatorRegistry:
+// Compact headers store a 1-byte index instead of the full allocator. The
+// registry maps those indices to allocators. Allocators get registered on
+// first use and removed by their release functions (tlsf_, arena_, slab_ and
+// electric_fence_allocator_release). When the registry is full, allocations
+// with unregistered allocators just get the full header.
+//
+// That means at most 255 allocators can be alive at once *and* in use with
+// compact headers. Allocators without a release function (e.g. pool
+// allocators) or ones which are just dropped keep their slot, call
+// allocator_registry_remove() yourself when you are done with them.
+inline const s64 ALLOCATOR_REGISTRY_SIZE = 255;
+
+// Returns the index of the allocator in the registry (registers it if it isn't
+// there yet), or -1 if the registry is full.
+s32 allocator_registry_index(allocator alloc);
+allocator allocator_registry_get(s32 index);
+
+// Frees the slots of all allocators with this context. Blocks which were
+// allocated with them must not be used afterwards.
+void allocator_registry_remove(void *context);
+
+// Returns the size the user requested for a block returned by
+// general_(re)allocate (works with both the full and the compact header).
+inline s64 allocation_get_size(const void *ptr) {
+#if !defined DEBUG_MEMORY
+  byte flags = ((const byte *)ptr)[-1];
+  if (flags & 1) {
+    s64 sizeBytes = ((flags >> 2) & 3) + 1;
+    auto *p = (const byte *)ptr - 2 - sizeBytes;
+
+    s64 size = 0;
+    For(range(sizeBytes)) size |= (s64)p[it] << (8 * it);
+    return size;
+  }
+#endif
+  return ((const allocation_header *)ptr - 1)->Size;
+}
+
+// Returns the allocator which was used to allocate a block returned by
+// general_(re)allocate.
+inline allocator allocation_get_allocator(const void *ptr) {
+#if !defined DEBUG_MEMORY
+  byte flags = ((const byte *)ptr)[-1];
+  if (flags & 1) return allocator_registry_get(((const byte *)ptr)[-2]);
+#endif
+  return ((const allocation_header *)ptr - 1)->Alloc;
+}
+
 template <non_void T>
 requires(!is_const<T>) T *lstd_reallocate_impl(T *block, s64 newCount,
                                                u64 options,
@@ -920,8 +1835,7 @@ requires(!is_const<T>) T *lstd_reallocate_impl(T *block, s64 newCount,
   // reallocate?), so we leave that up to the call site.
   assert(newCount != 0);
 
-  auto *header = (allocation_header *)block - 1;
-  s64 oldCount = header->Size / sizeof(T);
+  s64 oldCount = allocation_get_size(block) / sizeof(T);
 
   if constexpr (!is_scalar<T>) {
     if (newCount < oldCount) {
@@ -973,8 +1887,7 @@ requires(!is_const<T>) void lstd_free_impl(T *block, u64 options,
                                            source_location loc) {
   if (!block) return;
 
-  auto *header = (allocation_header *)block - 1;
-  s64 count = header->Size / sizeof(T);
+  s64 count = allocation_get_size(block) / sizeof(T);
 
   if constexpr (!is_scalar<T>) {
     auto *p = block;
@@ -1004,8 +1917,51 @@ int memcmp(void const *_Buf1, void const *_Buf2, size_t _Size);
 
 // This is non-standard extension, basically memset with 0
 void *memset0(void *_Dst, size_t _Size);
+
+//
+// Our implementations of the functions above. With LSTD_NO_CRT the standard
+// names forward to these, but they are always compiled so they can be tested
+// and benchmarked against the C runtime.
+//
+// On x86 we have SSE2 and AVX2 versions and pick one the first time any of
+// them is called, based on what the CPU supports (see memory_functions_impl).
+// Small sizes are handled with overlapping loads and stores (no loops),
+// larger ones with aligned stores, and copies and fills larger than
+// MEMORY_NON_TEMPORAL_THRESHOLD use non-temporal stores so they don't evict
+// the whole cache.
+//
+// lstd_memcpy handles overlapping buffers like lstd_memmove, see the note in
+// memory.cpp.
+//
+void *lstd_memcpy(void *_Dst, void const *_Src, size_t _Size);
+void *lstd_memmove(void *_Dst, void const *_Src, size_t _Size);
+void *lstd_memset(void *_Dst, int _Val, size_t _Size);
+int lstd_memcmp(void const *_Buf1, void const *_Buf2, size_t _Size);
 }
 
+LSTD_BEGIN_NAMESPACE
+
+inline const s64 MEMORY_NON_TEMPORAL_THRESHOLD = 4_MiB;
+
+// The widest SIMD instruction set both the CPU and the OS (which has to save
+// the registers) support. Used to pick between the implementations of the
+// lstd_mem* functions and get_hash_long(). Defined in memory.cpp, runs cpuid
+// every time, so don't call it in hot code.
+enum class cpu_simd_level : s32 { NONE, SSE2, AVX2 };
+cpu_simd_level cpu_get_simd_level();
+
+enum class memory_functions_impl : s32 { SCALAR, SSE2, AVX2 };
+
+// Returns the implementation the lstd_mem* functions currently use
+memory_functions_impl memory_functions_get_impl();
+
+// Forces an implementation, e.g. to compare them in tests and benchmarks. If
+// the CPU doesn't support _impl_ we pick the best one it does support.
+// Returns the implementation which was selected.
+memory_functions_impl memory_functions_set_impl(memory_functions_impl impl);
+
+LSTD_END_NAMESPACE
+
 #if COMPILER == MSVC
 #pragma warning(push)
 #pragma warning(disable : 4273)  // Different linkage
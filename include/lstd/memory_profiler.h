@@ -0,0 +1,121 @@
+#pragma once
+
+#include "array.h"
+#include "memory.h"
+#include "string.h"
+
+//
+// Allocation profiler.
+//
+// Opt-in: set Context.ProfileAllocations to true and every allocation made
+// on that thread through general_allocate() (so malloc<>, new, strings,
+// arrays, etc.) gets attributed to its call site, i.e. the source_location
+// passed to the allocation functions. Per call site we aggregate how many
+// allocations/reallocations/frees were made, how many bytes were requested,
+// how many bytes are live right now and the peak of that, and a histogram of
+// how long blocks lived.
+//
+// Lifetimes are measured in profiled allocations made on the thread between
+// allocating and freeing a block (the thread's "allocation clock"), not in
+// wall time, so they are cheap to measure and reproducible between runs.
+// Bucket i counts blocks which lived for [2^i - 1, 2^(i+1) - 1) ticks.
+//
+// The profiler state is per-thread and its tables live in memory requested
+// directly from the OS, so profiling doesn't take locks and doesn't show up
+// in its own results. Note: A block freed by another thread than the one
+// which allocated it stays live in the owner's table.
+//
+// Take snapshots with allocation_profile_snapshot(), compare two with
+// allocation_profile_diff() (e.g. to find out which call sites grew the heap
+// between two points of the program) and save them with
+// allocation_profile_write() for offline analysis.
+//
+
+LSTD_BEGIN_NAMESPACE
+
+inline const s64 ALLOCATION_LIFETIME_BUCKETS = 24;
+
+struct allocation_site_stats {
+  const char *File;
+  const char *Function;
+  u32 Line;
+  u32 Column;
+
+  s64 Allocations;
+  s64 Reallocations;
+  s64 Frees;
+
+  s64 TotalBytes;  // Requested by allocations (and by reallocations growing)
+  s64 LiveBytes;
+  s64 PeakLiveBytes;
+  s64 LiveCount;
+
+  s64 Lifetimes[ALLOCATION_LIFETIME_BUCKETS];  // See note above
+};
+
+struct allocation_profile {
+  // Sorted by _LiveBytes_, in decreasing order
+  array<allocation_site_stats> Sites;
+
+  s64 LiveBytes;  // Sum over all sites
+  s64 Tick;       // The thread's allocation clock at the time of the snapshot
+};
+
+// Copies the calling thread's per-call-site stats. The sites array is
+// allocated with the context's allocator, free it with free(profile.Sites).
+allocation_profile allocation_profile_snapshot();
+
+// Returns _newer_ - _older_ per call site (matched by file, line and column),
+// sorted by the growth in live bytes. _PeakLiveBytes_ is taken from _newer_.
+// Sites with no changes are left out. Allocated like in
+// allocation_profile_snapshot().
+allocation_profile allocation_profile_diff(allocation_profile older,
+                                           allocation_profile newer);
+
+//
+// Compact binary encoding of a profile (all integers are LEB128 varints,
+// signed ones are zigzag encoded first, so diffs can be saved too):
+//
+//   "LSAP" u8 version
+//   tick (signed) liveBytes (signed)
+//   stringCount, stringCount * [byteCount, bytes]        (file and function names)
+//   siteCount, siteCount * [file, function (indices in the strings above),
+//                           line, column,
+//                           allocations, reallocations, frees, totalBytes,
+//                           liveBytes, peakLiveBytes, liveCount (all signed),
+//                           ALLOCATION_LIFETIME_BUCKETS lifetimes (signed)]
+//
+inline const u8 ALLOCATION_PROFILE_VERSION = 1;
+
+// The result is allocated with the context's allocator
+string allocation_profile_encode(allocation_profile profile);
+
+// Encodes and writes to a file. Returns false on failure.
+bool allocation_profile_write(allocation_profile profile, string path);
+
+// Forgets everything recorded on the calling thread
+void allocation_profiler_reset();
+
+// Gives the calling thread's tables back to the OS. Called on thread exit.
+void allocation_profiler_release();
+
+//
+// Called by the general allocation functions (see memory.cpp)
+//
+
+// How many blocks the calling thread's profiler tracks. When this is 0 we
+// skip calling into the profiler on frees.
+inline thread_local s64 ProfiledBlockCount;
+
+void allocation_profiler_on_allocate(void *ptr, s64 size, allocator alloc,
+                                     source_location loc);
+void allocation_profiler_on_reallocate(void *oldPtr, void *newPtr,
+                                       s64 newSize);
+void allocation_profiler_on_free(void *ptr);
+
+// Treats blocks made with the allocator with _allocContext_ which lie in
+// [begin, end) as freed. Called by free_all() and arena_restore().
+void allocation_profiler_on_free_range(void *allocContext, void *begin,
+                                       void *end);
+
+LSTD_END_NAMESPACE
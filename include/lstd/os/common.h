@@ -167,6 +167,7 @@ inline void platform_init_context() {
   newContext.AllocAlignment = POINTER_SIZE;
   newContext.AllocOptions = 0;
   newContext.LogAllAllocations = false;
+  newContext.ProfileAllocations = false;
   newContext.PanicHandler = default_panic_handler;
   newContext.Log = &cout;
   newContext.FmtDisableAnsiCodes = false;
@@ -213,6 +214,10 @@ inline void platform_init_common_state() {
 // Reports leaks, uninitializes mutexes.
 //
 inline void platform_uninit_state() {
+  // Before reporting leaks, temporary allocations aren't leaks
+  void platform_temp_release();
+  platform_temp_release();
+
 #if defined DEBUG_MEMORY
   debug_memory_uninit();
 #endif
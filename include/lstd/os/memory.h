@@ -9,26 +9,168 @@
 // Platform specific memory functions.
 //
 
+// Options passed to the OS when allocating the pages behind the platform
+// allocators (persistent pools and the temporary storage arena), e.g.
+// -DPLATFORM_MEMORY_OPTIONS=OS_ALLOCATE_HUGE_PAGES to back them with huge
+// pages. See OS_ALLOCATE_HUGE_PAGES in memory.h.
+#if !defined PLATFORM_MEMORY_OPTIONS
+#define PLATFORM_MEMORY_OPTIONS 0
+#endif
+
 LSTD_BEGIN_NAMESPACE
 
-// Allocates memory by calling the OS directly
-mark_as_leak void *os_allocate_block(s64 size);
+// Allocates memory by calling the OS directly.
+// _options_ is a combination of OS_ALLOCATE_HUGE_PAGES and
+// OS_ALLOCATE_POPULATE (see memory.h).
+//
+// The size of the mapping is stored in an os_block_header (see memory.h) in
+// front of the returned pointer, so blocks can be freed without passing their
+// size. See os_block_size().
+mark_as_leak void *os_allocate_block(s64 size, u64 options = 0);
 
 // Frees a memory block allocated by os_allocate_block()
 void os_free_block(void *ptr);
 
+//
+// Virtual memory. Used by arenas which grow on demand (see
+// arena_allocator_reserve()). Sizes and pointers passed to commit/decommit
+// should be multiples of the page size.
+//
+
+s64 os_get_page_size();
+
+// Reserves a range of address space without backing it with memory.
+// Touching the range before committing it crashes. Returns null on failure.
+mark_as_leak void *os_reserve_block(s64 size);
+
+// Backs pages in a reserved range with (zeroed) memory. _options_ are the
+// same as for os_allocate_block() (with huge pages _ptr_ and _size_ should be
+// multiples of OS_HUGE_PAGE_SIZE). Returns false if the OS is out of memory.
+bool os_commit_block(void *ptr, s64 size, u64 options = 0);
+
+// Gives the memory behind committed pages back to the OS. The range stays
+// reserved (touching it crashes) until it's recommitted. Works on pages of
+// blocks from os_allocate_block() too.
+void os_decommit_block(void *ptr, s64 size);
+
+// Backs decommitted pages with (zeroed) memory again
+inline bool os_recommit_block(void *ptr, s64 size, u64 options = 0) {
+  return os_commit_block(ptr, size, options);
+}
+
+// Releases a range returned by os_reserve_block(). _size_ must be the size
+// which was reserved.
+void os_release_block(void *ptr, s64 size);
+
+//
+// Thread caching front end for an allocator which is shared between threads
+// (and hence protected by a mutex), e.g. the platform persistent allocator.
+//
+// Small blocks (up to THREAD_CACHE_MAX_SIZE bytes) are served from per-thread
+// free lists bucketed by size class, so the common case doesn't take any lock.
+// When a list runs dry we refill a whole batch from the shared allocator while
+// holding its mutex once. When a list grows beyond two batches we drain one
+// batch back (again under a single lock). Larger blocks go directly to the
+// shared allocator.
+//
+// Every block is prefixed by 8 bytes which store the cache which owns it (and
+// its size class in the low bits). When a thread frees a block which belongs
+// to another thread's cache we push it on that cache's remote free list
+// (lock-free). The owner collects those the next time a size class runs dry.
+//
+// Threads release their caches on exit (see lstd_uninit_thread()). A released
+// cache is marked as orphaned and gets adopted by the next thread which needs
+// a cache (blocks which were remotely freed in the meantime are collected
+// then). Caches are never given back to the shared allocator.
+//
+inline const s64 THREAD_CACHE_SIZE_CLASSES[] = {16,  32,  48,  64,  96,  128,
+                                                192, 256, 384, 512, 768, 1024};
+inline const s64 THREAD_CACHE_CLASS_COUNT =
+    sizeof(THREAD_CACHE_SIZE_CLASSES) / sizeof(THREAD_CACHE_SIZE_CLASSES[0]);
+inline const s64 THREAD_CACHE_MAX_SIZE = 1024;
+
+// How many bytes we aim to move between a cache and the shared allocator at
+// once. The batch count is clamped to [4, 64] blocks.
+inline const s64 THREAD_CACHE_BATCH_BYTES = 16_KiB;
+
+// How many different thread cached allocators a single thread can have caches
+// for. If a thread runs out of slots it just uses the shared allocator.
+inline const s64 THREAD_CACHE_MAX_ALLOCATORS = 4;
+
+struct thread_cache_allocator_data;
+
+struct alignas(64) thread_cache {
+  struct free_block {
+    free_block *Next;
+  };
+
+  struct size_class {
+    free_block *Head;
+    s64 Count;
+  };
+  size_class Classes[THREAD_CACHE_CLASS_COUNT];
+
+  // Blocks freed by other threads, pushed lock-free. The owner takes the
+  // entire list at once with an atomic swap, so we don't suffer from ABA.
+  free_block *RemoteFrees;
+
+  thread_cache_allocator_data *Owner;
+  thread_cache *NextCache;  // See _thread_cache_allocator_data::Caches_
+
+  s32 Orphaned;  // Set when the owning thread exits, see note above
+};
+
+struct thread_cache_allocator_data {
+  // Where we get memory from (and return memory to).
+  allocator Shared;
+
+  // Held while refilling or draining a batch so that the whole batch takes the
+  // lock once. _Shared_ is expected to lock this mutex itself too, so it
+  // must be recursive (which mutex is).
+  mutex *SharedMutex = null;
+
+  // All caches ever created for this allocator (live and orphaned).
+  // Only ever pushed to (atomically), never removed from.
+  thread_cache *Caches = null;
+};
+
+// Slots which point to this thread's caches, one per thread cached allocator.
+inline thread_local thread_cache *ThreadCaches[THREAD_CACHE_MAX_ALLOCATORS];
+
+// Small blocks are served from the calling thread's cache, see comment above.
+// Allocations with options (other than LEAK) skip the cache, since cached
+// blocks are allocated without any. Cached blocks are 8 byte aligned.
+// FREE_ALL is not supported.
+void *thread_cache_allocator(allocator_mode mode, void *context, s64 size,
+                             void *oldMemory, s64 oldSize, u64 options);
+
+// Drains this thread's caches back to their shared allocators and marks them
+// as orphaned. Called on thread exit.
+void thread_caches_release();
+
 struct platform_memory_state {
   // Used to store global state (e.g. cached command-line arguments/env
-  // variables or directories), a tlsf allocator
+  // variables or directories). Small allocations go through a thread caching
+  // front end (see thread_cache_allocator) so they don't have to lock
+  // _PersistentAllocMutex_, which protects the tlsf allocator behind it.
   allocator PersistentAlloc;
+  thread_cache_allocator_data PersistentAllocCache;
+
+  // The pools are allocated from the OS by the tlsf allocator itself (see
+  // tlsf_allocator_add_pool()), so trim() can give empty ones back.
   tlsf_allocator_data PersistentAllocData;
 
-  // Stores blocks that have been added as pools for the tlsf allocator or a
-  // large allocation which was handled by _os_allocate_block()_.
+  // Large allocations are handled by _os_allocate_block()_ directly. They are
+  // linked here so we can tell them apart from tlsf blocks when freeing.
   struct persistent_alloc_page {
-    persistent_alloc_page *Next;
+    persistent_alloc_page *Next, *Prev;
   };
-  persistent_alloc_page *PersistentAllocBasePage;
+  persistent_alloc_page *PersistentAllocLargePages;
+  s64 PersistentAllocLargePagesSize;  // Sum of their os_block_size()
+
+  // The highest the tlsf allocator's and the large pages' used memory has
+  // been together, updated on every allocation. For QUERY_STATS.
+  s64 PersistentAllocPeakUsed;
 
   mutex PersistentAllocMutex;
 
@@ -37,14 +179,10 @@ struct platform_memory_state {
   // want to mess with the user's memory.
   //
   // Used for temporary storage (e.g. converting strings from utf8 to wchar for
-  // windows calls or null-terminated for posix calls). Memory returned is only 
-  // guaranteed to be valid until the next temporary alloc call, because we call 
-  // free_all if we don't have enough space for the
-  // allocation. See note above _platform_temp_alloc()_.
+  // windows calls or null-terminated for posix calls). The context is null,
+  // the state lives in each thread's _PlatformTempRing_.
+  // See note above _platform_temp_alloc()_.
   allocator TempAlloc;
-  arena_allocator_data TempAllocData;
-
-  mutex TempAllocMutex;  // @TODO: Remove
 };
 
 // :GlobalStateNoConstructors:
@@ -66,80 +204,106 @@ inline void platform_report_error(
         loc.line(), loc.function_name(), message);
 }
 
-inline void create_new_temp_storage_block(s64 size) {
-  if (S->TempAllocData.Block) {
-    os_free_block(S->TempAllocData.Block);
-  } 
-  S->TempAllocData.Block = os_allocate_block(size);
+//
+// The platform temporary allocator. Each thread has its own ring of
+// PLATFORM_TEMPORARY_STORAGE_STARTING_SIZE bytes (allocated from the OS on the
+// thread's first temporary allocation), so no locking is needed and one
+// thread can't reset memory another thread is still using.
+//
+// Since there is no clear point at which to free_all (we are not running e.g.
+// a game with frames), allocations just wrap around to the start of the ring
+// once they reach its end. That means memory returned is valid until the
+// same thread makes another ring-sized worth of temporary allocations, which
+// is plenty for converting a couple of paths for a syscall. Every wrap starts
+// a new _Generation_.
+//
+// Requests which don't fit in the ring get their own OS block. Such a request
+// counts as a full ring's worth of allocations (it starts a new generation),
+// and its block is freed once two more generations have started.
+//
+// Reused memory is marked as freed for DEBUG_MEMORY and the allocation
+// profiler, so freeing or resizing a stale temporary pointer is reported like
+// a double free. Code which holds on to a temporary pointer can also check
+// it explicitly:
+//
+//     char *p = to_c_string(path, 0, TEMP);
+//     u64 generation = platform_temp_generation();
+//     ...
+//     assert(platform_temp_is_live(p, generation));
+//
+struct platform_temp_ring {
+  byte *Block;  // null until the thread's first temporary allocation
+  s64 Used;     // Where the next allocation goes
+
+  // Memory from the previous generation before this offset has been reused
+  s64 Reclaimed;
 
-  S->TempAllocData.Size = size;
-  S->TempAllocData.Used = 0;
-}
+  s64 PeakUsed;  // For QUERY_STATS
 
-// An extension to the arena allocator. Calls free_all when not enough space.
-// Because we are not running e.g. a game there is no clear point at which to
-// free_all the temporary allocator, that's why we assume that no allocation
-// made with TempAlloc should persist beyond the next allocation.
-//
-// Note: This allocator doesn't work 100% in a multithreaded situation because
-// free_all could be called at an arbitrary point in time.
-//
-// @TODO: Replace calls to the temporary alloc with calls to the persient alloc.
-// They are both are fast. Obviously this allocator is faster, but there is no
-// clear point as to when we can safely call free_all.. In a game free_all is
-// called at the end of each frame which means there is no problem there since
-// temporary allocations shouldn't persist until the next frame.
-inline void *platform_temp_alloc(allocator_mode mode, void *context, s64 size,
-                              void *oldMemory, s64 oldSize, u64 options) {
-  auto *data = (arena_allocator_data *)context;
-
-  lock(&S->TempAllocMutex);
-  defer(unlock(&S->TempAllocMutex));
-
-  auto *result =
-      arena_allocator(mode, context, size, oldMemory, oldSize, options);
-  if (!result && mode == allocator_mode::ALLOCATE) {
-    if (size < S->TempAllocData.Size) {
-      // If we couldn't allocate but the temporary storage block has enough
-      // space, we just call free_all
-      free_all(S->TempAlloc);
-      result = arena_allocator(allocator_mode::ALLOCATE, context, size, null, 0,
-                               options);
-      // Problem in multithreaded! See note above.
-    } else {
-      // If we try to allocate a block with size bigger than the temporary
-      // storage block, we make a new, larger temporary storage block.
-
-      platform_report_warning(
-          "Not enough memory in the temporary allocator "
-          "block; reallocating the pool");
-
-      os_free_block(S->TempAllocData.Block);
-      create_new_temp_storage_block(size * 2);
-
-      result = arena_allocator(allocator_mode::ALLOCATE, context, size, null, 0,
-                               options);
-    }
-  }
+  u64 Generation;
 
-  return result;
-}
+  struct overflow_block {
+    overflow_block *Next;
+    u64 Generation;
+  };
+  overflow_block *Overflow;
+};
+
+inline thread_local platform_temp_ring PlatformTempRing;
+
+void *platform_temp_alloc(allocator_mode mode, void *context, s64 size,
+                          void *oldMemory, s64 oldSize, u64 options);
+
+// The calling thread's current generation. Memory allocated now belongs to it.
+inline u64 platform_temp_generation() { return PlatformTempRing.Generation; }
+
+// Returns false if the memory at _ptr_ (allocated from the platform temporary
+// allocator on this thread during _generation_) has since been reused.
+bool platform_temp_is_live(void *ptr, u64 generation);
+
+// Gives the calling thread's ring (and overflow blocks) back to the OS.
+// Called on thread exit and by platform_uninit_state().
+void platform_temp_release();
 
 // Returns a pointer to the usable memory
 inline void *create_persistent_alloc_page(s64 size) {
   void *result = os_allocate_block(
-      size + sizeof(platform_memory_state::persistent_alloc_page));
+      size + sizeof(platform_memory_state::persistent_alloc_page),
+      PLATFORM_MEMORY_OPTIONS);
+  if (!result) return null;
 
   auto *p = (platform_memory_state::persistent_alloc_page *)result;
 
-  p->Next = S->PersistentAllocBasePage;
-  if (!S->PersistentAllocBasePage) {
-    S->PersistentAllocBasePage = p;
-  }
+  p->Prev = null;
+  p->Next = S->PersistentAllocLargePages;
+  if (p->Next) p->Next->Prev = p;
+  S->PersistentAllocLargePages = p;
+  S->PersistentAllocLargePagesSize += os_block_size(p);
 
   return (void *)(p + 1);
 }
 
+// Returns null if _ptr_ wasn't returned by create_persistent_alloc_page()
+inline platform_memory_state::persistent_alloc_page *find_persistent_alloc_page(
+    void *ptr) {
+  auto *p = S->PersistentAllocLargePages;
+  while (p && (void *)(p + 1) != ptr) p = p->Next;
+  return p;
+}
+
+inline void free_persistent_alloc_page(
+    platform_memory_state::persistent_alloc_page *p) {
+  if (p->Prev) {
+    p->Prev->Next = p->Next;
+  } else {
+    S->PersistentAllocLargePages = p->Next;
+  }
+  if (p->Next) p->Next->Prev = p->Prev;
+
+  S->PersistentAllocLargePagesSize -= os_block_size(p);
+  os_free_block(p);
+}
+
 inline void *platform_persistent_alloc(allocator_mode mode, void *context,
                                     s64 size, void *oldMemory, s64 oldSize,
                                     u64 options);
@@ -150,29 +314,26 @@ inline allocator platform_get_temporary_allocator() { return S->TempAlloc; }
 void platform_init_allocators();
 
 inline void platform_uninit_allocators() {
-  lock(&S->TempAllocMutex);
+  // The cached blocks live in the pages we free below
+  thread_caches_release();
+
   lock(&S->PersistentAllocMutex);
 
-  // Free all pages (pools and big allocations)
-  auto *p = S->PersistentAllocBasePage;
+  S->PersistentAllocCache.Caches = null;
+
+  // Free all pools and big allocations
+  tlsf_allocator_release(&S->PersistentAllocData);
+
+  auto *p = S->PersistentAllocLargePages;
   while (p) {
     auto *o = p;
     p = p->Next;
     os_free_block(o);
   }
-  S->PersistentAllocBasePage = null;
-
-  // Free temporary storage arena
-  os_free_block(S->TempAllocData.Block);
-  S->TempAllocData.Size = 0;
-  S->TempAllocData.Used = 0;
+  S->PersistentAllocLargePages = null;
+  S->PersistentAllocLargePagesSize = 0;
 
-  // Release mutexes
-
-  unlock(&S->TempAllocMutex);
   unlock(&S->PersistentAllocMutex);
-
-  free_mutex(&S->TempAllocMutex);
   free_mutex(&S->PersistentAllocMutex);
 }
 
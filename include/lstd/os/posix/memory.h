@@ -14,17 +14,114 @@
 
 LSTD_BEGIN_NAMESPACE
 
-mark_as_leak inline void *os_allocate_block(s64 size) {
+inline s64 os_get_page_size() { return sysconf(_SC_PAGESIZE); }
+
+// Touches a byte in every page in the range so the OS faults them in now
+inline void os_prefault_pages(void *ptr, s64 size) {
+  s64 pageSize = os_get_page_size();
+  for (s64 offset = 0; offset < size; offset += pageSize) {
+    ((volatile byte *)ptr)[offset] = 0;
+  }
+}
+
+// _size_ must be a multiple of the page size (of the huge page size with
+// OS_ALLOCATE_HUGE_PAGES)
+inline void *os_map_pages(s64 size, u64 options) {
+  int flags = MAP_ANONYMOUS | MAP_PRIVATE;
+#if defined MAP_POPULATE
+  if (options & OS_ALLOCATE_POPULATE) flags |= MAP_POPULATE;
+#endif
+
+  if (!(options & OS_ALLOCATE_HUGE_PAGES)) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ptr == MAP_FAILED) return null;
+#if !defined MAP_POPULATE
+    if (options & OS_ALLOCATE_POPULATE) os_prefault_pages(ptr, size);
+#endif
+    return ptr;
+  }
+
+#if defined MAP_HUGETLB
+  // Explicit huge pages only work if the admin reserved some, so this
+  // fails on most systems and we fall back to transparent huge pages.
+  void *huge = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+  if (huge != MAP_FAILED) return huge;
+#endif
+
+  // Transparent huge pages need 2 MiB alignment, so map more than we need
+  // and trim the ends. Populating is done after madvise so we get huge pages.
+  s64 mapped = size + OS_HUGE_PAGE_SIZE;
+
+  byte *ptr = (byte *)mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                           MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (ptr == (byte *)MAP_FAILED) return null;
+
+  byte *aligned = (byte *)(((u64)ptr + OS_HUGE_PAGE_SIZE - 1) & -OS_HUGE_PAGE_SIZE);
+  if (aligned != ptr) munmap(ptr, aligned - ptr);
+
+  byte *end = aligned + size;
+  if (end != ptr + mapped) munmap(end, ptr + mapped - end);
+
+#if defined MADV_HUGEPAGE
+  madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+  if (options & OS_ALLOCATE_POPULATE) os_prefault_pages(aligned, size);
+
+  return aligned;
+}
+
+mark_as_leak inline void *os_allocate_block(s64 size, u64 options) {
   assert(size < MAX_ALLOCATION_REQUEST);
 
-  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-  return ptr != MAP_FAILED ? ptr : null;
+  s64 pageSize = options & OS_ALLOCATE_HUGE_PAGES ? OS_HUGE_PAGE_SIZE
+                                                  : os_get_page_size();
+  s64 mapped = (size + sizeof(os_block_header) + pageSize - 1) & -pageSize;
+
+  auto *header = (os_block_header *)os_map_pages(mapped, options);
+  if (!header) return null;
+
+  header->Size = mapped;
+  header->Options = options;
+  return header + 1;
 }
 
 inline void os_free_block(void *ptr) {
-  if (munmap(ptr, 0) == -1) {
-    // Handle error 
+  auto *header = (os_block_header *)ptr - 1;
+  if (munmap(header, header->Size) == -1) {
+    assert(false && "Couldn't unmap block");
+  }
+}
+
+mark_as_leak inline void *os_reserve_block(s64 size) {
+  void *ptr = mmap(NULL, size, PROT_NONE,
+                   MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  return ptr != MAP_FAILED ? ptr : null;
+}
+
+inline bool os_commit_block(void *ptr, s64 size, u64 options) {
+  if (mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0) return false;
+
+#if defined MADV_HUGEPAGE
+  if (options & OS_ALLOCATE_HUGE_PAGES) madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+
+  if (options & OS_ALLOCATE_POPULATE) {
+#if defined MADV_POPULATE_WRITE
+    if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0) return true;
+#endif
+    os_prefault_pages(ptr, size);
   }
+  return true;
 }
 
+inline void os_decommit_block(void *ptr, s64 size) {
+  // MADV_DONTNEED drops the pages right away (so RSS falls immediately, unlike
+  // with MADV_FREE, which only lets the kernel take them under pressure).
+  // The next touch after recommitting gets zeroed pages.
+  madvise(ptr, size, MADV_DONTNEED);
+  mprotect(ptr, size, PROT_NONE);
+}
+
+inline void os_release_block(void *ptr, s64 size) { munmap(ptr, size); }
+
 LSTD_END_NAMESPACE
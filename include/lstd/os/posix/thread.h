@@ -90,9 +90,7 @@ inline void *thread_wrapper_function(void *data) {
 
   ti->Function(ti->UserData);  // <--- Call the user function with the user data
 
-#if defined DEBUG_MEMORY
-  debug_memory_uninit();
-#endif
+  lstd_uninit_thread();
 
   // free(ti); // Cross-thread free! @Leak
 
@@ -179,6 +179,30 @@ inline void lstd_init_thread() {
   const_cast<context *>(&Context)->ThreadID = os_get_current_thread_id();
 }
 
+// Call this before a thread exits. Reports leaks (if DEBUG_MEMORY), gives
+// back cached blocks to the shared allocators (see thread_cache_allocator),
+// frees the allocation profiler's tables, the thread's platform temporary
+// storage and releases the address space reserved by the temporary and
+// scratch arenas.
+inline void lstd_uninit_thread() {
+  // Before reporting leaks, temporary allocations aren't leaks
+  void platform_temp_release();
+  platform_temp_release();
+
+#if defined DEBUG_MEMORY
+  debug_memory_uninit();
+#endif
+
+  void thread_caches_release();
+  thread_caches_release();
+
+  void allocation_profiler_release();
+  allocation_profiler_release();
+
+  arena_allocator_release(&TemporaryAllocatorData);
+  For(ScratchArenas) arena_allocator_release(&it);
+}
+
 LSTD_END_NAMESPACE
 
 #if OS == WINDOWS
@@ -1077,6 +1077,11 @@ HANDLE OpenFileMappingW(DWORD dwDesiredAccess, BOOL bInheritHandle,
 
 BOOL HeapFree(HANDLE hHeap, DWORD dwFlags, LPVOID lpMem);
 
+LPVOID VirtualAlloc(LPVOID lpAddress, SIZE_T dwSize, DWORD flAllocationType,
+                    DWORD flProtect);
+
+BOOL VirtualFree(LPVOID lpAddress, SIZE_T dwSize, DWORD dwFreeType);
+
 void ExitProcess(UINT uExitCode);
 
 BOOL SetEnvironmentVariableW(LPCWSTR lpName, LPCWSTR lpValue);
@@ -1113,8 +1118,14 @@ DWORD GetCurrentProcessId();
 #define FILE_MAP_WRITE 0x0002
 #define FILE_MAP_READ 0x0004
 
+#define PAGE_NOACCESS 0x01
 #define PAGE_READWRITE 0x04
 
+#define MEM_COMMIT 0x00001000
+#define MEM_RESERVE 0x00002000
+#define MEM_DECOMMIT 0x00004000
+#define MEM_RELEASE 0x00008000
+
 #define CF_UNICODETEXT 13
 
 #define GHND 0x0042
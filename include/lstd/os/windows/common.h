@@ -479,6 +479,7 @@ inline void platform_init_context() {
   newContext.AllocAlignment = POINTER_SIZE;
   newContext.AllocOptions = 0;
   newContext.LogAllAllocations = false;
+  newContext.ProfileAllocations = false;
   newContext.PanicHandler = default_panic_handler;
   newContext.Log = &cout;
   newContext.FmtDisableAnsiCodes = false;
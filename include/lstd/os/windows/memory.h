@@ -8,13 +8,67 @@
 
 LSTD_BEGIN_NAMESPACE
 
-inline void *os_allocate_block(s64 size) {
+inline s64 os_get_page_size() {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwPageSize;
+}
+
+// Touches a byte in every page in the range so the OS faults them in now
+inline void os_prefault_pages(void *ptr, s64 size) {
+  s64 pageSize = os_get_page_size();
+  for (s64 offset = 0; offset < size; offset += pageSize) {
+    ((volatile byte *)ptr)[offset] = 0;
+  }
+}
+
+// Note: OS_ALLOCATE_HUGE_PAGES is ignored on Windows. Large pages there need
+// the SeLockMemoryPrivilege and VirtualAlloc with MEM_LARGE_PAGES, which
+// most processes don't have.
+//
+// We use VirtualAlloc instead of the process heap so the pages of a block can
+// be decommitted (see os_decommit_block()) and the whole thing is released.
+// We only commit whole pages, but Windows reserves address space in units of
+// the allocation granularity (64 KiB), so every block takes at least that
+// much address space. Small blocks which are allocated often should come
+// from a pool (e.g. a tlsf_allocator) rather than directly from here.
+inline void *os_allocate_block(s64 size, u64 options) {
   assert(size < MAX_ALLOCATION_REQUEST);
-  return HeapAlloc(GetProcessHeap(), 0, size);
+
+  s64 pageSize = os_get_page_size();
+  s64 mapped = (size + sizeof(os_block_header) + pageSize - 1) & -pageSize;
+
+  auto *header = (os_block_header *)VirtualAlloc(
+      null, mapped, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  if (!header) return null;
+
+  if (options & OS_ALLOCATE_POPULATE) os_prefault_pages(header, mapped);
+
+  header->Size = mapped;
+  header->Options = options;
+  return header + 1;
 }
 
 inline void os_free_block(void *ptr) {
-  WIN32_CHECK_BOOL(r, HeapFree(GetProcessHeap(), 0, ptr));
+  WIN32_CHECK_BOOL(r, VirtualFree((os_block_header *)ptr - 1, 0, MEM_RELEASE));
+}
+
+inline void *os_reserve_block(s64 size) {
+  return VirtualAlloc(null, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+inline bool os_commit_block(void *ptr, s64 size, u64 options) {
+  if (!VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE)) return false;
+  if (options & OS_ALLOCATE_POPULATE) os_prefault_pages(ptr, size);
+  return true;
+}
+
+inline void os_decommit_block(void *ptr, s64 size) {
+  WIN32_CHECK_BOOL(r, VirtualFree(ptr, size, MEM_DECOMMIT));
+}
+
+inline void os_release_block(void *ptr, s64 size) {
+  WIN32_CHECK_BOOL(r, VirtualFree(ptr, 0, MEM_RELEASE));
 }
 
 LSTD_END_NAMESPACE
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "xar.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// A slot map hands out handles instead of pointers or indices. A handle stays
+// valid (and keeps referring to the same element) no matter how many elements
+// are added or removed afterwards, and a handle to a removed element is
+// detected instead of silently aliasing whatever was put in its place.
+//
+// Elements are kept packed in _Values_, so iterating touches only live data
+// and _Values.Count_ is the number of elements.
+// _Slots_ maps a handle's index to the element's position in _Values_, and
+// _ValueSlots_ maps back, so removal can move the last element into the hole.
+// Removed slots go on a free list threaded through _Slots_ and their
+// generation is bumped, which is what invalidates the old handles.
+//
+// All three are exponential arrays, so growing never moves elements and never
+// copies the old storage. Note that removing does move the last element, so
+// pointers returned by get() are only good until the next remove().
+//
+//      slot_map<entity> entities;
+//      entities.Alloc = arena;  // Optional, defaults to the Context's allocator
+//
+//      auto h = add(entities, {...});
+//      if (auto *e = get(entities, h)) { ... }
+//      remove(entities, h);
+//      get(entities, h);  // null
+//
+inline const u32 SLOT_MAP_RETIRED_GENERATION = (u32) -2;
+
+struct slot_map_handle {
+  u32 Index = 0;
+  u32 Generation = 0;  // 0 is never handed out, so a zeroed handle is null
+
+  bool operator==(slot_map_handle other) const {
+    return Index == other.Index && Generation == other.Generation;
+  }
+
+  explicit operator bool() const { return Generation != 0; }
+};
+
+template <typename T_>
+struct slot_map {
+  using T = T_;
+
+  static const u32 FREE_LIST_END = (u32)-1;
+
+  struct slot {
+    // Position of the element in _Values_ while the slot is in use,
+    // or the next free slot while it's on the free list.
+    u32 DenseOrNextFree;
+    u32 Generation;  // Odd while in use, even while free
+  };
+
+  exponential_array<slot> Slots;
+  exponential_array<T> Values;
+  exponential_array<u32> ValueSlots;  // Slot index of each element in _Values_
+
+  u32 FreeHead = FREE_LIST_END;
+
+  // Used for all allocations. If null we use the Context's allocator.
+  allocator Alloc;
+};
+
+template <typename>
+const bool is_slot_map = false;
+
+template <typename T>
+const bool is_slot_map<slot_map<T>> = true;
+
+template <typename T>
+concept any_slot_map = is_slot_map<T>;
+
+template <any_slot_map M>
+using slot_map_value_t = typename M::T;
+
+// Reserves space for at least _n_ elements in total
+void reserve(any_slot_map auto ref map, s64 n) {
+  reserve(map.Slots, n, map.Alloc);
+  reserve(map.Values, n, map.Alloc);
+  reserve(map.ValueSlots, n, map.Alloc);
+}
+
+template <any_slot_map M>
+slot_map_handle add(M ref map, slot_map_value_t<M> no_copy value) {
+  u32 slotIndex;
+  if (map.FreeHead != M::FREE_LIST_END) {
+    slotIndex = map.FreeHead;
+    map.FreeHead = map.Slots[slotIndex].DenseOrNextFree;
+  } else {
+    reserve(map.Slots, map.Slots.Count + 1, map.Alloc);
+    slotIndex = (u32) map.Slots.Count++;
+    map.Slots[slotIndex].Generation = 0;
+  }
+
+  u32 denseIndex = (u32) map.Values.Count;
+  reserve(map.Values, denseIndex + 1, map.Alloc);
+  reserve(map.ValueSlots, denseIndex + 1, map.Alloc);
+  map.Values[map.Values.Count++] = value;
+  map.ValueSlots[map.ValueSlots.Count++] = slotIndex;
+
+  auto *s = &map.Slots[slotIndex];
+  s->DenseOrNextFree = denseIndex;
+  s->Generation++;
+
+  return {slotIndex, s->Generation};
+}
+
+// Returns null if the handle is null or its element has been removed
+template <any_slot_map M>
+slot_map_value_t<M> *get(M ref map, slot_map_handle handle) {
+  if (handle.Index >= map.Slots.Count) return null;
+
+  auto *s = &map.Slots[handle.Index];
+  if (s->Generation != handle.Generation || !(s->Generation & 1)) return null;
+  return &map.Values[s->DenseOrNextFree];
+}
+
+bool has(any_slot_map auto ref map, slot_map_handle handle) {
+  return get(map, handle) != null;
+}
+
+// Returns false if the handle was already invalid
+template <any_slot_map M>
+bool remove(M ref map, slot_map_handle handle) {
+  if (!get(map, handle)) return false;
+
+  auto *s = &map.Slots[handle.Index];
+  u32 denseIndex = s->DenseOrNextFree;
+
+  // Move the last element into the hole and repoint its slot
+  u32 last = (u32) map.Values.Count - 1;
+  if (denseIndex != last) {
+    u32 movedSlot = map.ValueSlots[last];
+    map.Values[denseIndex] = map.Values[last];
+    map.ValueSlots[denseIndex] = movedSlot;
+    map.Slots[movedSlot].DenseOrNextFree = denseIndex;
+  }
+  map.Values.Count--;
+  map.ValueSlots.Count--;
+
+  // Once the generation would wrap around, retire the slot for good instead
+  // of risking an old handle becoming valid again.
+  s->Generation++;
+  if (s->Generation != SLOT_MAP_RETIRED_GENERATION) {
+    s->DenseOrNextFree = map.FreeHead;
+    map.FreeHead = handle.Index;
+  }
+  return true;
+}
+
+// Removes all elements and invalidates every handle, but keeps the memory
+template <any_slot_map M>
+void reset(M ref map) {
+  map.FreeHead = M::FREE_LIST_END;
+  for (u32 i = (u32) map.Slots.Count; i-- > 0;) {
+    auto *s = &map.Slots[i];
+    if (s->Generation & 1) s->Generation++;
+    if (s->Generation == SLOT_MAP_RETIRED_GENERATION) continue;  // See remove()
+
+    s->DenseOrNextFree = map.FreeHead;
+    map.FreeHead = i;
+  }
+  map.Values.Count = 0;
+  map.ValueSlots.Count = 0;
+}
+
+// Handles that were handed out must not be used after this, since the
+// generations start over.
+void free(any_slot_map auto ref map) {
+  free(map.Slots);
+  free(map.Values);
+  free(map.ValueSlots);
+  map.FreeHead = remove_cvref_t<decltype(map)>::FREE_LIST_END;
+}
+
+// Calls _visitor_ with (value pointer, handle) for each live element, in
+// storage order. Return false from the visitor to stop. Don't add or remove
+// elements while visiting.
+void slot_map_visit(any_slot_map auto ref map, auto visitor) {
+  For(range(map.Values.Count)) {
+    u32 slotIndex = map.ValueSlots[it];
+    slot_map_handle handle = {slotIndex, map.Slots[slotIndex].Generation};
+    if (!visitor(&map.Values[it], handle)) break;
+  }
+}
+
+LSTD_END_NAMESPACE
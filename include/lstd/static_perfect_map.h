@@ -0,0 +1,169 @@
+#pragma once
+
+#include "hash_table.h"
+#include "string.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// A map from a fixed list of string keys to values, built at compile time so
+// that a lookup is one hash and one key compare, e.g. for keyword tables
+// which would otherwise be a chain of strings_match calls.
+//
+//      static constexpr static_perfect_map_item<token_type> KEYWORD_ITEMS[] = {
+//          {"if", token_type::IF}, {"else", token_type::ELSE}, ...
+//      };
+//      static constexpr auto KEYWORDS = make_static_perfect_map(KEYWORD_ITEMS);
+//
+//      auto *type = search(KEYWORDS, word);  // null if it's not a keyword
+//
+// Building uses "hash and displace" (as in CHD or PTHash): a key's hash picks
+// its bucket (there are about half as many buckets as keys), and every bucket
+// gets a small number (its pilot) which, mixed into the hash of each of its
+// keys, sends them all to slots that are still free. Buckets are placed
+// biggest first, while it's still easy to find free slots. The table has at
+// least twice as many slots as keys, so placing a bucket takes a few tries.
+//
+// The keys must be distinct, building fails to compile otherwise.
+//
+
+template <typename V>
+struct static_perfect_map_item {
+  const char *Key;
+  V Value;
+};
+
+template <typename V_, s64 N_>
+struct static_perfect_map {
+  using V = V_;
+
+  static constexpr s64 N = N_;
+
+  static constexpr s64 SLOT_BITS = [] {
+    s64 bits = 1;
+    while ((1ll << bits) < 2 * N) ++bits;
+    return bits;
+  }();
+  static constexpr s64 SLOTS = 1ll << SLOT_BITS;
+  static constexpr s64 BUCKETS = (N + 1) / 2;
+
+  struct entry {
+    const char *Key = null;  // null for empty slots
+    s64 KeyCount = 0;
+    V Value = {};
+  };
+  entry Entries[SLOTS] = {};
+
+  u16 Pilots[BUCKETS] = {};
+};
+
+// Separate from get_hash() because it must work at compile time.
+// FNV-1a and a final mix (the slot comes from the low bits).
+constexpr u64 static_perfect_map_hash(const char *key, s64 count) {
+  u64 hash = 0xCBF29CE484222325ull;
+  for (s64 i = 0; i < count; ++i) hash = (hash ^ (u8) key[i]) * 0x100000001B3ull;
+  hash ^= hash >> 32;
+  hash *= 0xD6E8FEB86659FD93ull;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+template <typename M>
+constexpr s64 static_perfect_map_bucket(u64 hash) {
+  return (s64) (((hash >> 32) * (u64) M::BUCKETS) >> 32);
+}
+
+template <typename M>
+constexpr s64 static_perfect_map_slot(u64 hash, u16 pilot) {
+  u64 x = (hash ^ (pilot * 0x9E3779B97F4A7C15ull)) * 0xD6E8FEB86659FD93ull;
+  return (s64) (x >> (64 - M::SLOT_BITS));
+}
+
+// Not constexpr, so reaching it while building makes the build fail to compile
+inline void static_perfect_map_build_failed(const char *) {}
+
+template <typename V, s64 N>
+constexpr auto make_static_perfect_map(const static_perfect_map_item<V> (&items)[N]) {
+  using map_t = static_perfect_map<V, N>;
+  map_t map;
+
+  u64 hashes[N] = {};
+  s64 counts[N] = {};
+  s64 buckets[N] = {};
+  s64 bucketSizes[map_t::BUCKETS] = {};
+
+  for (s64 i = 0; i < N; ++i) {
+    const char *key = items[i].Key;
+    while (key[counts[i]]) ++counts[i];
+
+    hashes[i] = static_perfect_map_hash(key, counts[i]);
+    buckets[i] = static_perfect_map_bucket<map_t>(hashes[i]);
+    ++bucketSizes[buckets[i]];
+
+    // Keys with the same hash can't be separated, almost surely a duplicate
+    for (s64 j = 0; j < i; ++j) {
+      if (hashes[j] == hashes[i]) static_perfect_map_build_failed("Duplicate key");
+    }
+  }
+
+  // Biggest buckets first
+  s64 order[map_t::BUCKETS] = {};
+  for (s64 b = 0; b < map_t::BUCKETS; ++b) {
+    s64 at = b;
+    while (at > 0 && bucketSizes[order[at - 1]] < bucketSizes[b]) {
+      order[at] = order[at - 1];
+      --at;
+    }
+    order[at] = b;
+  }
+
+  bool taken[map_t::SLOTS] = {};
+  for (s64 o = 0; o < map_t::BUCKETS; ++o) {
+    s64 b = order[o];
+    if (!bucketSizes[b]) break;
+
+    s64 keys[N] = {}, slots[N] = {}, count = 0;
+    for (s64 i = 0; i < N; ++i) {
+      if (buckets[i] == b) keys[count++] = i;
+    }
+
+    bool placed = false;
+    for (u32 pilot = 0; pilot <= 0xFFFF && !placed; ++pilot) {
+      placed = true;
+      for (s64 k = 0; k < count && placed; ++k) {
+        slots[k] = static_perfect_map_slot<map_t>(hashes[keys[k]], (u16) pilot);
+        if (taken[slots[k]]) placed = false;
+        for (s64 j = 0; j < k; ++j) {
+          if (slots[j] == slots[k]) placed = false;
+        }
+      }
+
+      if (placed) {
+        map.Pilots[b] = (u16) pilot;
+        for (s64 k = 0; k < count; ++k) {
+          taken[slots[k]] = true;
+          map.Entries[slots[k]] = {items[keys[k]].Key, counts[keys[k]], items[keys[k]].Value};
+        }
+      }
+    }
+    if (!placed) static_perfect_map_build_failed("No pilot found");
+  }
+  return map;
+}
+
+// Returns a pointer to the value of _key_ or null if it's not one of the keys
+template <typename V, s64 N>
+const V *search_opt(static_perfect_map<V, N> no_copy map, string no_copy key,
+                    table_search_options options = {}) {
+  using map_t = static_perfect_map<V, N>;
+
+  u64 hash = static_perfect_map_hash(key.Data, key.Count);
+  u16 pilot = map.Pilots[static_perfect_map_bucket<map_t>(hash)];
+
+  auto *entry = map.Entries + static_perfect_map_slot<map_t>(hash, pilot);
+  if (entry->KeyCount != key.Count || !entry->Key) return null;
+  if (memcmp(entry->Key, key.Data, key.Count) != 0) return null;
+  return &entry->Value;
+}
+
+LSTD_END_NAMESPACE
@@ -0,0 +1,452 @@
+#pragma once
+
+#include "hash_table.h"
+
+#if COMPILER == MSVC && ARCH == X86
+#include <intrin.h>
+#endif
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// A second hash map in the style of Abseil's "Swiss tables".
+//
+// hash_table keeps the full 64-bit hash next to every key and value and probes
+// one entry at a time, so every probe drags a whole {Hash, Key, Value} entry
+// into the cache. That's great for small values, but with big values most of
+// each cache line is wasted on entries we only look at to reject.
+//
+// Here the metadata lives in a separate array with one control byte per slot:
+//   - EMPTY (0x80) and DELETED (0xFE) have the top bit set,
+//   - a used slot stores H2, the low 7 bits of the (mixed) hash.
+// The rest of the hash (H1) picks the starting position. We probe 16 control
+// bytes at a time, with SSE2 that's one compare and one movemask for the whole
+// group, and we touch the entries only for bytes that matched H2 (a false
+// positive happens with a probability of 1/128 per used slot). A group which
+// contains an EMPTY byte ends the search.
+//
+// Since looking at a group is that cheap we can afford to fill the table up to
+// 7/8 (MAX_LOAD_NUMERATOR / MAX_LOAD_DENOMINATOR) before growing.
+//
+// The first GROUP_SIZE control bytes are mirrored after the last slot, so a
+// group starting near the end can be loaded in one go without wrapping.
+//
+// Groups are probed in a triangular sequence (pos + 16, + 32, + 48, ...)
+// which visits every group once when the capacity is a power of two.
+//
+// The free-function API is the same as hash_table's: add, set, search, has,
+// remove, reset, free, clone and iteration with
+//
+//      for (auto [key, value] : table) {
+//          ...
+//      }
+//
+// Note: Like hash_table, add() doesn't check if the key is already in the
+// table, use set() for that.
+//
+// Note: We don't store hashes, so when growing we call get_hash() on the keys
+// again. The _prehashed_ functions are there to avoid hashing twice, the hash
+// you pass them must be get_hash(key).
+//
+template <typename K_, typename V_>
+struct swiss_table {
+  static const s64 GROUP_SIZE = 16;
+  static const s64 MINIMUM_SIZE = 16;  // Must be at least GROUP_SIZE
+
+  static const s64 MAX_LOAD_NUMERATOR = 7;
+  static const s64 MAX_LOAD_DENOMINATOR = 8;
+
+  static const s8 EMPTY = (s8) 0x80;
+  static const s8 DELETED = (s8) 0xFE;
+
+  using K = K_;
+  using V = V_;
+
+  struct entry {
+    K Key;
+    V Value;
+  };
+
+  // Allocated + GROUP_SIZE bytes, see the comment above
+  s8 *Control = null;
+  entry *Entries = null;
+
+  s64 Count = 0;       // Number of slots in use
+  s64 GrowthLeft = 0;  // How many EMPTY slots we can still fill before growing
+  s64 Allocated = 0;   // Number of slots allocated in total, a power of 2
+
+  swiss_table() = default;
+
+  swiss_table(initializer_list<pair<K, V>> init) {
+    for (const auto &p : init) {
+      add(*this, p.first, p.second);
+    }
+  }
+};
+
+template <typename>
+const bool is_swiss_table = false;
+
+template <typename K, typename V>
+const bool is_swiss_table<swiss_table<K, V>> = true;
+
+template <typename T>
+concept any_swiss_table = is_swiss_table<T>;
+
+//
+// Operations on a group of 16 control bytes. Each returns a bit mask with
+// bit i set when the i-th byte matched.
+//
+#if ARCH == X86 && (COMPILER == GCC || COMPILER == CLANG) && defined __SSE2__
+typedef char swiss_group_vector __attribute__((vector_size(16), aligned(1)));
+
+inline u32 swiss_group_match_byte(const s8 *group, s8 b) {
+  auto v = *(const swiss_group_vector *) group;
+  return (u32) __builtin_ia32_pmovmskb128((swiss_group_vector)(v == (char) b));
+}
+
+// EMPTY and DELETED are the only control bytes with the top bit set
+inline u32 swiss_group_match_empty_or_deleted(const s8 *group) {
+  auto v = *(const swiss_group_vector *) group;
+  return (u32) __builtin_ia32_pmovmskb128(v);
+}
+#elif ARCH == X86 && COMPILER == MSVC
+inline u32 swiss_group_match_byte(const s8 *group, s8 b) {
+  __m128i v = _mm_loadu_si128((const __m128i *) group);
+  return (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(b)));
+}
+
+inline u32 swiss_group_match_empty_or_deleted(const s8 *group) {
+  return (u32) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+}
+#else
+inline u32 swiss_group_match_byte(const s8 *group, s8 b) {
+  u32 result = 0;
+  For(range(16)) result |= (u32) (group[it] == b) << it;
+  return result;
+}
+
+inline u32 swiss_group_match_empty_or_deleted(const s8 *group) {
+  u32 result = 0;
+  For(range(16)) result |= (u32) (group[it] < 0) << it;
+  return result;
+}
+#endif
+
+inline u32 swiss_group_match_empty(const s8 *group) {
+  return swiss_group_match_byte(group, (s8) 0x80);
+}
+
+// Trivial hashes (e.g. integers hash to themselves) would all land in the
+// same group and share H2, so spread the bits over the whole word first.
+inline u64 swiss_table_mix_hash(u64 hash) {
+  hash *= 0x9E3779B97F4A7C15ull;
+  return hash ^ (hash >> 32);
+}
+
+template <any_swiss_table T>
+void swiss_table_set_control(T ref table, s64 index, s8 c) {
+  table.Control[index] = c;
+  if (index < T::GROUP_SIZE) table.Control[table.Allocated + index] = c;
+}
+
+// Returns the first EMPTY or DELETED slot in the probe sequence for _hash_
+// (already mixed). There is always one because we never fill the table.
+template <any_swiss_table T>
+s64 swiss_table_find_free_slot(T ref table, u64 hash) {
+  u64 mask = table.Allocated - 1;
+  u64 pos = (hash >> 7) & mask;
+  u64 stride = 0;
+  while (true) {
+    u32 freeSlots = swiss_group_match_empty_or_deleted(table.Control + pos);
+    if (freeSlots) return (pos + lsb(freeSlots)) & mask;
+
+    stride += T::GROUP_SIZE;
+    pos = (pos + stride) & mask;
+  }
+}
+
+// Allocates _capacity_ slots and reinserts all entries, dropping DELETED
+// markers in the process. _capacity_ must be a power of two.
+template <any_swiss_table T>
+void swiss_table_rehash(T ref table, s64 capacity) {
+  auto *oldControl = table.Control;
+  auto *oldEntries = table.Entries;
+  s64 oldAllocated = table.Allocated;
+
+  table.Control = malloc<s8>({.Count = capacity + T::GROUP_SIZE});
+  table.Entries = malloc<typename T::entry>({.Count = capacity});
+  memset(table.Control, (byte) T::EMPTY, capacity + T::GROUP_SIZE);
+  table.Allocated = capacity;
+  table.GrowthLeft =
+      capacity * T::MAX_LOAD_NUMERATOR / T::MAX_LOAD_DENOMINATOR - table.Count;
+
+  For_as(it_index, range(oldAllocated)) {
+    if (oldControl[it_index] < 0) continue;
+
+    auto *it = oldEntries + it_index;
+    u64 hash = swiss_table_mix_hash(get_hash(it->Key));
+
+    s64 index = swiss_table_find_free_slot(table, hash);
+    swiss_table_set_control(table, index, (s8) (hash & 0x7F));
+    table.Entries[index] = *it;
+  }
+
+  if (oldAllocated) {
+    free(oldControl);
+    free(oldEntries);
+  }
+}
+
+// Reserves space equal to the next power of two bigger than _slotsToAllocate_,
+// starting at _MINIMUM_SIZE_. Note that only 7/8 of the slots can be used
+// before the table grows again.
+//
+// You don't need to call this before using the table.
+void resize(any_swiss_table auto ref table, s64 slotsToAllocate) {
+  if (slotsToAllocate <= table.Allocated) return;
+
+  s64 target = max<s64>(ceil_pow_of_2(slotsToAllocate), table.MINIMUM_SIZE);
+  swiss_table_rehash(table, target);
+}
+
+// Free any memory allocated by this object and reset count
+void free(any_swiss_table auto ref table) {
+  if (table.Allocated) {
+    free(table.Control);
+    free(table.Entries);
+  }
+  table.Control = null;
+  table.Entries = null;
+  table.Allocated = 0;
+  table.Count = 0;
+  table.GrowthLeft = 0;
+}
+
+// Don't free the table, just destroy contents and reset count
+template <any_swiss_table T>
+void reset(T ref table) {
+  if (!table.Allocated) return;
+
+  memset(table.Control, (byte) T::EMPTY, table.Allocated + T::GROUP_SIZE);
+  table.Count = 0;
+  table.GrowthLeft =
+      table.Allocated * T::MAX_LOAD_NUMERATOR / T::MAX_LOAD_DENOMINATOR;
+}
+
+// Returns the slot index of _key_ or -1. _hash_ is already mixed.
+template <any_swiss_table T>
+s64 swiss_table_find(T ref table, u64 hash, table_key_t<T> no_copy key) {
+  if (!table.Count) return -1;
+
+  s8 h2 = (s8) (hash & 0x7F);
+
+  u64 mask = table.Allocated - 1;
+  u64 pos = (hash >> 7) & mask;
+  u64 stride = 0;
+  while (true) {
+    const s8 *group = table.Control + pos;
+
+    for (u32 m = swiss_group_match_byte(group, h2); m; m &= m - 1) {
+      s64 index = (pos + lsb(m)) & mask;
+      if (compare_equals(table.Entries[index].Key, key)) return index;
+    }
+    if (swiss_group_match_empty(group)) return -1;
+
+    stride += T::GROUP_SIZE;
+    pos = (pos + stride) & mask;
+  }
+}
+
+// Looks for key in the table using the given hash
+template <any_swiss_table T>
+key_value_pair<T> search_prehashed(T ref table, u64 hash,
+                                   table_key_t<T> no_copy key) {
+  s64 index = swiss_table_find(table, swiss_table_mix_hash(hash), key);
+  if (index == -1) return {null, null};
+
+  auto *entry = table.Entries + index;
+  return {&entry->Key, &entry->Value};
+}
+
+template <any_swiss_table T>
+auto search_opt(T ref table, table_key_t<T> no_copy key,
+                table_search_options options = {}) {
+  return search_prehashed(table, get_hash(key), key);
+}
+
+// Returns pointers to the added key and value.
+template <any_swiss_table T>
+key_value_pair<T> add_prehashed(T ref table, u64 hash,
+                                table_key_t<T> no_copy key,
+                                table_value_t<T> no_copy value) {
+  hash = swiss_table_mix_hash(hash);
+
+  if (!table.Allocated) {
+    swiss_table_rehash(table, T::MINIMUM_SIZE);
+  }
+
+  s64 index = swiss_table_find_free_slot(table, hash);
+
+  // Reusing a DELETED slot doesn't use up an EMPTY one, so we don't need
+  // to check if we have to grow.
+  if (table.Control[index] == T::EMPTY) {
+    if (table.GrowthLeft == 0) {
+      // If a lot of the used up slots are DELETED, just clean those up
+      // instead of growing.
+      s64 maxCount =
+          table.Allocated * T::MAX_LOAD_NUMERATOR / T::MAX_LOAD_DENOMINATOR;
+      if (table.Count * 2 <= maxCount) {
+        swiss_table_rehash(table, table.Allocated);
+      } else {
+        swiss_table_rehash(table, table.Allocated * 2);
+      }
+      index = swiss_table_find_free_slot(table, hash);
+    }
+    --table.GrowthLeft;
+  }
+
+  ++table.Count;
+
+  swiss_table_set_control(table, index, (s8) (hash & 0x7F));
+
+  auto *entry = table.Entries + index;
+  *entry = {key, value};
+  return {&entry->Key, &entry->Value};
+}
+
+template <any_swiss_table T>
+key_value_pair<T> add(T ref table, table_key_t<T> no_copy key,
+                      table_value_t<T> no_copy value) {
+  return add_prehashed(table, get_hash(key), key, value);
+}
+
+template <any_swiss_table T>
+key_value_pair<T> set_prehashed(T ref table, u64 hash,
+                                table_key_t<T> no_copy key,
+                                table_value_t<T> no_copy value) {
+  auto [kp, vp] = search_prehashed(table, hash, key);
+  if (vp) {
+    *vp = value;
+    return {kp, vp};
+  }
+  return add_prehashed(table, hash, key, value);
+}
+
+template <any_swiss_table T>
+key_value_pair<T> set(T ref table, table_key_t<T> no_copy key,
+                      table_value_t<T> no_copy value) {
+  return set_prehashed(table, get_hash(key), key, value);
+}
+
+// Returns true if the key was found and removed.
+template <any_swiss_table T>
+bool remove_prehashed(T ref table, u64 hash, table_key_t<T> no_copy key) {
+  s64 index = swiss_table_find(table, swiss_table_mix_hash(hash), key);
+  if (index == -1) return false;
+
+  --table.Count;
+
+  // If there is an EMPTY slot in every group that could contain this slot,
+  // no search ever went past it, so we can mark it EMPTY instead of DELETED
+  // and get the slot back.
+  s64 mask = table.Allocated - 1;
+  u32 emptyBefore =
+      swiss_group_match_empty(table.Control + ((index - T::GROUP_SIZE) & mask));
+  u32 emptyAfter = swiss_group_match_empty(table.Control + index);
+
+  if (emptyBefore && emptyAfter &&
+      (15 - msb(emptyBefore)) + lsb(emptyAfter) < T::GROUP_SIZE) {
+    swiss_table_set_control(table, index, T::EMPTY);
+    ++table.GrowthLeft;
+  } else {
+    swiss_table_set_control(table, index, T::DELETED);
+  }
+  return true;
+}
+
+// Returns true if the key was found and removed.
+template <any_swiss_table T>
+bool remove(T ref table, table_key_t<T> no_copy key) {
+  return remove_prehashed(table, get_hash(key), key);
+}
+
+// Returns true if the table has the given key.
+template <any_swiss_table T>
+bool has(T ref table, table_key_t<T> no_copy key) {
+  return search(table, key).Key != null;
+}
+
+// Returns true if the table has the given key.
+template <any_swiss_table T>
+bool has_prehashed(T ref table, u64 hash, table_key_t<T> no_copy key) {
+  return search_prehashed(table, hash, key).Key != null;
+}
+
+template <any_swiss_table T>
+bool operator==(T ref t, T ref u) {
+  if (t.Count != u.Count) return false;
+
+  for (auto [k, v] : t) {
+    auto [uk, uv] = search(u, *k);
+    if (!uv || *v != *uv) return false;
+  }
+  return true;
+}
+
+template <any_swiss_table T>
+bool operator!=(T ref t, T ref u) {
+  return !(t == u);
+}
+
+template <any_swiss_table T>
+T clone(T ref src) {
+  T table;
+  resize(table, src.Allocated);
+  for (auto [k, v] : src) add(table, *k, *v);
+  return table;
+}
+
+template <any_swiss_table T>
+struct swiss_table_iterator {
+  using swiss_table_t = T;
+
+  swiss_table_t ref Table;
+  s64 Index;
+
+  swiss_table_iterator(T ref table, s64 index = 0) : Table(table), Index(index) {
+    skip_empty_slots();
+  }
+
+  swiss_table_iterator &operator++() {
+    return ++Index, skip_empty_slots(), *this;
+  }
+
+  swiss_table_iterator operator++(s32) {
+    swiss_table_iterator pre = *this;
+    return ++*this, pre;
+  }
+
+  bool operator==(swiss_table_iterator other) const {
+    return &Table == &other.Table && Index == other.Index;
+  }
+  bool operator!=(swiss_table_iterator other) const { return !(*this == other); }
+
+  key_value_pair<swiss_table_t> operator*() {
+    auto *entry = Table.Entries + Index;
+    return {&entry->Key, &entry->Value};
+  }
+
+  void skip_empty_slots() {
+    for (; Index < Table.Allocated; ++Index) {
+      if (Table.Control[Index] >= 0) break;
+    }
+  }
+};
+
+auto begin(any_swiss_table auto ref table) { return swiss_table_iterator(table); }
+auto end(any_swiss_table auto ref table) {
+  return swiss_table_iterator(table, table.Allocated);
+}
+
+LSTD_END_NAMESPACE
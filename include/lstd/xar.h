@@ -32,21 +32,26 @@ struct exponential_array {
         return Chunks[chunkIndex];
     }
 
+    // How many elements chunk _chunkIndex_ holds. The first two chunks hold
+    // 1 << BASE_SHIFT each and every one after that twice the one before, so
+    // chunk _chunkIndex_ (> 0) also starts at this index.
+    static constexpr usize chunk_capacity(usize chunkIndex) {
+        return chunkIndex <= 1 ? (1ull << BASE_SHIFT) : (1ull << (BASE_SHIFT + chunkIndex - 1));
+    }
+
+    // Which chunk holds the element at _index_
+    static usize chunk_index(usize index) {
+        usize i_shift = index >> BASE_SHIFT;
+        return i_shift ? msb(i_shift) + 1 : 0;
+    }
+
     T& get(s64 index) {
         index = translate_negative_index(index, Count);
 #if defined LSTD_ARRAY_BOUNDS_CHECK
         assert(index >= 0 && index < Count && "Index out of bounds");
 #endif
-        usize chunk_i = index;
-        usize chunk_cap = 1 << BASE_SHIFT;
-        usize chunks_i = 0;
-        usize i_shift = index >> BASE_SHIFT;
-        if (i_shift > 0) {
-            chunks_i = msb(i_shift);
-            chunk_cap = 1 << (chunks_i + BASE_SHIFT);
-            chunk_i -= chunk_cap;
-            chunks_i++;
-        }
+        usize chunks_i = chunk_index(index);
+        usize chunk_i = chunks_i ? index - chunk_capacity(chunks_i) : index;
         return get_chunk_ptr(chunks_i)[chunk_i];
     }
 
@@ -82,7 +87,7 @@ void reserve(any_xar auto ref arr, usize newSize, allocator alloc = {}) {
     if (next_index <= 1 && arr.N > 1 && arr.Chunks[1] != null) { current_capacity += base_size; next_index = 2; }
     for (usize i = 2; i < arr.N; ++i) {
         if (arr.Chunks[i] == null) break;
-        current_capacity += (1u << (arr.BASE_SHIFT + i - 1));
+        current_capacity += ArrT::chunk_capacity(i);
         next_index = i + 1;
     }
     
@@ -90,7 +95,7 @@ void reserve(any_xar auto ref arr, usize newSize, allocator alloc = {}) {
     
     // Grow until capacity >= newSize, starting from the first missing chunk
     for (usize i = next_index; i < arr.N && current_capacity < newSize; ++i) {
-        const usize chunk_size = (i == 0 || i == 1) ? base_size : (1u << (arr.BASE_SHIFT + i - 1));
+        const usize chunk_size = ArrT::chunk_capacity(i);
 
         if (i == 0) {
             if constexpr (!ArrT::STACK_FIRST) {
@@ -150,9 +155,7 @@ void free(any_xar auto ref arr) {
 void exponential_array_visit_chunks(any_xar auto ref arr, auto visitor) {
     usize processed = 0;
     for (usize chunk_i = 0; chunk_i < arr.N && processed < arr.Count; ++chunk_i) {
-    const usize chunk_size = (chunk_i == 0 || chunk_i == 1)
-                   ? (1u << arr.BASE_SHIFT)
-                   : (1u << (arr.BASE_SHIFT + chunk_i - 1));
+        const usize chunk_size = remove_cvref_t<decltype(arr)>::chunk_capacity(chunk_i);
         auto *ptr = arr.get_chunk_ptr(chunk_i);
         if (ptr == null) break; // no more allocated chunks
         const usize elements_in_chunk = min(chunk_size, arr.Count - processed);
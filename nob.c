@@ -14,6 +14,7 @@
 #define SRC_FOLDER "src/"
 #define INCLUDE_FOLDER "include/"
 #define TEST_SUITE_FOLDER "test-suite/"
+#define BENCHMARKS_FOLDER "benchmarks/"
 
 typedef enum
 {
@@ -52,6 +53,7 @@ void print_usage(const char *program_name)
     nob_log(INFO, "  release    - Release build (default)\n");
     nob_log(INFO, "\nOther commands:\n");
     nob_log(INFO, "  flags [config] - Print compiler flags for the (optionally specified) configuration and exit.\n");
+    nob_log(INFO, "  bench          - Build (Release) and run the benchmarks.\n");
 }
 
 void add_specific_flags(Cmd *cmd, Config config)
@@ -254,10 +256,56 @@ bool build_test_suite(Config config)
     return true;
 }
 
+bool build_benchmarks(Config config)
+{
+    nob_log(INFO, "Building benchmarks (%s)\n", config_names[config]);
+
+    const char *build_folder = get_build_folder(config);
+    if (!mkdir_if_not_exists(temp_sprintf("%sbin/", build_folder)))
+        return false;
+
+    File_Paths bench_dirs = {0};
+    da_append(&bench_dirs, BENCHMARKS_FOLDER);
+
+    const char *unity_cpp = BENCHMARKS_FOLDER "main.cpp";
+    const char *exe_path = temp_sprintf("%sbin/%s", build_folder, "benchmarks");
+
+    bool needs_rebuild_exe = needs_rebuild1(exe_path, temp_sprintf("%slib/liblstd.a", build_folder));
+    if (!needs_rebuild_exe)
+    {
+        needs_rebuild_exe = needs_rebuild_cpp_sources(exe_path, bench_dirs);
+    }
+
+    if (needs_rebuild_exe)
+    {
+        Cmd cmd = {0};
+        cmd_append(&cmd, "c++");
+
+        add_common_flags(&cmd, config);
+
+        nob_cc_inputs(&cmd, unity_cpp);
+        nob_cc_output(&cmd, exe_path);
+
+        cmd_append(&cmd, "-I" INCLUDE_FOLDER);
+        cmd_append(&cmd, temp_sprintf("-L%slib", build_folder));
+        cmd_append(&cmd, "-llstd");
+
+        // The benchmarks compare against the CRT functions, so unlike the
+        // test-suite we always link with it
+#if defined(__linux__) || defined(__APPLE__)
+        cmd_append(&cmd, "-lpthread", "-ldl");
+#endif
+        if (!cmd_run_sync(cmd))
+            return false;
+    }
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     NOB_GO_REBUILD_URSELF(argc, argv);
     Config config = CONFIG_DEBUG;
+    bool run_benchmarks = false;
 
     for (int i = 1; i < argc; ++i)
     {
@@ -278,6 +326,11 @@ int main(int argc, char **argv)
         {
             config = CONFIG_RELEASE;
         }
+        else if (strcmp(argv[i], "bench") == 0)
+        {
+            config = CONFIG_RELEASE;
+            run_benchmarks = true;
+        }
         else
         {
             nob_log(ERROR, "Unknown argument: %s\n", argv[i]);
@@ -292,6 +345,19 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    if (run_benchmarks)
+    {
+        if (!build_benchmarks(config))
+        {
+            nob_log(ERROR, "Failed to build benchmarks\n");
+            return 1;
+        }
+
+        Cmd cmd = {0};
+        cmd_append(&cmd, temp_sprintf("%sbin/benchmarks", get_build_folder(config)));
+        return cmd_run_sync(cmd) ? 0 : 1;
+    }
+
     if (!build_test_suite(config))
     {
         nob_log(ERROR, "Failed to build test-suite\n");
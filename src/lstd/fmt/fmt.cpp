@@ -1,6 +1,7 @@
 #include "lstd/parse.h"
 #include "lstd/context.h"
 #include "lstd/fmt.h"
+#include "lstd/static_perfect_map.h"
 
 LSTD_BEGIN_NAMESPACE
 
@@ -45,17 +46,20 @@ inline string color_to_string(color c)
   }
 }
 
+static constexpr static_perfect_map_item<color> COLOR_ITEMS[] = {
+#define COLOR_DEF(x, y) {#x, color::x},
+#include "colors.inl"
+#undef COLOR_DEF
+};
+static constexpr auto COLORS_BY_NAME = make_static_perfect_map(COLOR_ITEMS);
+
 // Colors are defined all-uppercase and this function is case-sensitive
 //   e.g. cornflower_blue doesn't return color::CORNFLOWER_BLUE
 // Returns color::NONE (with value of black) if not found.
 inline color string_to_color(string str)
 {
-#define COLOR_DEF(x, y)               \
-  if (strings_match(str, string(#x))) \
-    return color::x;
-#include "colors.inl"
-#undef COLOR_DEF
-  return color::NONE;
+  auto *c = search(COLORS_BY_NAME, str);
+  return c ? *c : color::NONE;
 }
 
 inline string terminal_color_to_string(terminal_color c)
@@ -72,17 +76,20 @@ inline string terminal_color_to_string(terminal_color c)
   }
 }
 
+static constexpr static_perfect_map_item<terminal_color> TERMINAL_COLOR_ITEMS[] = {
+#define COLOR_DEF(x, y) {#x, terminal_color::x},
+#include "terminal_colors.inl"
+#undef COLOR_DEF
+};
+static constexpr auto TERMINAL_COLORS_BY_NAME = make_static_perfect_map(TERMINAL_COLOR_ITEMS);
+
 // Colors are defined all-uppercase and this function is case-sensitive
 //   e.g. bright_black doesn't return color::BRIGHT_BLACK
 // Returns terminal_color::NONE (invalid) if not found.
 inline terminal_color string_to_terminal_color(string str)
 {
-#define COLOR_DEF(x, y)               \
-  if (strings_match(str, string(#x))) \
-    return terminal_color::x;
-#include "terminal_colors.inl"
-#undef COLOR_DEF
-  return terminal_color::NONE;
+  auto *c = search(TERMINAL_COLORS_BY_NAME, str);
+  return c ? *c : terminal_color::NONE;
 }
 
 // Used when making ANSI escape codes for text styles
@@ -0,0 +1,428 @@
+#include "lstd/hash.h"
+
+#if ARCH == X86
+#if COMPILER == MSVC
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+#endif
+
+LSTD_USING_NAMESPACE;
+
+//
+// get_hash_long(), see the note in hash.h.
+//
+// The input is processed in 64 byte stripes. Each stripe is xor-ed with 64
+// bytes of the secret (shifted by 8 bytes for every stripe), and each of the
+// 8 lanes adds the 32x32->64 bit product of the halves of its keyed word and
+// the raw word of its neighbour. Every 16 stripes (a block) the lanes are
+// scrambled so the high bits flow back down. At the end the lanes are
+// multiplied together in pairs and mixed down to 64 bits.
+//
+
+static const s64 HASH_SECRET_CONSUME = 8;
+static const s64 HASH_STRIPES_PER_BLOCK = (HASH_SECRET_SIZE - HASH_STRIPE_LEN) / HASH_SECRET_CONSUME;
+static const s64 HASH_BLOCK_LEN = HASH_STRIPE_LEN * HASH_STRIPES_PER_BLOCK;
+
+static const u64 HASH_PRIME32_1 = 0x9E3779B1u;
+static const u64 HASH_PRIME32_2 = 0x85EBCA77u;
+static const u64 HASH_PRIME32_3 = 0xC2B2AE3Du;
+static const u64 HASH_PRIME64_1 = 0x9E3779B185EBCA87ull;
+static const u64 HASH_PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+static const u64 HASH_PRIME64_3 = 0x165667B19E3779F9ull;
+static const u64 HASH_PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+static const u64 HASH_PRIME64_5 = 0x27D4EB2F165667C5ull;
+
+static const u64 HASH_LONG_INIT[8] = {HASH_PRIME32_3, HASH_PRIME64_1, HASH_PRIME64_2, HASH_PRIME64_3,
+                                      HASH_PRIME64_4, HASH_PRIME32_2, HASH_PRIME64_5, HASH_PRIME32_1};
+
+// splitmix64 output, any random bytes will do
+struct hash_secret {
+  alignas(32) byte Bytes[HASH_SECRET_SIZE];
+};
+
+static constexpr hash_secret hash_make_secret() {
+  hash_secret result = {};
+  u64 x = HASH_PRIME64_1;
+  for (s64 i = 0; i < HASH_SECRET_SIZE; i += 8) {
+    u64 z = (x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    for (s64 j = 0; j < 8; ++j) result.Bytes[i + j] = (byte)(z >> (8 * j));
+  }
+  return result;
+}
+
+static constexpr hash_secret HASH_SECRET = hash_make_secret();
+
+// Seeded hashes use a secret derived from the seed
+static void hash_derive_secret(byte *secret, u64 seed) {
+  for (s64 i = 0; i < HASH_SECRET_SIZE; i += 16) {
+    u64 lo = hash_read64(HASH_SECRET.Bytes + i) + seed;
+    u64 hi = hash_read64(HASH_SECRET.Bytes + i + 8) - seed;
+    memcpy(secret + i, &lo, 8);
+    memcpy(secret + i + 8, &hi, 8);
+  }
+}
+
+static u64 hash_long_merge(const u64 *lanes, const byte *secret, s64 len) {
+  u64 result = (u64)len * HASH_PRIME64_1;
+  For(range(4)) {
+    result += hash_mix(lanes[2 * it] ^ hash_read64(secret + 11 + 16 * it),
+                       lanes[2 * it + 1] ^ hash_read64(secret + 11 + 16 * it + 8));
+  }
+  result ^= result >> 37;
+  result *= 0x165667919E3779F9ull;
+  return result ^ (result >> 32);
+}
+
+// Two lanes in plain integers, so all instruction sets share one loop
+struct scalar_hash_vec {
+  struct type {
+    u64 Lo, Hi;
+  };
+
+  static const s64 SIZE = 16;
+
+  static always_inline type loadu(const byte *p) {
+    return {hash_read64(p), hash_read64(p + 8)};
+  }
+  static always_inline void storeu(byte *p, type v) {
+    memcpy(p, &v.Lo, 8);
+    memcpy(p + 8, &v.Hi, 8);
+  }
+
+  static always_inline type accumulate(type acc, type data, type key) {
+    u64 lo = data.Lo ^ key.Lo, hi = data.Hi ^ key.Hi;
+    acc.Lo += data.Hi + (lo & 0xFFFFFFFF) * (lo >> 32);
+    acc.Hi += data.Lo + (hi & 0xFFFFFFFF) * (hi >> 32);
+    return acc;
+  }
+
+  static always_inline u64 scramble_lane(u64 acc, u64 key) {
+    acc ^= acc >> 47;
+    acc ^= key;
+    return acc * HASH_PRIME32_1;
+  }
+  static always_inline type scramble(type acc, type key) {
+    return {scramble_lane(acc.Lo, key.Lo), scramble_lane(acc.Hi, key.Hi)};
+  }
+
+  static always_inline void leave() {}
+};
+
+#define VEC scalar_hash_vec
+#define HASH_FUNC(name) name##_scalar
+#include "hash_functions.inl"
+#undef VEC
+#undef HASH_FUNC
+
+#if ARCH == X86
+struct sse2_hash_vec {
+  using type = __m128i;
+
+  static const s64 SIZE = 16;
+
+  static always_inline type loadu(const byte *p) {
+    return _mm_loadu_si128((const __m128i *)p);
+  }
+  static always_inline void storeu(byte *p, type v) {
+    _mm_storeu_si128((__m128i *)p, v);
+  }
+
+  static always_inline type accumulate(type acc, type data, type key) {
+    type keyed = _mm_xor_si128(data, key);
+    type keyedHi = _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1));
+    type product = _mm_mul_epu32(keyed, keyedHi);
+    type swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm_add_epi64(_mm_add_epi64(acc, swapped), product);
+  }
+
+  static always_inline type scramble(type acc, type key) {
+    type prime = _mm_set1_epi32((s32)HASH_PRIME32_1);
+    acc = _mm_xor_si128(_mm_xor_si128(acc, _mm_srli_epi64(acc, 47)), key);
+    type lo = _mm_mul_epu32(acc, prime);
+    type hi = _mm_mul_epu32(_mm_shuffle_epi32(acc, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+    return _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+  }
+
+  static always_inline void leave() {}
+};
+
+#define VEC sse2_hash_vec
+#define HASH_FUNC(name) name##_sse2
+#include "hash_functions.inl"
+#undef VEC
+#undef HASH_FUNC
+
+// Compiled for AVX2 like the lstd_mem* AVX2 versions, see memory.cpp
+#if COMPILER == GCC
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#elif COMPILER == CLANG
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#endif
+
+struct avx2_hash_vec {
+  using type = __m256i;
+
+  static const s64 SIZE = 32;
+
+  static always_inline type loadu(const byte *p) {
+    return _mm256_loadu_si256((const __m256i *)p);
+  }
+  static always_inline void storeu(byte *p, type v) {
+    _mm256_storeu_si256((__m256i *)p, v);
+  }
+
+  static always_inline type accumulate(type acc, type data, type key) {
+    type keyed = _mm256_xor_si256(data, key);
+    type keyedHi = _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1));
+    type product = _mm256_mul_epu32(keyed, keyedHi);
+    type swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm256_add_epi64(_mm256_add_epi64(acc, swapped), product);
+  }
+
+  static always_inline type scramble(type acc, type key) {
+    type prime = _mm256_set1_epi32((s32)HASH_PRIME32_1);
+    acc = _mm256_xor_si256(_mm256_xor_si256(acc, _mm256_srli_epi64(acc, 47)), key);
+    type lo = _mm256_mul_epu32(acc, prime);
+    type hi = _mm256_mul_epu32(_mm256_shuffle_epi32(acc, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+  }
+
+  // The compiler doesn't always clear the upper halves before tail calls
+  // (e.g. to hash_long_merge()), and SSE code running with them dirty pays
+  // for a transition on every instruction
+  static always_inline void leave() { _mm256_zeroupper(); }
+};
+
+#define VEC avx2_hash_vec
+#define HASH_FUNC(name) name##_avx2
+#include "hash_functions.inl"
+#undef VEC
+#undef HASH_FUNC
+
+#if COMPILER == GCC
+#pragma GCC pop_options
+#elif COMPILER == CLANG
+#pragma clang attribute pop
+#endif
+#endif
+
+// Null until the first call to get_hash_long() or hash_init().
+// :GlobalStateNoConstructors:
+static struct {
+  void (*Stripes)(u64 *, const byte *, s64, const byte *, s64 *);
+  u64 (*Finish)(u64 *, const byte *, const byte *, s64);
+  hash_functions_impl Impl;
+
+  // What get_hash_bytes_long() and hash_state run. Picked from the CPU when
+  // the functions are first set, only hash_bytes_set_use_long() changes it.
+  bool UseLong;
+} HashFunctions;
+
+LSTD_BEGIN_NAMESPACE
+
+hash_functions_impl hash_functions_set_impl(hash_functions_impl impl) {
+  auto best = hash_functions_impl::SCALAR;
+  switch (cpu_get_simd_level()) {
+    case cpu_simd_level::AVX2: best = hash_functions_impl::AVX2; break;
+    case cpu_simd_level::SSE2: best = hash_functions_impl::SSE2; break;
+    default: break;
+  }
+  if ((s32)impl > (s32)best) impl = best;
+
+  // Threads racing here all write the same values
+  if (!HashFunctions.Stripes) HashFunctions.UseLong = best == hash_functions_impl::AVX2;
+
+  switch (impl) {
+#if ARCH == X86
+    case hash_functions_impl::AVX2:
+      HashFunctions.Stripes = hash_long_stripes_avx2;
+      HashFunctions.Finish = hash_long_finish_avx2;
+      break;
+    case hash_functions_impl::SSE2:
+      HashFunctions.Stripes = hash_long_stripes_sse2;
+      HashFunctions.Finish = hash_long_finish_sse2;
+      break;
+#endif
+    default:
+      HashFunctions.Stripes = hash_long_stripes_scalar;
+      HashFunctions.Finish = hash_long_finish_scalar;
+      break;
+  }
+  HashFunctions.Impl = impl;
+  return impl;
+}
+
+hash_functions_impl hash_functions_get_impl() {
+  if (!HashFunctions.Stripes) {
+    hash_functions_set_impl(hash_functions_impl::AVX2);
+  }
+  return HashFunctions.Impl;
+}
+
+bool hash_bytes_get_use_long() {
+  if (!HashFunctions.Stripes) [[unlikely]] {
+    hash_functions_set_impl(hash_functions_impl::AVX2);
+  }
+  return HashFunctions.UseLong;
+}
+
+bool hash_bytes_set_use_long(bool useLong) {
+  bool old = hash_bytes_get_use_long();
+  HashFunctions.UseLong = useLong;
+  return old;
+}
+
+u64 get_hash_long(const byte *key, s64 len, u64 seed) {
+  assert(len > HASH_STRIPE_LEN);
+
+  if (!HashFunctions.Stripes) [[unlikely]] {
+    hash_functions_set_impl(hash_functions_impl::AVX2);
+  }
+
+  hash_secret seeded;
+  const byte *secret = HASH_SECRET.Bytes;
+  if (seed) {
+    hash_derive_secret(seeded.Bytes, seed);
+    secret = seeded.Bytes;
+  }
+
+  u64 lanes[8];
+  memcpy(lanes, HASH_LONG_INIT, sizeof(lanes));
+
+  // Every stripe except the last one, see hash_long_finish()
+  s64 stripeInBlock = 0;
+  HashFunctions.Stripes(lanes, key, (len - 1) / HASH_STRIPE_LEN, secret, &stripeInBlock);
+  return HashFunctions.Finish(lanes, key + len - HASH_STRIPE_LEN, secret, len);
+}
+
+u64 get_hash_bytes_long(const byte *key, s64 len, u64 seed) {
+  if (!HashFunctions.Stripes) [[unlikely]] {
+    hash_functions_set_impl(hash_functions_impl::AVX2);
+  }
+
+  if (HashFunctions.UseLong) return get_hash_long(key, len, seed);
+  return get_hash_rapid(key, len, seed);
+}
+
+void hash_init(hash_state ref state, u64 seed) {
+  if (!HashFunctions.Stripes) [[unlikely]] {
+    hash_functions_set_impl(hash_functions_impl::AVX2);
+  }
+
+  state.Seed = seed;
+  state.Count = 0;
+  state.Streaming = false;
+  state.Pending = 0;
+}
+
+// Size of the units the bulk loop of the hash we are streaming works on
+static s64 hash_state_unit(hash_state no_copy state) {
+  return state.Long ? HASH_STRIPE_LEN : HASH_RAPID_ROUND_LEN;
+}
+
+static void hash_state_process(hash_state no_copy state, u64 *lanes, s64 *stripeInBlock,
+                               const byte *units, s64 count) {
+  if (state.Long) {
+    HashFunctions.Stripes(lanes, units, count, state.Secret, stripeInBlock);
+  } else {
+    For(range(count)) hash_rapid_round(lanes, units + it * HASH_RAPID_ROUND_LEN);
+  }
+}
+
+// Runs the bulk loop on whole units of _data_ but always holds back at least
+// the last 1..unit bytes, because we don't know yet if they are the end of
+// the input. Small updates are collected until there's a whole block of
+// units, so the bulk loop doesn't run for every few bytes.
+static void hash_state_feed(hash_state ref state, const byte *data, s64 len) {
+  s64 unit = hash_state_unit(state);
+  s64 capacity = HASH_STATE_PENDING_SIZE / unit * unit;
+  byte *pending = state.Tail + HASH_STRIPE_LEN;
+
+  if (state.Pending + len <= capacity) {
+    memcpy(pending + state.Pending, data, len);
+    state.Pending += len;
+    return;
+  }
+
+  // The held back bytes are all followed by more now
+  if (state.Pending) {
+    s64 fill = capacity - state.Pending;
+    memcpy(pending + state.Pending, data, fill);
+    data += fill, len -= fill;
+
+    hash_state_process(state, state.Lanes, &state.StripeInBlock, pending, capacity / unit);
+    memcpy(pending - unit, pending + capacity - unit, unit);
+    state.Pending = 0;
+  }
+
+  s64 units = (len - 1) / unit;
+  if (units) {
+    hash_state_process(state, state.Lanes, &state.StripeInBlock, data, units);
+    memcpy(pending - unit, data + (units - 1) * unit, unit);
+    data += units * unit, len -= units * unit;
+  }
+
+  memcpy(pending, data, len);
+  state.Pending = len;
+}
+
+void hash_update(hash_state ref state, const byte *data, s64 len) {
+  if (len <= 0) return;
+
+  if (!state.Streaming) {
+    if (state.Count + len <= HASH_LONG_INPUT_THRESHOLD) {
+      memcpy(state.Buffer + state.Count, data, len);
+      state.Count += len;
+      return;
+    }
+
+    // Now we know get_hash_bytes() wouldn't use get_hash_rapid() on its own
+    state.Streaming = true;
+    state.Long = HashFunctions.UseLong;
+    if (state.Long) {
+      memcpy(state.Lanes, HASH_LONG_INIT, sizeof(state.Lanes));
+      state.StripeInBlock = 0;
+      if (state.Seed) {
+        hash_derive_secret(state.Secret, state.Seed);
+      } else {
+        memcpy(state.Secret, HASH_SECRET.Bytes, HASH_SECRET_SIZE);
+      }
+    } else {
+      u64 seed = hash_rapid_seed(state.Seed);
+      For(range(3)) state.Lanes[it] = seed;
+    }
+    hash_state_feed(state, state.Buffer, state.Count);
+  }
+
+  hash_state_feed(state, data, len);
+  state.Count += len;
+}
+
+u64 hash_finalize(hash_state no_copy state) {
+  if (!state.Streaming) return get_hash_bytes(state.Buffer, state.Count, state.Seed);
+
+  // Run the bulk loop on the held back bytes except the last 1..unit, on
+  // copies so the state can keep going
+  u64 lanes[8];
+  memcpy(lanes, state.Lanes, sizeof(lanes));
+  s64 stripeInBlock = state.StripeInBlock;
+
+  s64 unit = hash_state_unit(state);
+  s64 units = (state.Pending - 1) / unit;
+
+  const byte *pending = state.Tail + HASH_STRIPE_LEN;
+  hash_state_process(state, lanes, &stripeInBlock, pending, units);
+
+  const byte *last = pending + units * unit;
+  s64 lastCount = state.Pending - units * unit;
+  if (!state.Long) return hash_rapid_tail(lanes[0] ^ lanes[1] ^ lanes[2], last, lastCount, state.Count);
+  return HashFunctions.Finish(lanes, last + lastCount - HASH_STRIPE_LEN, state.Secret, state.Count);
+}
+
+LSTD_END_NAMESPACE
@@ -0,0 +1,77 @@
+// Included by hash.cpp once per instruction set. Expects:
+//   VEC             - a struct with the lane operations (see scalar_hash_vec),
+//                     VEC::leave() is called before returning to code
+//                     compiled for another instruction set
+//   HASH_FUNC(name) - appends the instruction set to _name_
+//
+// The 8 accumulator lanes (64 bytes) are kept in 64 / VEC::SIZE vectors.
+
+// Accumulates _count_ consecutive stripes, the secret moves by
+// HASH_SECRET_CONSUME bytes for every stripe. One call handles a whole
+// block, so the lanes stay in registers.
+static void HASH_FUNC(accumulate)(typename VEC::type *acc, const byte *stripes, s64 count,
+                                  const byte *secret) {
+  const s64 N = HASH_STRIPE_LEN / VEC::SIZE;
+
+  typename VEC::type lanes[N];
+  For(range(N)) lanes[it] = acc[it];
+
+  For_as(s, range(count)) {
+    const byte *stripe = stripes + s * HASH_STRIPE_LEN;
+    const byte *key = secret + s * HASH_SECRET_CONSUME;
+    For(range(N)) {
+      lanes[it] = VEC::accumulate(lanes[it], VEC::loadu(stripe + it * VEC::SIZE),
+                                  VEC::loadu(key + it * VEC::SIZE));
+    }
+  }
+
+  For(range(N)) acc[it] = lanes[it];
+}
+
+static void HASH_FUNC(scramble)(typename VEC::type *acc, const byte *secret) {
+  For(range(HASH_STRIPE_LEN / VEC::SIZE)) {
+    acc[it] = VEC::scramble(acc[it], VEC::loadu(secret + it * VEC::SIZE));
+  }
+}
+
+// Accumulates _count_ stripes into _lanes_ and scrambles them at the end of
+// every block. _stripeInBlock_ is where in its block the first stripe is.
+static void HASH_FUNC(hash_long_stripes)(u64 *lanes, const byte *stripes, s64 count,
+                                         const byte *secret, s64 *stripeInBlock) {
+  const s64 N = HASH_STRIPE_LEN / VEC::SIZE;
+
+  typename VEC::type acc[N];
+  For(range(N)) acc[it] = VEC::loadu((const byte *)lanes + it * VEC::SIZE);
+
+  while (count) {
+    s64 n = min(count, HASH_STRIPES_PER_BLOCK - *stripeInBlock);
+    HASH_FUNC(accumulate)(acc, stripes, n, secret + *stripeInBlock * HASH_SECRET_CONSUME);
+    stripes += n * HASH_STRIPE_LEN;
+    count -= n;
+
+    *stripeInBlock += n;
+    if (*stripeInBlock == HASH_STRIPES_PER_BLOCK) {
+      HASH_FUNC(scramble)(acc, secret + HASH_SECRET_SIZE - HASH_STRIPE_LEN);
+      *stripeInBlock = 0;
+    }
+  }
+
+  For(range(N)) VEC::storeu((byte *)lanes + it * VEC::SIZE, acc[it]);
+  VEC::leave();
+}
+
+// Accumulates the last stripe of the input (which may overlap with the
+// stripes before it) with a different part of the secret and mixes the
+// lanes down to the result
+static u64 HASH_FUNC(hash_long_finish)(u64 *lanes, const byte *lastStripe, const byte *secret,
+                                       s64 len) {
+  const s64 N = HASH_STRIPE_LEN / VEC::SIZE;
+
+  typename VEC::type acc[N];
+  For(range(N)) acc[it] = VEC::loadu((const byte *)lanes + it * VEC::SIZE);
+  HASH_FUNC(accumulate)(acc, lastStripe, 1, secret + HASH_SECRET_SIZE - HASH_STRIPE_LEN - 7);
+  For(range(N)) VEC::storeu((byte *)lanes + it * VEC::SIZE, acc[it]);
+  VEC::leave();
+
+  return hash_long_merge(lanes, secret, len);
+}
@@ -1,5 +1,7 @@
 #include "context.cpp"
 #include "memory.cpp"
+#include "memory_profiler.cpp"
+#include "hash.cpp"
 
 #include "platform/memory.cpp"
 
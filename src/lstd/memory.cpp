@@ -2,52 +2,187 @@
 
 #include "lstd/atomic.h"
 #include "lstd/fmt.h"
+#include "lstd/memory_profiler.h"
 #include "lstd/os.h"
 
+#if ARCH == X86
+#if COMPILER == MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#endif
+
 LSTD_USING_NAMESPACE;
 
-extern "C" {
-#if defined LSTD_NO_CRT
-int memcmp(void const *_Buf1, void const *_Buf2, size_t _Size) {
-  auto *p1 = (byte *)_Buf1;
-  auto *p2 = (byte *)_Buf2;
-  For(range(_Size)) {
-    if (p1[it] != p2[it]) return p1[it] - p2[it];
+//
+// Memory functions (lstd_memcpy, lstd_memmove, lstd_memset, lstd_memcmp).
+// See the note in memory.h.
+//
+
+#if COMPILER == MSVC
+using unaligned_u64 = u64;
+using unaligned_u32 = u32;
+using unaligned_u16 = u16;
+#else
+typedef u64 unaligned_u64 __attribute__((aligned(1), may_alias));
+typedef u32 unaligned_u32 __attribute__((aligned(1), may_alias));
+typedef u16 unaligned_u16 __attribute__((aligned(1), may_alias));
+#endif
+
+template <typename T>
+static always_inline T load_unaligned(const byte *p) {
+  if constexpr (sizeof(T) == 8) return *(const unaligned_u64 *)p;
+  if constexpr (sizeof(T) == 4) return *(const unaligned_u32 *)p;
+  if constexpr (sizeof(T) == 2) return *(const unaligned_u16 *)p;
+}
+
+template <typename T>
+static always_inline void store_unaligned(byte *p, T v) {
+  if constexpr (sizeof(T) == 8) *(unaligned_u64 *)p = v;
+  if constexpr (sizeof(T) == 4) *(unaligned_u32 *)p = v;
+  if constexpr (sizeof(T) == 2) *(unaligned_u16 *)p = v;
+}
+
+//
+// Small sizes are done with two (or four) overlapping loads and stores. We
+// load everything before storing, so these work for overlapping buffers too.
+//
+
+static always_inline void copy_up_to_16(byte *dst, const byte *src, s64 size) {
+  if (size >= 8) {
+    u64 a = load_unaligned<u64>(src), b = load_unaligned<u64>(src + size - 8);
+    store_unaligned(dst, a);
+    store_unaligned(dst + size - 8, b);
+  } else if (size >= 4) {
+    u32 a = load_unaligned<u32>(src), b = load_unaligned<u32>(src + size - 4);
+    store_unaligned(dst, a);
+    store_unaligned(dst + size - 4, b);
+  } else if (size >= 2) {
+    u16 a = load_unaligned<u16>(src), b = load_unaligned<u16>(src + size - 2);
+    store_unaligned(dst, a);
+    store_unaligned(dst + size - 2, b);
+  } else if (size == 1) {
+    *dst = *src;
+  }
+}
+
+// 16 <= _size_ <= 32
+static always_inline void copy_16_to_32(byte *dst, const byte *src, s64 size) {
+  u64 a = load_unaligned<u64>(src), b = load_unaligned<u64>(src + 8);
+  u64 c = load_unaligned<u64>(src + size - 16);
+  u64 d = load_unaligned<u64>(src + size - 8);
+  store_unaligned(dst, a);
+  store_unaligned(dst + 8, b);
+  store_unaligned(dst + size - 16, c);
+  store_unaligned(dst + size - 8, d);
+}
+
+static always_inline void set_up_to_16(byte *dst, byte value, s64 size) {
+  u64 v = value * 0x0101010101010101ull;
+  if (size >= 8) {
+    store_unaligned(dst, v);
+    store_unaligned(dst + size - 8, v);
+  } else if (size >= 4) {
+    store_unaligned(dst, (u32)v);
+    store_unaligned(dst + size - 4, (u32)v);
+  } else if (size >= 2) {
+    store_unaligned(dst, (u16)v);
+    store_unaligned(dst + size - 2, (u16)v);
+  } else if (size == 1) {
+    *dst = value;
+  }
+}
+
+// 16 <= _size_ <= 32
+static always_inline void set_16_to_32(byte *dst, byte value, s64 size) {
+  u64 v = value * 0x0101010101010101ull;
+  store_unaligned(dst, v);
+  store_unaligned(dst + 8, v);
+  store_unaligned(dst + size - 16, v);
+  store_unaligned(dst + size - 8, v);
+}
+
+static always_inline int compare_words(const byte *a, const byte *b) {
+  if (load_unaligned<u64>(a) == load_unaligned<u64>(b)) return 0;
+  For(range(8)) {
+    if (a[it] != b[it]) return a[it] - b[it];
   }
   return 0;
 }
 
-void *__cdecl memcpy(void *_Dst, void const *_Src, size_t _Size) {
-  if ((u64)_Dst > (u64)_Src && (s64)((byte *)_Dst - (byte *)_Src) < (s64)_Size)
-      [[unlikely]] {
-    //
-    // Careful. Buffers overlap. You should use memmove in this case.
-    //
-    // If this bug isn't caught until Release, then bad stuff happens.
-    // So in order to make it work nevertheless we do memmove.
-    // I wish the C standard didn't make a distinction between the
-    // two functions, but we're stuck with that.
-    //
-    // This makes calling memmove superfluous, and personally,
-    // I'm ok with that.
-    return memmove(_Dst, _Src, _Size);
-  } else {
-    auto *dst = (byte *)_Dst;
-    auto *src = (byte *)_Src;
-    while (_Size--) *dst++ = *src++;
+static always_inline int compare_up_to_16(const byte *a, const byte *b,
+                                          s64 size) {
+  if (size >= 8) {
+    int r = compare_words(a, b);
+    return r ? r : compare_words(a + size - 8, b + size - 8);
   }
-  return _Dst;
+  For(range(size)) {
+    if (a[it] != b[it]) return a[it] - b[it];
+  }
+  return 0;
 }
 
-void *memmove(void *_Dst, void const *_Src, size_t _Size) {
-  auto *dst = (byte *)_Dst;
-  auto *src = (byte *)_Src;
-  if (_Size == 0) return _Dst;
-  For(range(_Size - 1, -1, -1)) dst[it] = src[it];
-  return dst;
+// 16 <= _size_ <= 32
+static always_inline int compare_16_to_32(const byte *a, const byte *b,
+                                          s64 size) {
+  int r = compare_words(a, b);
+  if (!r) r = compare_words(a + 8, b + 8);
+  if (!r) r = compare_words(a + size - 16, b + size - 16);
+  if (!r) r = compare_words(a + size - 8, b + size - 8);
+  return r;
 }
 
-void *memset(void *_Dst, int _Val, size_t _Size) {
+//
+// Portable versions, used when we don't have vector instructions.
+// These go a word at a time.
+//
+
+// Keeps the optimizer from turning the loops below back into calls to
+// memcpy/memset, which with LSTD_NO_CRT are these very functions.
+#if COMPILER == CLANG
+#define NO_LOOP_IDIOMS __attribute__((no_builtin))
+#elif COMPILER == GCC
+#define NO_LOOP_IDIOMS \
+  __attribute__((optimize("no-tree-loop-distribute-patterns")))
+#else
+#define NO_LOOP_IDIOMS
+#endif
+
+NO_LOOP_IDIOMS static void *memmove_scalar(void *dstp, const void *srcp, size_t n) {
+  auto *dst = (byte *)dstp;
+  auto *src = (const byte *)srcp;
+  s64 size = (s64)n;
+
+  if (size <= 16) {
+    copy_up_to_16(dst, src, size);
+    return dstp;
+  }
+  if (size <= 32) {
+    copy_16_to_32(dst, src, size);
+    return dstp;
+  }
+
+  // Each word is loaded before it's stored, so going in the right direction
+  // is enough to handle overlapping buffers
+  if ((u64)(dst - src) >= (u64)size) {
+    s64 i = 0;
+    for (; i + 8 <= size; i += 8) {
+      store_unaligned(dst + i, load_unaligned<u64>(src + i));
+    }
+    for (; i < size; ++i) dst[i] = src[i];
+  } else {
+    s64 i = size;
+    for (; i >= 8; i -= 8) {
+      store_unaligned(dst + i - 8, load_unaligned<u64>(src + i - 8));
+    }
+    for (; i > 0; --i) dst[i - 1] = src[i - 1];
+  }
+  return dstp;
+}
+
+NO_LOOP_IDIOMS static void *memset_scalar(void *_Dst, int _Val, size_t _Size) {
   u64 dstp = (u64)_Dst;
 
   if (_Size >= 8) {
@@ -100,6 +235,265 @@ void *memset(void *_Dst, int _Val, size_t _Size) {
 
   return _Dst;
 }
+
+NO_LOOP_IDIOMS static int memcmp_scalar(const void *ap, const void *bp, size_t n) {
+  auto *a = (const byte *)ap;
+  auto *b = (const byte *)bp;
+  s64 size = (s64)n;
+
+  if (size < 16) return compare_up_to_16(a, b, size);
+
+  s64 i = 0;
+  for (; i + 8 <= size; i += 8) {
+    int r = compare_words(a + i, b + i);
+    if (r) return r;
+  }
+  return i < size ? compare_words(a + size - 8, b + size - 8) : 0;
+}
+
+#if ARCH == X86
+struct sse2_vec {
+  using type = __m128i;
+
+  static const s64 SIZE = 16;
+  static const u32 ALL_EQUAL = 0xFFFF;
+
+  static always_inline type loadu(const byte *p) {
+    return _mm_loadu_si128((const __m128i *)p);
+  }
+  static always_inline void storeu(byte *p, type v) {
+    _mm_storeu_si128((__m128i *)p, v);
+  }
+  static always_inline void store(byte *p, type v) {
+    _mm_store_si128((__m128i *)p, v);
+  }
+  static always_inline void stream(byte *p, type v) {
+    _mm_stream_si128((__m128i *)p, v);
+  }
+  static always_inline void fence() { _mm_sfence(); }
+
+  static always_inline type broadcast(byte b) { return _mm_set1_epi8((char)b); }
+
+  static always_inline type equal(type a, type b) { return _mm_cmpeq_epi8(a, b); }
+  static always_inline type and_(type a, type b) { return _mm_and_si128(a, b); }
+  static always_inline u32 mask(type v) { return (u32)_mm_movemask_epi8(v); }
+  static always_inline u32 equal_mask(type a, type b) { return mask(equal(a, b)); }
+};
+
+#define VEC sse2_vec
+#define MEMORY_FUNC(name) name##_sse2
+#include "memory_functions.inl"
+#undef VEC
+#undef MEMORY_FUNC
+
+// The AVX2 versions are compiled for AVX2 even though the rest of the
+// library isn't, we only call them if the CPU supports it.
+#if COMPILER == GCC
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#elif COMPILER == CLANG
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#endif
+
+struct avx2_vec {
+  using type = __m256i;
+
+  static const s64 SIZE = 32;
+  static const u32 ALL_EQUAL = 0xFFFFFFFF;
+
+  static always_inline type loadu(const byte *p) {
+    return _mm256_loadu_si256((const __m256i *)p);
+  }
+  static always_inline void storeu(byte *p, type v) {
+    _mm256_storeu_si256((__m256i *)p, v);
+  }
+  static always_inline void store(byte *p, type v) {
+    _mm256_store_si256((__m256i *)p, v);
+  }
+  static always_inline void stream(byte *p, type v) {
+    _mm256_stream_si256((__m256i *)p, v);
+  }
+  static always_inline void fence() { _mm_sfence(); }
+
+  static always_inline type broadcast(byte b) {
+    return _mm256_set1_epi8((char)b);
+  }
+
+  static always_inline type equal(type a, type b) {
+    return _mm256_cmpeq_epi8(a, b);
+  }
+  static always_inline type and_(type a, type b) {
+    return _mm256_and_si256(a, b);
+  }
+  static always_inline u32 mask(type v) { return (u32)_mm256_movemask_epi8(v); }
+  static always_inline u32 equal_mask(type a, type b) { return mask(equal(a, b)); }
+};
+
+#define VEC avx2_vec
+#define MEMORY_FUNC(name) name##_avx2
+#include "memory_functions.inl"
+#undef VEC
+#undef MEMORY_FUNC
+
+#if COMPILER == GCC
+#pragma GCC pop_options
+#elif COMPILER == CLANG
+#pragma clang attribute pop
+#endif
+
+static void cpuid(u32 leaf, u32 subleaf, u32 *regs) {
+#if COMPILER == MSVC
+  __cpuidex((int *)regs, (int)leaf, (int)subleaf);
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+LSTD_BEGIN_NAMESPACE
+
+cpu_simd_level cpu_get_simd_level() {
+  u32 regs[4];
+
+  cpuid(0, 0, regs);
+  u32 maxLeaf = regs[0];
+
+  cpuid(1, 0, regs);
+  bool sse2 = regs[3] & (1 << 26);
+  bool osxsave = regs[2] & (1 << 27);
+  bool avx = regs[2] & (1 << 28);
+
+  bool avx2 = false;
+  if (maxLeaf >= 7 && osxsave && avx) {
+    cpuid(7, 0, regs);
+    avx2 = regs[1] & (1 << 5);
+
+    // The OS must save the YMM registers on context switches
+#if COMPILER == MSVC
+    u64 xcr0 = _xgetbv(0);
+#else
+    u32 lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    u64 xcr0 = ((u64)hi << 32) | lo;
+#endif
+    if ((xcr0 & 6) != 6) avx2 = false;
+  }
+
+  if (avx2) return cpu_simd_level::AVX2;
+  if (sse2) return cpu_simd_level::SSE2;
+  return cpu_simd_level::NONE;
+}
+
+LSTD_END_NAMESPACE
+#else
+LSTD_BEGIN_NAMESPACE
+cpu_simd_level cpu_get_simd_level() { return cpu_simd_level::NONE; }
+LSTD_END_NAMESPACE
+#endif
+
+// Null until the first call to one of the functions.
+// :GlobalStateNoConstructors:
+static struct {
+  void *(*Move)(void *, const void *, size_t);
+  void *(*Set)(void *, int, size_t);
+  int (*Compare)(const void *, const void *, size_t);
+  memory_functions_impl Impl;
+} MemoryFunctions;
+
+LSTD_BEGIN_NAMESPACE
+
+memory_functions_impl memory_functions_set_impl(memory_functions_impl impl) {
+  auto best = memory_functions_impl::SCALAR;
+  switch (cpu_get_simd_level()) {
+    case cpu_simd_level::AVX2: best = memory_functions_impl::AVX2; break;
+    case cpu_simd_level::SSE2: best = memory_functions_impl::SSE2; break;
+    default: break;
+  }
+  if ((s32)impl > (s32)best) impl = best;
+
+  // Threads racing here all write the same values
+  switch (impl) {
+#if ARCH == X86
+    case memory_functions_impl::AVX2:
+      MemoryFunctions.Move = memmove_avx2;
+      MemoryFunctions.Set = memset_avx2;
+      MemoryFunctions.Compare = memcmp_avx2;
+      break;
+    case memory_functions_impl::SSE2:
+      MemoryFunctions.Move = memmove_sse2;
+      MemoryFunctions.Set = memset_sse2;
+      MemoryFunctions.Compare = memcmp_sse2;
+      break;
+#endif
+    default:
+      MemoryFunctions.Move = memmove_scalar;
+      MemoryFunctions.Set = memset_scalar;
+      MemoryFunctions.Compare = memcmp_scalar;
+      break;
+  }
+  MemoryFunctions.Impl = impl;
+  return impl;
+}
+
+memory_functions_impl memory_functions_get_impl() {
+  if (!MemoryFunctions.Move) {
+    memory_functions_set_impl(memory_functions_impl::AVX2);
+  }
+  return MemoryFunctions.Impl;
+}
+
+LSTD_END_NAMESPACE
+
+extern "C" {
+void *lstd_memmove(void *_Dst, void const *_Src, size_t _Size) {
+  if (!MemoryFunctions.Move) [[unlikely]] {
+    memory_functions_set_impl(memory_functions_impl::AVX2);
+  }
+  return MemoryFunctions.Move(_Dst, _Src, _Size);
+}
+
+void *lstd_memcpy(void *_Dst, void const *_Src, size_t _Size) {
+  //
+  // Careful. Buffers might overlap. You should use memmove in this case.
+  //
+  // If this bug isn't caught until Release, then bad stuff happens.
+  // So in order to make it work nevertheless we do memmove (which costs a
+  // single compare, since it has to pick a direction anyway).
+  // I wish the C standard didn't make a distinction between the
+  // two functions, but we're stuck with that.
+  //
+  return lstd_memmove(_Dst, _Src, _Size);
+}
+
+void *lstd_memset(void *_Dst, int _Val, size_t _Size) {
+  if (!MemoryFunctions.Set) [[unlikely]] {
+    memory_functions_set_impl(memory_functions_impl::AVX2);
+  }
+  return MemoryFunctions.Set(_Dst, _Val, _Size);
+}
+
+int lstd_memcmp(void const *_Buf1, void const *_Buf2, size_t _Size) {
+  if (!MemoryFunctions.Compare) [[unlikely]] {
+    memory_functions_set_impl(memory_functions_impl::AVX2);
+  }
+  return MemoryFunctions.Compare(_Buf1, _Buf2, _Size);
+}
+
+#if defined LSTD_NO_CRT
+int memcmp(void const *_Buf1, void const *_Buf2, size_t _Size) {
+  return lstd_memcmp(_Buf1, _Buf2, _Size);
+}
+
+void *__cdecl memcpy(void *_Dst, void const *_Src, size_t _Size) {
+  return lstd_memcpy(_Dst, _Src, _Size);
+}
+
+void *memmove(void *_Dst, void const *_Src, size_t _Size) {
+  return lstd_memmove(_Dst, _Src, _Size);
+}
+
+void *memset(void *_Dst, int _Val, size_t _Size) {
+  return lstd_memset(_Dst, _Val, _Size);
+}
 #endif
 
 void *memset0(void *_Dst, size_t _Size) {
@@ -140,16 +534,55 @@ string get_short_file_name(string str) {
 }
 
 #if defined DEBUG_MEMORY
+//
+// Live allocations are kept in a treap (a binary search tree ordered by the
+// header address, balanced by random node priorities) so we can find a block
+// in O(log n). The same nodes are also linked in a sorted list (see
+// DebugMemoryHead) for iterating in order and for looking at neighbours when
+// checking for overlapping blocks.
+//
+// Freed nodes are moved to a second treap, see comment above
+// debug_memory_node::Freed.
+//
+static thread_local debug_memory_node *DebugMemoryLiveRoot;
+static thread_local debug_memory_node *DebugMemoryFreedRoot;
+
+// Where the next slice of incremental heap verification starts,
+// see debug_memory_maybe_verify_heap().
+static thread_local debug_memory_node *DebugMemoryVerifyCursor;
+
+// xorshift64 state for node priorities. Deterministic so runs are reproducible.
+static thread_local u64 DebugMemoryPrioritySeed = 0x9E3779B97F4A7C15ull;
+
 debug_memory_node *new_node(allocation_header *header) {
   auto *node = (debug_memory_node *)pool_allocator(
       allocator_mode::ALLOCATE, &DebugMemoryNodesPool,
       sizeof(debug_memory_node), null, 0, 0);
+  if (!node) {
+    // Grow the pool
+    s64 poolSize = 5000 * sizeof(debug_memory_node) +
+                   sizeof(pool_allocator_data::block);
+
+    void *pool = os_allocate_block(poolSize);
+    pool_allocator_provide_block(&DebugMemoryNodesPool, pool, poolSize);
+
+    node = (debug_memory_node *)pool_allocator(
+        allocator_mode::ALLOCATE, &DebugMemoryNodesPool,
+        sizeof(debug_memory_node), null, 0, 0);
+  }
   assert(node);
 
   memset0((byte *)node, sizeof(debug_memory_node));
 
   node->Header = header;
 
+  u64 x = DebugMemoryPrioritySeed;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  DebugMemoryPrioritySeed = x;
+  node->Priority = x;
+
   // Leave invalid for now, filled out later
   node->ID = (u64)-1;
 
@@ -174,6 +607,10 @@ void debug_memory_init() {
   sentinel2->Prev = sentinel1;
   DebugMemoryHead = sentinel1;
   DebugMemoryTail = sentinel2;
+
+  DebugMemoryLiveRoot = null;
+  DebugMemoryFreedRoot = null;
+  DebugMemoryVerifyCursor = null;
 }
 
 void debug_memory_uninit() {
@@ -187,36 +624,132 @@ void debug_memory_uninit() {
     os_free_block(b);
     b = next;
   }
+
+  DebugMemoryLiveRoot = null;
+  DebugMemoryFreedRoot = null;
+  DebugMemoryVerifyCursor = null;
+}
+
+// Splits _t_ into nodes with headers < _header_ (in _l_) and the rest (in _r_)
+static void tree_split(debug_memory_node *t, allocation_header *header,
+                       debug_memory_node **l, debug_memory_node **r) {
+  if (!t) {
+    *l = *r = null;
+  } else if (t->Header < header) {
+    tree_split(t->Right, header, &t->Right, r);
+    *l = t;
+  } else {
+    tree_split(t->Left, header, l, &t->Left);
+    *r = t;
+  }
+}
+
+// Every header in _l_ must be smaller than every header in _r_
+static debug_memory_node *tree_merge(debug_memory_node *l,
+                                     debug_memory_node *r) {
+  if (!l) return r;
+  if (!r) return l;
+
+  if (l->Priority > r->Priority) {
+    l->Right = tree_merge(l->Right, r);
+    return l;
+  }
+  r->Left = tree_merge(l, r->Left);
+  return r;
+}
+
+static void tree_insert(debug_memory_node **root, debug_memory_node *node) {
+  node->Left = node->Right = null;
+
+  debug_memory_node *l, *r;
+  tree_split(*root, node->Header, &l, &r);
+  *root = tree_merge(tree_merge(l, node), r);
+}
+
+static void tree_remove(debug_memory_node **root, allocation_header *header) {
+  auto **t = root;
+  while (*t && (*t)->Header != header) {
+    t = header < (*t)->Header ? &(*t)->Left : &(*t)->Right;
+  }
+  if (*t) *t = tree_merge((*t)->Left, (*t)->Right);
 }
 
+// Returns the first node with a header >= _header_, null if there is none
+static debug_memory_node *tree_lower_bound(debug_memory_node *t,
+                                           allocation_header *header) {
+  debug_memory_node *result = null;
+  while (t) {
+    if (t->Header < header) {
+      t = t->Right;
+    } else {
+      result = t;
+      t = t->Left;
+    }
+  }
+  return result;
+}
+
+// Returns the first live node with a header >= _header_ (or the tail sentinel)
 static auto *list_search(allocation_header *header) {
-  debug_memory_node *t = DebugMemoryHead;
-  while (t != DebugMemoryTail && t->Header < header) t = t->Next;
-  return t;
+  auto *n = tree_lower_bound(DebugMemoryLiveRoot, header);
+  return n ? n : DebugMemoryTail;
 }
 
-static debug_memory_node *list_add(allocation_header *header) {
-  auto *n = list_search(header);
-  assert(n->Header != header);
+// Returns the freed node with exactly _header_, null if there is none
+static debug_memory_node *freed_search(allocation_header *header) {
+  auto *n = tree_lower_bound(DebugMemoryFreedRoot, header);
+  return n && n->Header == header ? n : null;
+}
 
-  auto *node = new_node(header);
+static void list_add(debug_memory_node *node) {
+  auto *n = list_search(node->Header);
+  assert(n->Header != node->Header);
 
   node->Next = n;
   node->Prev = n->Prev;
   n->Prev->Next = node;
   n->Prev = node;
 
+  tree_insert(&DebugMemoryLiveRoot, node);
+}
+
+static void list_remove(debug_memory_node *node) {
+  if (DebugMemoryVerifyCursor == node) DebugMemoryVerifyCursor = node->Next;
+
+  node->Prev->Next = node->Next;
+  node->Next->Prev = node->Prev;
+
+  tree_remove(&DebugMemoryLiveRoot, node->Header);
+}
+
+// Returns a node for a new live block at _header_. If a block at the same
+// address was freed before (the allocator handed the memory out again) we
+// reuse its node.
+static debug_memory_node *debug_memory_add_live(allocation_header *header) {
+  auto *node = freed_search(header);
+  if (node) {
+    tree_remove(&DebugMemoryFreedRoot, header);
+  } else {
+    node = new_node(header);
+  }
+
+  node->Freed = false;
+  node->FreedAt = {};
+
+  list_add(node);
   return node;
 }
 
-static debug_memory_node *list_remove(allocation_header *header) {
-  auto *n = list_search(header);
-  if (n->Header != header) return null;
+// Moves _node_ from the live allocations to the freed ones
+static void debug_memory_mark_freed(debug_memory_node *node,
+                                    source_location loc) {
+  list_remove(node);
 
-  n->Prev->Next = n->Next;
-  n->Next->Prev = n->Prev;
+  node->Freed = true;
+  node->FreedAt = loc;
 
-  return n;
+  assert(!freed_search(node->Header));
+  tree_insert(&DebugMemoryFreedRoot, node);
 }
 
 bool debug_memory_list_contains(allocation_header *header) {
@@ -231,7 +764,7 @@ void debug_memory_report_leaks() {
   // @Cleanup: Factor this into a macro
   auto *it = DebugMemoryHead->Next;
   while (it != DebugMemoryTail) {
-    if (!it->Freed && !it->MarkedAsLeak) ++leaksCount;
+    if (!it->MarkedAsLeak) ++leaksCount;
     it = it->Next;
   }
 
@@ -247,7 +780,7 @@ void debug_memory_report_leaks() {
 
   it = DebugMemoryHead->Next;
   while (it != DebugMemoryTail) {
-    if (!it->Freed && !it->MarkedAsLeak) *p++ = it;
+    if (!it->MarkedAsLeak) *p++ = it;
     it = it->Next;
   }
 
@@ -341,7 +874,19 @@ void debug_memory_verify_heap() {
 
 void debug_memory_maybe_verify_heap() {
   if (AllocationCount % Context.DebugMemoryHeapVerifyFrequency) return;
-  debug_memory_verify_heap();
+
+  // Verify the next slice of live blocks, wrapping around at the end of the
+  // list, so the cost doesn't grow with the number of allocations.
+  auto *node = DebugMemoryVerifyCursor;
+  For(range(DEBUG_MEMORY_HEAP_VERIFY_SLICE)) {
+    if (!node || node == DebugMemoryTail) {
+      node = DebugMemoryHead->Next;
+      if (node == DebugMemoryTail) break;
+    }
+    verify_node_integrity(node);
+    node = node->Next;
+  }
+  DebugMemoryVerifyCursor = node;
 }
 
 void check_for_overlapping_blocks(debug_memory_node *node) {
@@ -350,12 +895,11 @@ void check_for_overlapping_blocks(debug_memory_node *node) {
   // of individual allocated blocks and we have info about their size.
   // This might catch bugs in the allocator implementation/two allocators using
   // the same pool.
+  //
+  // Only live blocks are in the list so we just look at the neighbours.
 
   auto *left = node->Prev;
-  while (left->Freed) left = left->Prev;
-
   auto *right = node->Next;
-  while (right->Freed) right = right->Next;
 
   if (left != DebugMemoryHead) {
     // Check below
@@ -390,6 +934,197 @@ void check_for_overlapping_blocks(debug_memory_node *node) {
 }
 #endif
 
+//
+// :AllocatorRegistry:
+//
+// Plain pointers so these are zero-initialized before any constructors run
+// (allocations may happen in global constructors).
+// See :GlobalStateNoConstructors:
+//
+static allocator_func_t AllocatorRegistryFunctions[ALLOCATOR_REGISTRY_SIZE];
+static void *AllocatorRegistryContexts[ALLOCATOR_REGISTRY_SIZE];
+static s32 AllocatorRegistryCount;
+static s32 AllocatorRegistryLock;
+
+// Small direct-mapped per-thread cache so we don't scan the registry on every
+// allocation.
+struct allocator_registry_cache_entry {
+  allocator_func_t Function;
+  void *Context;
+  s32 Index;
+};
+static thread_local allocator_registry_cache_entry AllocatorRegistryCache[8];
+
+static s32 allocator_registry_find(allocator alloc, s32 count) {
+  For(range(count)) {
+    if (AllocatorRegistryFunctions[it] == alloc.Function &&
+        AllocatorRegistryContexts[it] == alloc.Context) {
+      return (s32)it;
+    }
+  }
+  return -1;
+}
+
+s32 allocator_registry_index(allocator alloc) {
+  u64 slot = (((u64)alloc.Context ^ (u64)alloc.Function) >> 4) & 7;
+
+  // The slot might have been removed (and reused) since we cached it
+  auto *cached = &AllocatorRegistryCache[slot];
+  if (cached->Function == alloc.Function && cached->Context == alloc.Context &&
+      AllocatorRegistryFunctions[cached->Index] == alloc.Function &&
+      AllocatorRegistryContexts[cached->Index] == alloc.Context) {
+    return cached->Index;
+  }
+
+  s32 index = allocator_registry_find(
+      alloc, atomic_compare_and_swap(&AllocatorRegistryCount, 0, 0));
+  if (index == -1) {
+    while (atomic_swap(&AllocatorRegistryLock, 1)) {
+    }
+
+    // Someone might have registered it in the meantime
+    s32 count = AllocatorRegistryCount;
+    index = allocator_registry_find(alloc, count);
+
+    // Reuse a removed slot before growing
+    For(range(count)) {
+      if (index != -1) break;
+      if (!AllocatorRegistryFunctions[it]) {
+        AllocatorRegistryContexts[it] = alloc.Context;
+        atomic_swap(&AllocatorRegistryFunctions[it], alloc.Function);
+        index = (s32)it;
+      }
+    }
+
+    if (index == -1 && count < ALLOCATOR_REGISTRY_SIZE) {
+      AllocatorRegistryFunctions[count] = alloc.Function;
+      AllocatorRegistryContexts[count] = alloc.Context;
+
+      // Publish after the entry has been written
+      atomic_swap(&AllocatorRegistryCount, count + 1);
+      index = count;
+    }
+
+    atomic_swap(&AllocatorRegistryLock, 0);
+  }
+
+  if (index != -1) *cached = {alloc.Function, alloc.Context, index};
+  return index;
+}
+
+void allocator_registry_remove(void *context) {
+  if (!context) return;
+
+  while (atomic_swap(&AllocatorRegistryLock, 1)) {
+  }
+
+  For(range(AllocatorRegistryCount)) {
+    if (AllocatorRegistryContexts[it] != context) continue;
+
+    // Clear the function first, that marks the slot as free
+    atomic_swap(&AllocatorRegistryFunctions[it], (allocator_func_t)null);
+    AllocatorRegistryContexts[it] = null;
+  }
+
+  atomic_swap(&AllocatorRegistryLock, 0);
+}
+
+allocator allocator_registry_get(s32 index) {
+  assert(index >= 0 && index < AllocatorRegistryCount);
+  return allocator(AllocatorRegistryFunctions[index],
+                   AllocatorRegistryContexts[index]);
+}
+
+// How many bytes we need to store _size_ in a compact header, 0 if it doesn't
+// fit. See :CompactHeader:
+static s64 compact_header_size_bytes(s64 size) {
+  if (size < (1ll << 8)) return 1;
+  if (size < (1ll << 16)) return 2;
+  if (size < (1ll << 24)) return 3;
+  if (size < (1ll << 32)) return 4;
+  return 0;
+}
+
+static void encode_compact_size(void *p, s64 size, s64 sizeBytes) {
+  auto *s = (byte *)p - 2 - sizeBytes;
+  For(range(sizeBytes)) s[it] = (byte)(size >> (8 * it));
+}
+
+#if !defined DEBUG_MEMORY
+static void *encode_compact_header(void *block, s64 userSize, u32 align,
+                                   s32 index, s64 sizeBytes) {
+  s64 headerSize = 2 + sizeBytes;
+
+  auto *p = (byte *)block + headerSize;
+  p += calculate_padding_for_pointer(p, align);
+
+  s64 padding = p - headerSize - (byte *)block;
+  assert(padding < 16);
+
+  encode_compact_size(p, userSize, sizeBytes);
+  p[-2] = (byte)index;
+  p[-1] = (byte)(1 | (align == 16 ? 2 : 0) | ((sizeBytes - 1) << 2) |
+                 (padding << 4));
+  return p;
+}
+#endif
+
+// What gets added to the user size when requesting a block with a full header
+static s64 full_header_extra(u32 alignment) {
+  s64 extra = alignment + sizeof(allocation_header) +
+              sizeof(allocation_header) % alignment;
+#if defined DEBUG_MEMORY
+  extra += NO_MANS_LAND_SIZE;  // This is for the safety bytes after the
+                               // requested block
+#endif
+  return extra;
+}
+
+// Everything we need to know about an allocation when reallocating/freeing,
+// regardless of the kind of header it has.
+struct decoded_header {
+  allocator Alloc;
+  s64 Size;
+  u32 Alignment;
+
+  void *Block;    // The pointer the allocator implementation returned
+  s64 BlockSize;  // The size we requested from the allocator implementation
+
+  s64 CompactSizeBytes;  // 0 if the block has a full header
+};
+
+static decoded_header decode_header(void *ptr) {
+  decoded_header result;
+
+#if !defined DEBUG_MEMORY
+  byte flags = ((byte *)ptr)[-1];
+  if (flags & 1) {
+    result.CompactSizeBytes = ((flags >> 2) & 3) + 1;
+
+    result.Alloc = allocator_registry_get(((byte *)ptr)[-2]);
+    result.Size = allocation_get_size(ptr);
+    result.Alignment = flags & 2 ? 16 : 8;
+
+    result.Block = (byte *)ptr - 2 - result.CompactSizeBytes - (flags >> 4);
+    result.BlockSize =
+        result.Size + 2 + result.CompactSizeBytes + result.Alignment - 1;
+    return result;
+  }
+#endif
+
+  auto *header = (allocation_header *)ptr - 1;
+
+  result.CompactSizeBytes = 0;
+
+  result.Alloc = header->Alloc;
+  result.Size = header->Size;
+  result.Alignment = header->Alignment;
+
+  result.Block = (byte *)header - header->AlignmentPadding;
+  result.BlockSize = header->Size + full_header_extra(header->Alignment);
+  return result;
+}
+
 static void *encode_header(void *p, s64 userSize, u32 align, allocator alloc,
                            u64 flags) {
   u32 padding = calculate_padding_for_pointer_with_header(
@@ -404,6 +1139,10 @@ static void *encode_header(void *p, s64 userSize, u32 align, allocator alloc,
   result->Alignment = align;
   result->AlignmentPadding = alignmentPadding;
 
+#if !defined DEBUG_MEMORY
+  result->Kind = 0;  // See :CompactHeader:
+#endif
+
   //
   // This is now safe since we handle alignment here (and not in
   // general_(re)allocate). Before I wrote the fix the program was crashing
@@ -442,6 +1181,37 @@ static void *encode_header(void *p, s64 userSize, u32 align, allocator alloc,
   return p;
 }
 
+// Calls the allocator implementation and encodes the header (a compact one if
+// the block qualifies, see :CompactHeader:).
+static void *allocate_with_header(allocator alloc, s64 userSize, u32 alignment,
+                                  u64 options) {
+#if !defined DEBUG_MEMORY
+  if (alignment <= 16) {
+    s64 sizeBytes = compact_header_size_bytes(userSize);
+    s32 index = sizeBytes ? allocator_registry_index(alloc) : -1;
+    if (index != -1) {
+      u32 compactAlignment = alignment < 8 ? 8 : alignment;
+
+      s64 required = userSize + 2 + sizeBytes + compactAlignment - 1;
+      void *block = alloc.Function(allocator_mode::ALLOCATE, alloc.Context,
+                                   required, null, 0, options);
+      assert(block);
+
+      return encode_compact_header(block, userSize, compactAlignment, index,
+                                   sizeBytes);
+    }
+  }
+#endif
+
+  s64 required = userSize + full_header_extra(alignment);
+
+  void *block = alloc.Function(allocator_mode::ALLOCATE, alloc.Context,
+                               required, null, 0, options);
+  assert(block);
+
+  return encode_header(block, userSize, alignment, alloc, options);
+}
+
 // Without using the fmt.h module, i.e. without allocations.
 static void log_file_and_line(source_location loc) {
   write(Context.Log, loc.file_name());
@@ -501,43 +1271,25 @@ void *general_allocate(allocator alloc, s64 userSize, u32 alignment,
   alignment = alignment < POINTER_SIZE ? POINTER_SIZE : alignment;
   assert(is_pow_of_2(alignment));
 
-  s64 required = userSize + alignment + sizeof(allocation_header) +
-                 sizeof(allocation_header) % alignment;
-#if defined DEBUG_MEMORY
-  required += NO_MANS_LAND_SIZE;  // This is for the safety bytes after the
-                                  // requested block
-#endif
+  auto *result = allocate_with_header(alloc, userSize, alignment, options);
 
-  void *block = alloc.Function(allocator_mode::ALLOCATE, alloc.Context,
-                               required, null, 0, options);
-  assert(block);
-
-  auto *result = encode_header(block, userSize, alignment, alloc, options);
+  if (Context.ProfileAllocations) [[unlikely]] {
+    allocation_profiler_on_allocate(result, userSize, alloc, loc);
+  }
 
 #if defined DEBUG_MEMORY
   auto *header = (allocation_header *)result - 1;
 
-  auto *node = list_search(header);
-
-  debug_memory_node *nodeToEncode = null;
-  if (node->Header == header) {
-    if (!node->Freed) {
-      // Maybe this is a bug in the allocator implementation,
-      // or maybe two different allocators use the same pool.
-      assert(false &&
-             "Allocator implementation returning a pointer which is "
-             "still live and wasn't freed yet");
-      return null;
-    }
-
-    // Overwrite node which was marked as freed.
-    node->Header = header;
-    nodeToEncode = node;
+  if (list_search(header)->Header == header) {
+    // Maybe this is a bug in the allocator implementation,
+    // or maybe two different allocators use the same pool.
+    assert(false &&
+           "Allocator implementation returning a pointer which is "
+           "still live and wasn't freed yet");
+    return null;
   }
 
-  if (!nodeToEncode) {
-    nodeToEncode = list_add(header);
-  }
+  auto *nodeToEncode = debug_memory_add_live(header);
 
   check_for_overlapping_blocks(nodeToEncode);
 
@@ -549,9 +1301,6 @@ void *general_allocate(allocator alloc, s64 userSize, u32 alignment,
   nodeToEncode->RID = 0;
   nodeToEncode->MarkedAsLeak = options & LEAK;
 
-  nodeToEncode->Freed = false;
-
-  nodeToEncode->FreedAt = {};
 #endif
 
   return result;
@@ -561,13 +1310,25 @@ void *general_reallocate(void *ptr, s64 newUserSize, u64 options,
                          source_location loc) {
   options |= Context.AllocOptions;
 
+#if defined DEBUG_MEMORY
   auto *header = (allocation_header *)ptr - 1;
 
-#if defined DEBUG_MEMORY
   debug_memory_maybe_verify_heap();
 
   auto *node = list_search(header);
   if (node->Header != header) {
+    auto *freed = freed_search(header);
+    if (freed) {
+      // @TODO: Callstack
+      panic(tprint(
+          "{!RED}Attempting to reallocate a memory block which was freed.{!} "
+          "The free happened at {!YELLOW}{}:{}{!} (in function: "
+          "{!YELLOW}{}{!}).",
+          freed->FreedAt.file_name(), freed->FreedAt.line(),
+          freed->FreedAt.function_name()));
+      return null;
+    }
+
     // @TODO: Callstack
     panic(
         tprint("{!RED}Attempting to reallocate a memory block which was not "
@@ -576,19 +1337,11 @@ void *general_reallocate(void *ptr, s64 newUserSize, u64 options,
                loc.file_name(), loc.line(), loc.function_name()));
     return null;
   }
-
-  if (node->Freed) {
-    // @TODO: Callstack
-    panic(tprint(
-        "{!RED}Attempting to reallocate a memory block which was freed.{!} The "
-        "free happened at {!YELLOW}{}:{}{!} (in function: {!YELLOW}{}{!}).",
-        node->FreedAt.file_name(), node->FreedAt.line(),
-        node->FreedAt.function_name()));
-    return null;
-  }
 #endif
 
-  if (header->Size == newUserSize) [[unlikely]] {
+  auto h = decode_header(ptr);
+
+  if (h.Size == newUserSize) [[unlikely]] {
     return ptr;
   }
 
@@ -605,61 +1358,56 @@ void *general_reallocate(void *ptr, s64 newUserSize, u64 options,
 
   // The header stores just the size of the requested allocation
   // (so the user code can look at the header and not be confused with garbage)
-  s64 extra = sizeof(allocation_header) + header->Alignment +
-              sizeof(allocation_header) % header->Alignment;
-#if defined DEBUG_MEMORY
-  extra += NO_MANS_LAND_SIZE;
-#endif
+  s64 oldUserSize = h.Size;
+  s64 oldSize = h.BlockSize;
+  s64 newSize = oldSize - oldUserSize + newUserSize;
 
-  s64 oldUserSize = header->Size;
-  s64 oldSize = oldUserSize + extra;
-  s64 newSize = newUserSize + extra;
+  auto alloc = h.Alloc;
 
-  auto alloc = header->Alloc;
-
-  void *block = (byte *)header - header->AlignmentPadding;
+  void *block = h.Block;
 
   void *result = ptr;
 
   // Try to resize the block, this returns null if the block can't be resized
-  // and we need to move it.
-  void *newBlock = alloc.Function(allocator_mode::RESIZE, alloc.Context,
-                                  newSize, block, oldSize, options);
+  // and we need to move it. A compact header can't stay in place if the new
+  // size takes a different number of bytes to store.
+  void *newBlock = null;
+  if (!h.CompactSizeBytes ||
+      compact_header_size_bytes(newUserSize) == h.CompactSizeBytes) {
+    newBlock = alloc.Function(allocator_mode::RESIZE, alloc.Context, newSize,
+                              block, oldSize, options);
+  }
+
   if (!newBlock) {
     // Memory needs to be moved
-    void *newBlock = alloc.Function(allocator_mode::ALLOCATE, alloc.Context,
-                                    newSize, null, 0, options);
-    assert(newBlock);
-
-    result =
-        encode_header(newBlock, newUserSize, header->Alignment, alloc, options);
+    result = allocate_with_header(alloc, newUserSize, h.Alignment, options);
 
+#if defined DEBUG_MEMORY
     // We can't just override the header cause we need to keep the list sorted
     // by the header address
     header = (allocation_header *)result - 1;
 
-#if defined DEBUG_MEMORY
     // See note in _general_free()_
-    node->Freed = true;
-    node->FreedAt = loc;
+    debug_memory_mark_freed(node, loc);
 
     // @Volatile
     auto id = node->ID;
     auto rid = node->RID;
     bool wasMarkedAsLeak = node->MarkedAsLeak;
 
-    node = list_add(header);
-#endif
+    assert(list_search(header)->Header != header &&
+           "Allocator implementation returning a pointer which is "
+           "still live and wasn't freed yet");
+    node = debug_memory_add_live(header);
 
     // Copy old state
-#if defined DEBUG_MEMORY
     node->ID = id;
     node->RID = rid;
     node->MarkedAsLeak = wasMarkedAsLeak;
 #endif
 
     // Copy old stuff and free
-    memcpy((char *)result, (char *)ptr, oldUserSize);
+    memcpy((char *)result, (char *)ptr, min(oldUserSize, newUserSize));
     alloc.Function(allocator_mode::FREE, alloc.Context, 0, block, oldSize,
                    options);
   } else {
@@ -669,7 +1417,11 @@ void *general_reallocate(void *ptr, s64 newUserSize, u64 options,
 
     assert(block == newBlock);  // Sanity
 
-    header->Size = newUserSize;
+    if (h.CompactSizeBytes) {
+      encode_compact_size(ptr, newUserSize, h.CompactSizeBytes);
+    } else {
+      ((allocation_header *)ptr - 1)->Size = newUserSize;
+    }
   }
 
 #if defined DEBUG_MEMORY
@@ -681,14 +1433,19 @@ void *general_reallocate(void *ptr, s64 newUserSize, u64 options,
   if (oldSize < newSize) {
     // If we are expanding the memory, fill the new stuff with CLEAN_LAND_FILL
     memset((byte *)result + oldUserSize, CLEAN_LAND_FILL, newSize - oldSize);
-  } else {
-    // If we are shrinking the memory, fill the old stuff with DEAD_LAND_FILL
-    memset((byte *)header + oldSize, DEAD_LAND_FILL, oldSize - newSize);
+  } else if (result == ptr) {
+    // If we shrunk the memory in place, fill the old stuff with DEAD_LAND_FILL
+    memset((byte *)result + newUserSize, DEAD_LAND_FILL,
+           oldUserSize - newUserSize);
   }
 
   memset((byte *)result + newUserSize, NO_MANS_LAND_FILL, NO_MANS_LAND_SIZE);
 #endif
 
+  if (ProfiledBlockCount) [[unlikely]] {
+    allocation_profiler_on_reallocate(ptr, result, newUserSize);
+  }
+
   return result;
 }
 
@@ -697,13 +1454,24 @@ void general_free(void *ptr, u64 options, source_location loc) {
 
   options |= Context.AllocOptions;
 
+#if defined DEBUG_MEMORY
   auto *header = (allocation_header *)ptr - 1;
 
-#if defined DEBUG_MEMORY
   debug_memory_maybe_verify_heap();
 
   auto *node = list_search(header);
   if (node->Header != header) {
+    auto *freed = freed_search(header);
+    if (freed) {
+      panic(
+          tprint("{!RED}Attempting to free a memory block which was already "
+                 "freed.{!} The previous free happened at {!YELLOW}{}:{}{!} "
+                 "(in function: {!YELLOW}{}{!})",
+                 freed->FreedAt.file_name(), freed->FreedAt.line(),
+                 freed->FreedAt.function_name()));
+      return;
+    }
+
     // @TODO: Callstack
     panic(
         tprint("Attempting to free a memory block which was not heap "
@@ -713,42 +1481,28 @@ void general_free(void *ptr, u64 options, source_location loc) {
 
     return;
   }
-
-  if (node->Freed) {
-    panic(
-        tprint("{!RED}Attempting to free a memory block which was already "
-               "freed.{!} The previous free happened at {!YELLOW}{}:{}{!} "
-               "(in function: {!YELLOW}{}{!})",
-               node->FreedAt.file_name(), node->FreedAt.line(),
-               node->FreedAt.function_name()));
-    return;
-  }
 #endif
 
-  auto alloc = header->Alloc;
-  void *block = (byte *)header - header->AlignmentPadding;
-
-  s64 extra = header->Alignment + sizeof(allocation_header) +
-              sizeof(allocation_header) % header->Alignment;
-#if defined DEBUG_MEMORY
-  extra += NO_MANS_LAND_SIZE;
-#endif
+  auto h = decode_header(ptr);
 
-  s64 size = header->Size + extra;
+  auto alloc = h.Alloc;
+  void *block = h.Block;
+  s64 size = h.BlockSize;
 
 #if defined DEBUG_MEMORY
-  // If DEBUG_MEMORY we keep freed notes in the list
-  // but mark them as freed. This allows debugging double freeing the same
-  // memory block.
-
-  node->Freed = true;
-  node->FreedAt = loc;
+  // If DEBUG_MEMORY we keep freed nodes around (in a seperate tree) and mark
+  // them as freed. This allows debugging double freeing the same memory block.
+  debug_memory_mark_freed(node, loc);
 
   memset((byte *)block, DEAD_LAND_FILL, size);
 
   auto id = node->ID;
 #endif
 
+  if (ProfiledBlockCount) [[unlikely]] {
+    allocation_profiler_on_free(ptr);
+  }
+
   alloc.Function(allocator_mode::FREE, alloc.Context, 0, block, size, options);
 }
 
@@ -758,20 +1512,309 @@ void free_all(allocator alloc, u64 options) {
   // don't corrupt the heap
   auto *it = DebugMemoryHead->Next;
   while (it != DebugMemoryTail) {
-    if (!it->Freed) {
-      if (it->Header->Alloc == alloc) {
-        it->Freed = true;
-        it->FreedAt = source_location::current();
-      }
+    auto *next = it->Next;
+    if (it->Header->Alloc == alloc) {
+      debug_memory_mark_freed(it, source_location::current());
     }
-    it = it->Next;
+    it = next;
   }
 #endif
 
+  if (ProfiledBlockCount) [[unlikely]] {
+    allocation_profiler_on_free_range(alloc.Context, null, (void *)-1);
+  }
+
   options |= Context.AllocOptions;
   alloc.Function(allocator_mode::FREE_ALL, alloc.Context, 0, 0, 0, options);
 }
 
+void trim(allocator alloc, u64 options) {
+  options |= Context.AllocOptions;
+  alloc.Function(allocator_mode::TRIM, alloc.Context, 0, 0, 0, options);
+}
+
+bool query_stats(allocator alloc, allocator_stats *stats) {
+  *stats = {};
+  return alloc.Function(allocator_mode::QUERY_STATS, alloc.Context, 0, stats,
+                        0, Context.AllocOptions) != null;
+}
+
+void arena_restore(arena_checkpoint checkpoint) {
+  auto *data = checkpoint.Arena;
+  assert(checkpoint.Used <= data->Used &&
+         "Restoring a checkpoint which is newer than the arena's state. Did "
+         "you call free_all or restore checkpoints in the wrong order?");
+
+  forget_allocations_in_range(data, (byte *)data->Block + checkpoint.Used,
+                              (byte *)data->Block + data->Used);
+
+  data->Used = checkpoint.Used;
+}
+
+void forget_allocations_in_range(void *allocContext, void *begin, void *end) {
+#if defined DEBUG_MEMORY
+  // The list is sorted by address, so just walk the range
+  auto *it = list_search((allocation_header *)begin);
+  while (it != DebugMemoryTail && it->Header < (allocation_header *)end) {
+    auto *next = it->Next;
+    if (it->Header->Alloc.Context == allocContext) {
+      debug_memory_mark_freed(it, source_location::current());
+    }
+    it = next;
+  }
+#endif
+
+  if (ProfiledBlockCount) [[unlikely]] {
+    allocation_profiler_on_free_range(allocContext, begin, end);
+  }
+}
+
+//
+// Electric fence allocator, see comment in memory.h.
+//
+
+using electric_fence_live_block = electric_fence_allocator_data::live_block;
+
+static s64 electric_fence_slot(void *block, s64 capacity) {
+  u64 h = ((u64)block >> 4) * 0x9E3779B97F4A7C15ull;
+  return (s64)(h >> 32) & (capacity - 1);
+}
+
+static void electric_fence_insert(electric_fence_live_block *live,
+                                  s64 capacity,
+                                  electric_fence_live_block entry) {
+  s64 it = electric_fence_slot(entry.Block, capacity);
+  while (live[it].Block) it = (it + 1) & (capacity - 1);
+  live[it] = entry;
+}
+
+static bool electric_fence_add_live(electric_fence_allocator_data *data,
+                                    electric_fence_live_block entry) {
+  if ((data->LiveCount + 1) * 2 > data->LiveCapacity) {
+    s64 capacity = max(data->LiveCapacity * 2, (s64)256);
+
+    auto *live = (electric_fence_live_block *)os_allocate_block(
+        capacity * sizeof(electric_fence_live_block));
+    if (!live) return false;
+
+    For(range(data->LiveCapacity)) {
+      if (data->Live[it].Block) {
+        electric_fence_insert(live, capacity, data->Live[it]);
+      }
+    }
+    if (data->Live) os_free_block(data->Live);
+
+    data->Live = live;
+    data->LiveCapacity = capacity;
+  }
+
+  electric_fence_insert(data->Live, data->LiveCapacity, entry);
+  data->LiveCount += 1;
+  return true;
+}
+
+// Returns the pages of _block_ and forgets about it
+static electric_fence_allocator_data::range electric_fence_remove_live(
+    electric_fence_allocator_data *data, void *block) {
+  s64 mask = data->LiveCapacity - 1;
+  auto *live = data->Live;
+
+  s64 hole = electric_fence_slot(block, data->LiveCapacity);
+  while (live[hole].Block != block) {
+    assert(live[hole].Block && "Block wasn't allocated by this allocator");
+    hole = (hole + 1) & mask;
+  }
+  auto pages = live[hole].Pages;
+
+  // Move entries after the hole back if that's closer to their slot, so
+  // lookups don't stop early at the hole
+  for (s64 it = (hole + 1) & mask; live[it].Block; it = (it + 1) & mask) {
+    s64 home = electric_fence_slot(live[it].Block, data->LiveCapacity);
+    if (((it - home) & mask) >= ((it - hole) & mask)) {
+      live[hole] = live[it];
+      hole = it;
+    }
+  }
+  live[hole] = {};
+  data->LiveCount -= 1;
+
+  return pages;
+}
+
+// Reserves and commits the pages for a block and its guard page
+static void *electric_fence_allocate(electric_fence_allocator_data *data,
+                                     s64 size, bool guardAfter,
+                                     electric_fence_allocator_data::range *pages) {
+  s64 pageSize = os_get_page_size();
+  s64 alignment = max(data->Alignment, (s64)1);
+  assert(is_pow_of_2(alignment));
+
+  s64 dataSize = (max(size, (s64)1) + alignment - 1 + pageSize - 1) & -pageSize;
+
+  auto *base = (byte *)os_reserve_block(dataSize + pageSize);
+  if (!base) return null;
+
+  byte *dataStart = guardAfter ? base : base + pageSize;
+  if (!os_commit_block(dataStart, dataSize)) {
+    os_release_block(base, dataSize + pageSize);
+    return null;
+  }
+  *pages = {base, dataSize + pageSize};
+
+  if (!guardAfter) return dataStart;
+
+  // Flush against the guard
+  byte *end = dataStart + dataSize;
+  return (byte *)((u64)(end - size) & -alignment);
+}
+
+// Blocks only take the lock for bookkeeping, the syscalls (mapping,
+// decommitting and releasing pages) happen outside of it
+static void electric_fence_lock(electric_fence_allocator_data *data) {
+  while (atomic_swap(&data->Lock, 1)) {
+    while (data->Lock) cpu_pause();
+  }
+}
+
+static void electric_fence_unlock(electric_fence_allocator_data *data) {
+  atomic_swap(&data->Lock, 0);
+}
+
+// Puts _pages_ (already decommitted) in the quarantine. Returns the range
+// which has to be released: the oldest one in the quarantine if it was full,
+// or _pages_ itself if there is no quarantine. Call with the lock held.
+static electric_fence_allocator_data::range electric_fence_quarantine(
+    electric_fence_allocator_data *data,
+    electric_fence_allocator_data::range pages) {
+  if (!data->Quarantine) return pages;
+
+  auto *slot = &data->Quarantine[data->QuarantineNext];
+  auto evicted = *slot;
+  *slot = pages;
+
+  data->QuarantineNext = (data->QuarantineNext + 1) % data->QuarantineSize;
+  return evicted;
+}
+
+static void electric_fence_release_ranges(
+    electric_fence_allocator_data::range *ranges, s64 count) {
+  For(range(count)) {
+    if (ranges[it].Base) os_release_block(ranges[it].Base, ranges[it].Size);
+  }
+}
+
+void *electric_fence_allocator(allocator_mode mode, void *context, s64 size,
+                               void *oldMemory, s64 oldSize, u64 options) {
+  auto *data = (electric_fence_allocator_data *)context;
+
+  switch (mode) {
+    case allocator_mode::ALLOCATE: {
+      bool guardAfter = data->Guard == electric_fence_guard::AFTER;
+      if (data->Guard == electric_fence_guard::ALTERNATE) {
+        guardAfter = (atomic_inc(&data->AllocationCount) & 1) == 0;
+      }
+
+      electric_fence_allocator_data::range pages;
+      void *result = electric_fence_allocate(data, size, guardAfter, &pages);
+      if (!result) return null;
+
+      electric_fence_lock(data);
+      bool added = electric_fence_add_live(data, {result, pages});
+      if (added) {
+        data->Used += size;
+        data->PeakUsed = max(data->PeakUsed, data->Used);
+        data->Committed += pages.Size - os_get_page_size();
+      }
+      electric_fence_unlock(data);
+
+      if (!added) {
+        os_release_block(pages.Base, pages.Size);
+        return null;
+      }
+      return result;
+    }
+    case allocator_mode::RESIZE: {
+      // Moving the block every time also catches stale pointers after a
+      // reallocation
+      return null;
+    }
+    case allocator_mode::FREE: {
+      using range = electric_fence_allocator_data::range;
+
+      // The ring for the quarantine is allocated on the first free
+      range *ring = null;
+      if (!data->Quarantine && data->QuarantineSize > 0) {
+        ring = (range *)os_allocate_block(data->QuarantineSize * sizeof(range));
+      }
+
+      electric_fence_lock(data);
+      auto pages = electric_fence_remove_live(data, oldMemory);
+      data->Used -= oldSize;
+      data->Committed -= pages.Size - os_get_page_size();
+      electric_fence_unlock(data);
+
+      // Anything touching the block from now on faults. Only the guard isn't
+      // committed, we don't have to know which side it's on.
+      os_decommit_block(pages.Base, pages.Size);
+
+      electric_fence_lock(data);
+      if (ring && !data->Quarantine) {
+        data->Quarantine = ring;
+        ring = null;
+      }
+      auto evicted = electric_fence_quarantine(data, pages);
+      electric_fence_unlock(data);
+
+      electric_fence_release_ranges(&evicted, 1);
+      if (ring) os_free_block(ring);  // Another thread installed one first
+      return null;
+    }
+    case allocator_mode::FREE_ALL: {
+      assert(false);  // Not supported, see comment in memory.h
+      return null;
+    }
+    case allocator_mode::TRIM: {
+      // Take the whole quarantine, the next free allocates a new one
+      electric_fence_lock(data);
+      auto *ring = data->Quarantine;
+      data->Quarantine = null;
+      data->QuarantineNext = 0;
+      electric_fence_unlock(data);
+
+      if (ring) {
+        electric_fence_release_ranges(ring, data->QuarantineSize);
+        os_free_block(ring);
+      }
+      return null;
+    }
+    case allocator_mode::QUERY_STATS: {
+      auto *stats = (allocator_stats *)oldMemory;
+
+      electric_fence_lock(data);
+      stats->Used = data->Used;
+      stats->PeakUsed = data->PeakUsed;
+      stats->Committed = data->Committed;
+      electric_fence_unlock(data);
+      return stats;
+    }
+  }
+  return null;
+}
+
+void electric_fence_allocator_release(electric_fence_allocator_data *data) {
+  allocator_registry_remove(data);
+  if (data->Quarantine) {
+    electric_fence_release_ranges(data->Quarantine, data->QuarantineSize);
+    os_free_block(data->Quarantine);
+  }
+  data->Quarantine = null;
+  data->QuarantineNext = 0;
+
+  if (data->Live) os_free_block(data->Live);
+  data->Live = null;
+  data->LiveCount = data->LiveCapacity = 0;
+}
+
 LSTD_END_NAMESPACE
 
 #if LSTD_NO_CRT
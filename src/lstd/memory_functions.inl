@@ -0,0 +1,200 @@
+// Included by memory.cpp once per instruction set. Expects:
+//   VEC               - a struct with the vector operations (see sse2_vec)
+//   MEMORY_FUNC(name) - appends the instruction set to _name_
+//
+// Everything larger than 2 vectors is done with a head and a tail vector
+// (unaligned, loaded before anything is stored) and a loop of aligned stores
+// in between, so overlapping buffers are handled without special cases as
+// long as we pick the right direction.
+
+// _size_ > 2 vectors. Safe for overlapping buffers when _dst_ < _src_.
+static void MEMORY_FUNC(copy_forward)(byte *dst, const byte *src, s64 size,
+                                      bool nonTemporal) {
+  const s64 V = VEC::SIZE;
+
+  auto head = VEC::loadu(src);
+  auto tail = VEC::loadu(src + size - V);
+
+  byte *end = dst + size;
+
+  s64 skew = V - ((u64)dst & (V - 1));
+  byte *d = dst + skew;
+  const byte *s = src + skew;
+
+  if (nonTemporal) {
+    while (end - d > 4 * V) {
+      auto a = VEC::loadu(s), b = VEC::loadu(s + V);
+      auto c = VEC::loadu(s + 2 * V), e = VEC::loadu(s + 3 * V);
+      VEC::stream(d, a), VEC::stream(d + V, b);
+      VEC::stream(d + 2 * V, c), VEC::stream(d + 3 * V, e);
+      d += 4 * V, s += 4 * V;
+    }
+    VEC::fence();
+  } else {
+    while (end - d > 4 * V) {
+      auto a = VEC::loadu(s), b = VEC::loadu(s + V);
+      auto c = VEC::loadu(s + 2 * V), e = VEC::loadu(s + 3 * V);
+      VEC::store(d, a), VEC::store(d + V, b);
+      VEC::store(d + 2 * V, c), VEC::store(d + 3 * V, e);
+      d += 4 * V, s += 4 * V;
+    }
+  }
+
+  while (end - d > V) {
+    VEC::store(d, VEC::loadu(s));
+    d += V, s += V;
+  }
+
+  VEC::storeu(dst, head);
+  VEC::storeu(end - V, tail);
+}
+
+// _size_ > 2 vectors. Safe for overlapping buffers when _dst_ > _src_.
+static void MEMORY_FUNC(copy_backward)(byte *dst, const byte *src, s64 size) {
+  const s64 V = VEC::SIZE;
+
+  auto head = VEC::loadu(src);
+  auto tail = VEC::loadu(src + size - V);
+
+  s64 skew = (u64)(dst + size) & (V - 1);
+  byte *d = dst + size - skew;
+  const byte *s = src + size - skew;
+
+  while (d - dst > 4 * V) {
+    d -= 4 * V, s -= 4 * V;
+    auto a = VEC::loadu(s + 3 * V), b = VEC::loadu(s + 2 * V);
+    auto c = VEC::loadu(s + V), e = VEC::loadu(s);
+    VEC::store(d + 3 * V, a), VEC::store(d + 2 * V, b);
+    VEC::store(d + V, c), VEC::store(d, e);
+  }
+
+  while (d - dst > V) {
+    d -= V, s -= V;
+    VEC::store(d, VEC::loadu(s));
+  }
+
+  VEC::storeu(dst, head);
+  VEC::storeu(dst + size - V, tail);
+}
+
+static void *MEMORY_FUNC(memmove)(void *dstp, const void *srcp, size_t n) {
+  const s64 V = VEC::SIZE;
+
+  auto *dst = (byte *)dstp;
+  auto *src = (const byte *)srcp;
+  s64 size = (s64)n;
+
+  if (size <= 16) {
+    copy_up_to_16(dst, src, size);
+    return dstp;
+  }
+
+  if (size <= 2 * V) {
+    if (size >= V) {
+      auto a = VEC::loadu(src), b = VEC::loadu(src + size - V);
+      VEC::storeu(dst, a);
+      VEC::storeu(dst + size - V, b);
+    } else {
+      copy_16_to_32(dst, src, size);
+    }
+    return dstp;
+  }
+
+  // Copying front to back is fine unless _dst_ starts inside the source
+  if ((u64)(dst - src) >= (u64)size) {
+    bool disjoint = src + size <= dst || dst + size <= src;
+    MEMORY_FUNC(copy_forward)
+    (dst, src, size, disjoint && size >= MEMORY_NON_TEMPORAL_THRESHOLD);
+  } else {
+    MEMORY_FUNC(copy_backward)(dst, src, size);
+  }
+  return dstp;
+}
+
+static void *MEMORY_FUNC(memset)(void *dstp, int value, size_t n) {
+  const s64 V = VEC::SIZE;
+
+  auto *dst = (byte *)dstp;
+  s64 size = (s64)n;
+
+  if (size <= 16) {
+    set_up_to_16(dst, (byte)value, size);
+    return dstp;
+  }
+
+  if (size < V) {
+    set_16_to_32(dst, (byte)value, size);
+    return dstp;
+  }
+
+  auto v = VEC::broadcast((byte)value);
+
+  byte *end = dst + size;
+  VEC::storeu(dst, v);
+  VEC::storeu(end - V, v);
+  if (size <= 2 * V) return dstp;
+
+  byte *d = (byte *)(((u64)dst + V) & -V);
+
+  if (size >= MEMORY_NON_TEMPORAL_THRESHOLD) {
+    while (end - d > 4 * V) {
+      VEC::stream(d, v), VEC::stream(d + V, v);
+      VEC::stream(d + 2 * V, v), VEC::stream(d + 3 * V, v);
+      d += 4 * V;
+    }
+    VEC::fence();
+  } else {
+    while (end - d > 4 * V) {
+      VEC::store(d, v), VEC::store(d + V, v);
+      VEC::store(d + 2 * V, v), VEC::store(d + 3 * V, v);
+      d += 4 * V;
+    }
+  }
+
+  while (end - d > V) {
+    VEC::store(d, v);
+    d += V;
+  }
+  return dstp;
+}
+
+// Returns the difference of the first mismatching bytes in the vectors at
+// _a_ and _b_, or 0 if they are equal
+static int MEMORY_FUNC(compare_vector)(const byte *a, const byte *b) {
+  u32 mask = VEC::equal_mask(VEC::loadu(a), VEC::loadu(b));
+  if (mask == VEC::ALL_EQUAL) return 0;
+
+  s32 i = lsb(~mask & VEC::ALL_EQUAL);
+  return a[i] - b[i];
+}
+
+static int MEMORY_FUNC(memcmp)(const void *ap, const void *bp, size_t n) {
+  const s64 V = VEC::SIZE;
+
+  auto *a = (const byte *)ap;
+  auto *b = (const byte *)bp;
+  s64 size = (s64)n;
+
+  if (size < 16) return compare_up_to_16(a, b, size);
+  if (size < V) return compare_16_to_32(a, b, size);
+
+  s64 i = 0;
+  for (; i + 4 * V <= size; i += 4 * V) {
+    auto e0 = VEC::equal(VEC::loadu(a + i), VEC::loadu(b + i));
+    auto e1 = VEC::equal(VEC::loadu(a + i + V), VEC::loadu(b + i + V));
+    auto e2 = VEC::equal(VEC::loadu(a + i + 2 * V), VEC::loadu(b + i + 2 * V));
+    auto e3 = VEC::equal(VEC::loadu(a + i + 3 * V), VEC::loadu(b + i + 3 * V));
+
+    auto all = VEC::and_(VEC::and_(e0, e1), VEC::and_(e2, e3));
+    if (VEC::mask(all) != VEC::ALL_EQUAL) break;  // Find it below
+  }
+
+  for (; i + V <= size; i += V) {
+    int r = MEMORY_FUNC(compare_vector)(a + i, b + i);
+    if (r) return r;
+  }
+
+  // The bytes before the last vector are known to be equal
+  if (i < size) return MEMORY_FUNC(compare_vector)(a + size - V, b + size - V);
+  return 0;
+}
@@ -0,0 +1,527 @@
+#include "lstd/memory_profiler.h"
+
+#include "lstd/bits.h"
+#include "lstd/os.h"
+#include "lstd/qsort.h"
+
+LSTD_BEGIN_NAMESPACE
+
+//
+// Both tables use open addressing with linear probing and live in memory
+// requested directly from the OS (see note in memory_profiler.h).
+//
+
+struct profiled_block {
+  void *Ptr;  // null if the slot is empty
+  void *AllocContext;
+  s64 Size;
+  s64 Tick;  // When it was allocated
+  s64 Site;  // Index in the sites table
+};
+
+struct allocation_profiler_state {
+  allocation_site_stats *Sites;
+  s64 SitesCount;
+  s64 SitesCapacity;  // Power of 2
+
+  profiled_block *Blocks;
+  s64 BlocksCapacity;  // Power of 2, the count is ProfiledBlockCount
+
+  s64 Tick;
+};
+
+static thread_local allocation_profiler_state ProfilerState;
+
+static void *profiler_allocate_table(s64 size) {
+  void *p = os_reserve_block(size);
+  if (!p) return null;
+  if (!os_commit_block(p, size)) {
+    os_release_block(p, size);
+    return null;
+  }
+  return p;  // Committed memory is zeroed
+}
+
+static u64 profiler_hash_pointer(void *p) {
+  u64 h = (u64)p;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  return h;
+}
+
+static u64 profiler_hash_site(const char *file, u32 line, u32 column) {
+  return profiler_hash_pointer((void *)file) ^
+         (((u64)line << 16 | column) * 0x9E3779B97F4A7C15ull);
+}
+
+static bool profiler_grow_sites() {
+  auto *s = &ProfilerState;
+
+  s64 newCapacity = s->SitesCapacity ? s->SitesCapacity * 2 : 256;
+
+  auto *newSites = (allocation_site_stats *)profiler_allocate_table(
+      newCapacity * sizeof(allocation_site_stats));
+  if (!newSites) return false;
+
+  // The block table refers to sites by index, so remember where each one went
+  s64 *moves = null;
+  if (s->SitesCapacity) {
+    moves = (s64 *)profiler_allocate_table(s->SitesCapacity * sizeof(s64));
+    if (!moves) {
+      os_release_block(newSites, newCapacity * sizeof(allocation_site_stats));
+      return false;
+    }
+  }
+
+  For(range(s->SitesCapacity)) {
+    auto *site = &s->Sites[it];
+    if (!site->File) continue;
+
+    u64 i = profiler_hash_site(site->File, site->Line, site->Column) &
+            (newCapacity - 1);
+    while (newSites[i].File) i = (i + 1) & (newCapacity - 1);
+
+    newSites[i] = *site;
+    moves[it] = i;
+  }
+
+  For(range(s->BlocksCapacity)) {
+    auto *b = &s->Blocks[it];
+    if (b->Ptr) b->Site = moves[b->Site];
+  }
+
+  if (s->SitesCapacity) {
+    os_release_block(moves, s->SitesCapacity * sizeof(s64));
+    os_release_block(s->Sites, s->SitesCapacity * sizeof(allocation_site_stats));
+  }
+
+  s->Sites = newSites;
+  s->SitesCapacity = newCapacity;
+  return true;
+}
+
+// Returns -1 if we run out of memory
+static s64 profiler_find_or_add_site(source_location loc) {
+  auto *s = &ProfilerState;
+
+  if ((s->SitesCount + 1) * 4 > s->SitesCapacity * 3) {
+    if (!profiler_grow_sites()) return -1;
+  }
+
+  const char *file = loc.file_name();
+  u32 line = loc.line(), column = loc.column();
+
+  u64 i = profiler_hash_site(file, line, column) & (s->SitesCapacity - 1);
+  while (s->Sites[i].File) {
+    auto *site = &s->Sites[i];
+    if (site->File == file && site->Line == line && site->Column == column) {
+      return i;
+    }
+    i = (i + 1) & (s->SitesCapacity - 1);
+  }
+
+  auto *site = &s->Sites[i];
+  site->File = file;
+  site->Function = loc.function_name();
+  site->Line = line;
+  site->Column = column;
+  ++s->SitesCount;
+  return i;
+}
+
+static bool profiler_grow_blocks() {
+  auto *s = &ProfilerState;
+
+  s64 newCapacity = s->BlocksCapacity ? s->BlocksCapacity * 2 : 4096;
+
+  auto *newBlocks = (profiled_block *)profiler_allocate_table(
+      newCapacity * sizeof(profiled_block));
+  if (!newBlocks) return false;
+
+  For(range(s->BlocksCapacity)) {
+    auto *b = &s->Blocks[it];
+    if (!b->Ptr) continue;
+
+    u64 i = profiler_hash_pointer(b->Ptr) & (newCapacity - 1);
+    while (newBlocks[i].Ptr) i = (i + 1) & (newCapacity - 1);
+    newBlocks[i] = *b;
+  }
+
+  if (s->BlocksCapacity) {
+    os_release_block(s->Blocks, s->BlocksCapacity * sizeof(profiled_block));
+  }
+
+  s->Blocks = newBlocks;
+  s->BlocksCapacity = newCapacity;
+  return true;
+}
+
+// Returns the slot of _ptr_, -1 if we don't track it
+static s64 profiler_find_block(void *ptr) {
+  auto *s = &ProfilerState;
+  if (!s->BlocksCapacity) return -1;
+
+  u64 i = profiler_hash_pointer(ptr) & (s->BlocksCapacity - 1);
+  while (s->Blocks[i].Ptr) {
+    if (s->Blocks[i].Ptr == ptr) return i;
+    i = (i + 1) & (s->BlocksCapacity - 1);
+  }
+  return -1;
+}
+
+// Backward-shift deletion so we don't need tombstones
+static void profiler_remove_block(s64 slot) {
+  auto *s = &ProfilerState;
+  u64 mask = s->BlocksCapacity - 1;
+
+  u64 hole = slot;
+  u64 i = (hole + 1) & mask;
+  while (s->Blocks[i].Ptr) {
+    u64 home = profiler_hash_pointer(s->Blocks[i].Ptr) & mask;
+
+    // Move the block into the hole if the hole lies between its home and
+    // where it is now (cyclically)
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      s->Blocks[hole] = s->Blocks[i];
+      hole = i;
+    }
+    i = (i + 1) & mask;
+  }
+  s->Blocks[hole].Ptr = null;
+
+  --ProfiledBlockCount;
+}
+
+static void profiler_record_free(s64 slot) {
+  auto *s = &ProfilerState;
+
+  auto *b = &s->Blocks[slot];
+  auto *site = &s->Sites[b->Site];
+
+  site->Frees += 1;
+  site->LiveBytes -= b->Size;
+  site->LiveCount -= 1;
+
+  s64 bucket = msb((u64)(s->Tick - b->Tick + 1));
+  if (bucket >= ALLOCATION_LIFETIME_BUCKETS) {
+    bucket = ALLOCATION_LIFETIME_BUCKETS - 1;
+  }
+  site->Lifetimes[bucket] += 1;
+
+  profiler_remove_block(slot);
+}
+
+void allocation_profiler_on_allocate(void *ptr, s64 size, allocator alloc,
+                                     source_location loc) {
+  auto *s = &ProfilerState;
+
+  if ((ProfiledBlockCount + 1) * 4 > s->BlocksCapacity * 3) {
+    if (!profiler_grow_blocks()) return;
+  }
+
+  s64 siteIndex = profiler_find_or_add_site(loc);
+  if (siteIndex == -1) return;
+
+  ++s->Tick;
+
+  auto *site = &s->Sites[siteIndex];
+  site->Allocations += 1;
+  site->TotalBytes += size;
+  site->LiveBytes += size;
+  site->LiveCount += 1;
+  if (site->LiveBytes > site->PeakLiveBytes) {
+    site->PeakLiveBytes = site->LiveBytes;
+  }
+
+  u64 i = profiler_hash_pointer(ptr) & (s->BlocksCapacity - 1);
+  while (s->Blocks[i].Ptr) i = (i + 1) & (s->BlocksCapacity - 1);
+
+  s->Blocks[i] = {ptr, alloc.Context, size, s->Tick, siteIndex};
+  ++ProfiledBlockCount;
+}
+
+void allocation_profiler_on_reallocate(void *oldPtr, void *newPtr,
+                                       s64 newSize) {
+  auto *s = &ProfilerState;
+
+  s64 slot = profiler_find_block(oldPtr);
+  if (slot == -1) return;
+
+  auto b = s->Blocks[slot];
+
+  auto *site = &s->Sites[b.Site];
+  site->Reallocations += 1;
+  if (newSize > b.Size) site->TotalBytes += newSize - b.Size;
+  site->LiveBytes += newSize - b.Size;
+  if (site->LiveBytes > site->PeakLiveBytes) {
+    site->PeakLiveBytes = site->LiveBytes;
+  }
+
+  if (newPtr == oldPtr) {
+    s->Blocks[slot].Size = newSize;
+    return;
+  }
+
+  // The block moved, rehash it under the new pointer
+  profiler_remove_block(slot);
+
+  b.Ptr = newPtr;
+  b.Size = newSize;
+
+  u64 i = profiler_hash_pointer(newPtr) & (s->BlocksCapacity - 1);
+  while (s->Blocks[i].Ptr) i = (i + 1) & (s->BlocksCapacity - 1);
+  s->Blocks[i] = b;
+  ++ProfiledBlockCount;
+}
+
+void allocation_profiler_on_free(void *ptr) {
+  s64 slot = profiler_find_block(ptr);
+  if (slot != -1) profiler_record_free(slot);
+}
+
+void allocation_profiler_on_free_range(void *allocContext, void *begin,
+                                       void *end) {
+  auto *s = &ProfilerState;
+
+  // Removing shifts later blocks back into the current slot, so we look at
+  // the same slot again until it doesn't match.
+  For(range(s->BlocksCapacity)) {
+    while (true) {
+      auto *b = &s->Blocks[it];
+      if (!b->Ptr || b->AllocContext != allocContext || b->Ptr < begin ||
+          b->Ptr >= end) {
+        break;
+      }
+      profiler_record_free(it);
+    }
+  }
+}
+
+void allocation_profiler_reset() {
+  auto *s = &ProfilerState;
+  if (s->SitesCapacity) {
+    memset0(s->Sites, s->SitesCapacity * sizeof(allocation_site_stats));
+  }
+  if (s->BlocksCapacity) {
+    memset0(s->Blocks, s->BlocksCapacity * sizeof(profiled_block));
+  }
+  s->SitesCount = 0;
+  s->Tick = 0;
+  ProfiledBlockCount = 0;
+}
+
+void allocation_profiler_release() {
+  auto *s = &ProfilerState;
+  if (s->SitesCapacity) {
+    os_release_block(s->Sites, s->SitesCapacity * sizeof(allocation_site_stats));
+  }
+  if (s->BlocksCapacity) {
+    os_release_block(s->Blocks, s->BlocksCapacity * sizeof(profiled_block));
+  }
+  *s = {};
+  ProfiledBlockCount = 0;
+}
+
+static s32 compare_sites_by_live_bytes(const allocation_site_stats *lhs,
+                                       const allocation_site_stats *rhs) {
+  if (lhs->LiveBytes == rhs->LiveBytes) return 0;
+  return lhs->LiveBytes > rhs->LiveBytes ? -1 : 1;
+}
+
+allocation_profile allocation_profile_snapshot() {
+  auto *s = &ProfilerState;
+
+  allocation_profile result;
+  result.LiveBytes = 0;
+  result.Tick = s->Tick;
+
+  // Don't profile ourselves
+  auto newContext = Context;
+  newContext.ProfileAllocations = false;
+  PUSH_CONTEXT(newContext) {
+    if (s->SitesCount) reserve(result.Sites, s->SitesCount);
+
+    For(range(s->SitesCapacity)) {
+      auto *site = &s->Sites[it];
+      if (!site->File) continue;
+
+      add(result.Sites, *site);
+      result.LiveBytes += site->LiveBytes;
+    }
+  }
+
+  quick_sort<allocation_site_stats>(result.Sites.Data, result.Sites.Count,
+                                    &compare_sites_by_live_bytes);
+  return result;
+}
+
+static bool sites_match(allocation_site_stats *a, allocation_site_stats *b) {
+  return a->Line == b->Line && a->Column == b->Column &&
+         (a->File == b->File || c_string_order(a->File, b->File) == 0);
+}
+
+// Returns true if anything changed
+static bool site_subtract(allocation_site_stats *result,
+                          allocation_site_stats *older) {
+  result->Allocations -= older->Allocations;
+  result->Reallocations -= older->Reallocations;
+  result->Frees -= older->Frees;
+  result->TotalBytes -= older->TotalBytes;
+  result->LiveBytes -= older->LiveBytes;
+  result->LiveCount -= older->LiveCount;
+
+  bool changed = result->Allocations || result->Reallocations ||
+                 result->Frees || result->TotalBytes || result->LiveBytes;
+  For(range(ALLOCATION_LIFETIME_BUCKETS)) {
+    result->Lifetimes[it] -= older->Lifetimes[it];
+    changed = changed || result->Lifetimes[it];
+  }
+  return changed;
+}
+
+allocation_profile allocation_profile_diff(allocation_profile older,
+                                           allocation_profile newer) {
+  allocation_profile result;
+  result.LiveBytes = newer.LiveBytes - older.LiveBytes;
+  result.Tick = newer.Tick - older.Tick;
+
+  auto newContext = Context;
+  newContext.ProfileAllocations = false;
+  PUSH_CONTEXT(newContext) {
+    For_as(n, newer.Sites) {
+      allocation_site_stats d = n;
+
+      bool changed = true;
+      For_as(o, older.Sites) {
+        if (sites_match(&n, &o)) {
+          changed = site_subtract(&d, &o);
+          break;
+        }
+      }
+      if (changed) add(result.Sites, d);
+    }
+
+    // Sites which only the older snapshot has (e.g. taken on another thread)
+    For_as(o, older.Sites) {
+      bool found = false;
+      For_as(n, newer.Sites) {
+        if (sites_match(&n, &o)) {
+          found = true;
+          break;
+        }
+      }
+      if (found) continue;
+
+      allocation_site_stats d = {};
+      d.File = o.File;
+      d.Function = o.Function;
+      d.Line = o.Line;
+      d.Column = o.Column;
+      site_subtract(&d, &o);
+      add(result.Sites, d);
+    }
+  }
+
+  quick_sort<allocation_site_stats>(result.Sites.Data, result.Sites.Count,
+                                    &compare_sites_by_live_bytes);
+  return result;
+}
+
+// The encoding is binary, so we don't go through add(), which indexes by
+// code points and would trip over invalid utf-8
+static void encode_bytes(string ref out, const char *data, s64 size) {
+  maybe_grow(out, size);
+  memcpy(out.Data + out.Count, data, size);
+  out.Count += size;
+}
+
+static void encode_varint(string ref out, u64 value) {
+  char buffer[10];
+  s64 count = 0;
+  do {
+    byte b = value & 0x7f;
+    value >>= 7;
+    if (value) b |= 0x80;
+    buffer[count++] = (char)b;
+  } while (value);
+  encode_bytes(out, buffer, count);
+}
+
+static void encode_signed_varint(string ref out, s64 value) {
+  encode_varint(out, ((u64)value << 1) ^ (u64)(value >> 63));  // Zigzag
+}
+
+// Returns the index of _str_ in _strings_, adds it if it's not there
+static s64 intern_profile_string(array<const char *> ref strings,
+                                 const char *str) {
+  For(range(strings.Count)) {
+    if (strings[it] == str || c_string_order(strings[it], str) == 0) return it;
+  }
+  add(strings, str);
+  return strings.Count - 1;
+}
+
+string allocation_profile_encode(allocation_profile profile) {
+  string result;
+
+  auto newContext = Context;
+  newContext.ProfileAllocations = false;
+  PUSH_CONTEXT(newContext) {
+    array<const char *> strings;
+    defer(free(strings));
+
+    For(profile.Sites) {
+      intern_profile_string(strings, it.File);
+      intern_profile_string(strings, it.Function);
+    }
+
+    encode_bytes(result, "LSAP", 4);
+    encode_bytes(result, (const char *)&ALLOCATION_PROFILE_VERSION, 1);
+
+    encode_signed_varint(result, profile.Tick);
+    encode_signed_varint(result, profile.LiveBytes);
+
+    encode_varint(result, strings.Count);
+    For(strings) {
+      s64 size = c_string_byte_count(it);
+      encode_varint(result, size);
+      encode_bytes(result, it, size);
+    }
+
+    encode_varint(result, profile.Sites.Count);
+    For(profile.Sites) {
+      encode_varint(result, intern_profile_string(strings, it.File));
+      encode_varint(result, intern_profile_string(strings, it.Function));
+      encode_varint(result, it.Line);
+      encode_varint(result, it.Column);
+
+      encode_signed_varint(result, it.Allocations);
+      encode_signed_varint(result, it.Reallocations);
+      encode_signed_varint(result, it.Frees);
+      encode_signed_varint(result, it.TotalBytes);
+      encode_signed_varint(result, it.LiveBytes);
+      encode_signed_varint(result, it.PeakLiveBytes);
+      encode_signed_varint(result, it.LiveCount);
+
+      For_as(l, it.Lifetimes) encode_signed_varint(result, l);
+    }
+  }
+  return result;
+}
+
+bool allocation_profile_write(allocation_profile profile, string path) {
+  auto newContext = Context;
+  newContext.ProfileAllocations = false;
+
+  bool result = false;
+  PUSH_CONTEXT(newContext) {
+    string encoded = allocation_profile_encode(profile);
+    defer(free(encoded));
+
+    result = os_write_to_file(path, encoded, file_write_mode::Overwrite_Entire);
+  }
+  return result;
+}
+
+LSTD_END_NAMESPACE
@@ -4,6 +4,11 @@ LSTD_BEGIN_NAMESPACE
 
 #define S ((platform_memory_state *)&PlatformMemoryState[0])
 
+static void persistent_alloc_update_peak() {
+  s64 used = S->PersistentAllocData.Used + S->PersistentAllocLargePagesSize;
+  S->PersistentAllocPeakUsed = max(S->PersistentAllocPeakUsed, used);
+}
+
 void *platform_persistent_alloc(allocator_mode mode, void *context, s64 size,
                              void *oldMemory, s64 oldSize, u64 options) {
   auto *data = (tlsf_allocator_data *)context;
@@ -16,44 +21,545 @@ void *platform_persistent_alloc(allocator_mode mode, void *context, s64 size,
     platform_report_warning(
         "Large allocation requested for the platform persistent allocator; "
         "querying the OS for memory directly");
-    return create_persistent_alloc_page(size);
+    void *page = create_persistent_alloc_page(size);
+    persistent_alloc_update_peak();
+    return page;
+  }
+
+  // Large allocations don't belong to the tlsf allocator. There are usually
+  // very few of them, so a linear search is fine.
+  if ((mode == allocator_mode::RESIZE || mode == allocator_mode::FREE) &&
+      S->PersistentAllocLargePages) {
+    auto *page = find_persistent_alloc_page(oldMemory);
+    if (page) {
+      if (mode == allocator_mode::FREE) {
+        free_persistent_alloc_page(page);
+        return null;
+      }
+
+      // The mapping is rounded up to pages, so we may have room to grow
+      s64 available = os_block_size(page) - sizeof(*page);
+      return size <= available ? oldMemory : null;
+    }
   }
 
   auto *result =
       tlsf_allocator(mode, context, size, oldMemory, oldSize, options);
+
+  if (mode == allocator_mode::QUERY_STATS) {
+    auto *stats = (allocator_stats *)result;
+    stats->Used += S->PersistentAllocLargePagesSize;
+    stats->Committed += S->PersistentAllocLargePagesSize;
+    stats->PeakUsed = S->PersistentAllocPeakUsed;
+    return stats;
+  }
+
   if (mode == allocator_mode::ALLOCATE && !result) {
     platform_report_warning(
         "Not enough memory in the persistent allocator; adding another pool");
 
-    void *block =
-        create_persistent_alloc_page(PLATFORM_PERSISTENT_STORAGE_STARTING_SIZE);
-    tlsf_allocator_add_pool(&S->PersistentAllocData, block,
-                            PLATFORM_PERSISTENT_STORAGE_STARTING_SIZE);
+    if (!tlsf_allocator_add_pool(&S->PersistentAllocData,
+                                 PLATFORM_PERSISTENT_STORAGE_STARTING_SIZE,
+                                 PLATFORM_MEMORY_OPTIONS)) {
+      return null;
+    }
 
     result = tlsf_allocator(allocator_mode::ALLOCATE, context, size, null, 0,
                             options);
     assert(result);
   }
+
+  if (result && (mode == allocator_mode::ALLOCATE ||
+                 mode == allocator_mode::RESIZE)) {
+    persistent_alloc_update_peak();
+  }
   return result;
 }
 
+//
+// Platform temporary allocator, see comment above _platform_temp_ring_.
+//
+
+static const s64 PLATFORM_TEMP_RING_SIZE =
+    PLATFORM_TEMPORARY_STORAGE_STARTING_SIZE;
+
+static s64 platform_temp_round_size(s64 size) { return (size + 15) & -16; }
+
+// Frees the calling thread's overflow blocks older than _generation_
+static void platform_temp_free_overflow(u64 generation) {
+  auto **link = &PlatformTempRing.Overflow;
+  while (*link) {
+    auto *b = *link;
+    if (b->Generation < generation) {
+      *link = b->Next;
+      forget_allocations_in_range(null, b, (byte *)b + os_block_size(b));
+      os_free_block(b);
+    } else {
+      link = &b->Next;
+    }
+  }
+}
+
+// Starts a new generation at the beginning of the ring. What was left of the
+// generation before the previous one is dead now.
+static void platform_temp_wrap() {
+  auto &ring = PlatformTempRing;
+  if (ring.Block) {
+    forget_allocations_in_range(null, ring.Block + ring.Reclaimed,
+                                ring.Block + PLATFORM_TEMP_RING_SIZE);
+  }
+
+  ++ring.Generation;
+  ring.Used = 0;
+  ring.Reclaimed = 0;
+
+  platform_temp_free_overflow(ring.Generation - 1);
+}
+
+// Moves the end of the ring's used memory to _newUsed_, reclaiming memory from
+// the previous generation on the way
+static void platform_temp_advance(s64 newUsed) {
+  auto &ring = PlatformTempRing;
+  if (ring.Reclaimed < newUsed) {
+    forget_allocations_in_range(null, ring.Block + ring.Reclaimed,
+                                ring.Block + newUsed);
+    ring.Reclaimed = newUsed;
+  }
+  ring.Used = newUsed;
+}
+
+static void *platform_temp_allocate_overflow(s64 size) {
+  auto &ring = PlatformTempRing;
+
+  // Counts as a full ring's worth of allocations, see note in os/memory.h
+  platform_temp_wrap();
+
+  auto *b = (platform_temp_ring::overflow_block *)os_allocate_block(
+      sizeof(platform_temp_ring::overflow_block) + size,
+      PLATFORM_MEMORY_OPTIONS);
+  if (!b) return null;
+
+  b->Generation = ring.Generation;
+  b->Next = ring.Overflow;
+  ring.Overflow = b;
+  return b + 1;
+}
+
+void *platform_temp_alloc(allocator_mode mode, void *context, s64 size,
+                          void *oldMemory, s64 oldSize, u64 options) {
+  auto &ring = PlatformTempRing;
+
+  size = platform_temp_round_size(size);
+  oldSize = platform_temp_round_size(oldSize);
+
+  // Offset of _oldMemory_ if it's the last allocation in the ring, -1 otherwise
+  s64 lastOffset = -1;
+  if (oldMemory && ring.Block && (byte *)oldMemory >= ring.Block &&
+      (byte *)oldMemory + oldSize == ring.Block + ring.Used) {
+    lastOffset = (byte *)oldMemory - ring.Block;
+  }
+
+  switch (mode) {
+    case allocator_mode::ALLOCATE: {
+      if (size > PLATFORM_TEMP_RING_SIZE) {
+        void *result = platform_temp_allocate_overflow(size);
+        if (!result) {
+          platform_report_warning(
+              "Not enough memory for a large temporary allocation");
+        }
+        return result;
+      }
+
+      if (!ring.Block) {
+        ring.Block = (byte *)os_allocate_block(PLATFORM_TEMP_RING_SIZE,
+                                               PLATFORM_MEMORY_OPTIONS);
+        if (!ring.Block) {
+          platform_report_warning(
+              "Couldn't allocate this thread's temporary storage");
+          return null;
+        }
+      }
+
+      if (ring.Used + size > PLATFORM_TEMP_RING_SIZE) platform_temp_wrap();
+
+      void *result = ring.Block + ring.Used;
+      platform_temp_advance(ring.Used + size);
+      ring.PeakUsed = max(ring.PeakUsed, ring.Used);
+      return result;
+    }
+    case allocator_mode::RESIZE: {
+      // Only the last allocation can grow (or shrink) in place
+      if (lastOffset == -1 || lastOffset + size > PLATFORM_TEMP_RING_SIZE) {
+        return null;
+      }
+      platform_temp_advance(lastOffset + size);
+      ring.PeakUsed = max(ring.PeakUsed, ring.Used);
+      return oldMemory;
+    }
+    case allocator_mode::FREE: {
+      // Popping the last allocation is free, everything else (including
+      // overflow blocks) goes away when the ring wraps around
+      if (lastOffset != -1) ring.Used = lastOffset;
+      return null;
+    }
+    case allocator_mode::FREE_ALL: {
+      // free_all() already forgot the allocations, so just make everything
+      // look like it's from a dead generation
+      platform_temp_free_overflow((u64)-1);
+      ring.Generation += 2;
+      ring.Used = 0;
+      ring.Reclaimed = PLATFORM_TEMP_RING_SIZE;
+      return null;
+    }
+    case allocator_mode::TRIM:
+      return null;
+    case allocator_mode::QUERY_STATS: {
+      // Of the calling thread's ring
+      auto *stats = (allocator_stats *)oldMemory;
+      stats->Used = ring.Used;
+      stats->PeakUsed = ring.PeakUsed;
+
+      if (ring.Block) stats->Committed = PLATFORM_TEMP_RING_SIZE;
+      for (auto *b = ring.Overflow; b; b = b->Next) {
+        stats->Committed += os_block_size(b);
+      }
+
+      // Without wrapping around
+      s64 free = PLATFORM_TEMP_RING_SIZE - ring.Used;
+      stats->FreeBlockCount = free > 0;
+      stats->LargestFreeBlock = free;
+      return stats;
+    }
+  }
+  return null;
+}
+
+bool platform_temp_is_live(void *ptr, u64 generation) {
+  auto &ring = PlatformTempRing;
+  auto *p = (byte *)ptr;
+
+  if (ring.Block && p >= ring.Block &&
+      p < ring.Block + PLATFORM_TEMP_RING_SIZE) {
+    s64 offset = p - ring.Block;
+    if (generation == ring.Generation) return offset < ring.Used;
+    if (generation + 1 == ring.Generation) return offset >= ring.Reclaimed;
+    return false;
+  }
+
+  for (auto *b = ring.Overflow; b; b = b->Next) {
+    if (p > (byte *)b && p < (byte *)b + os_block_size(b)) {
+      return b->Generation == generation;
+    }
+  }
+  return false;
+}
+
+void platform_temp_release() {
+  auto &ring = PlatformTempRing;
+  if (ring.Block) {
+    forget_allocations_in_range(null, ring.Block,
+                                ring.Block + PLATFORM_TEMP_RING_SIZE);
+    os_free_block(ring.Block);
+  }
+  platform_temp_free_overflow((u64)-1);
+  ring = {};
+}
+
+//
+// Thread caching front end, see comment above _thread_cache_allocator_data_.
+//
+
+// A block handed out by the cache is prefixed by this tag. Caches are aligned
+// to 64 bytes so we use the low bits to store the size class (+ 1, 0 means the
+// block didn't come from a cache).
+static u64 *thread_cache_tag(void *p) { return (u64 *)p - 1; }
+
+// Cached blocks are only guaranteed to be 8 byte aligned (the shared
+// allocator's blocks offset by the tag, see the assert in
+// thread_cache_refill()). Bigger alignments are handled by general_allocate()
+// which over-allocates and bumps the pointer.
+static s64 thread_cache_size_class(s64 size) {
+  For(range(THREAD_CACHE_CLASS_COUNT)) {
+    if (size <= THREAD_CACHE_SIZE_CLASSES[it]) return it;
+  }
+  return -1;
+}
+
+static s64 thread_cache_batch_count(s64 sizeClass) {
+  s64 count = THREAD_CACHE_BATCH_BYTES / THREAD_CACHE_SIZE_CLASSES[sizeClass];
+  return clamp(count, (s64)4, (s64)64);
+}
+
+static void thread_cache_push(thread_cache *cache, s64 sizeClass, void *p) {
+  auto *b = (thread_cache::free_block *)p;
+  auto *c = &cache->Classes[sizeClass];
+  b->Next = c->Head;
+  c->Head = b;
+  c->Count += 1;
+}
+
+// Moves blocks which were freed by other threads to the local lists
+static void thread_cache_collect_remote_frees(thread_cache *cache) {
+  auto *b = atomic_swap(&cache->RemoteFrees, (thread_cache::free_block *)null);
+  while (b) {
+    auto *next = b->Next;
+    thread_cache_push(cache, (*thread_cache_tag(b) & 63) - 1, b);
+    b = next;
+  }
+}
+
+static void thread_cache_refill(thread_cache *cache, s64 sizeClass) {
+  auto *data = cache->Owner;
+  s64 blockSize = THREAD_CACHE_SIZE_CLASSES[sizeClass] + sizeof(u64);
+
+  lock(data->SharedMutex);
+  defer(unlock(data->SharedMutex));
+
+  For(range(thread_cache_batch_count(sizeClass))) {
+    auto *raw = (u64 *)data->Shared.Function(allocator_mode::ALLOCATE,
+                                             data->Shared.Context, blockSize,
+                                             null, 0, 0);
+    if (!raw) break;
+    assert(((u64)raw & 7) == 0);
+
+    *raw = (u64)cache | (u64)(sizeClass + 1);
+    thread_cache_push(cache, sizeClass, raw + 1);
+  }
+}
+
+// Gives back _count_ blocks (or less if the list doesn't have that many)
+static void thread_cache_drain(thread_cache *cache, s64 sizeClass, s64 count) {
+  auto *data = cache->Owner;
+  auto *c = &cache->Classes[sizeClass];
+  s64 blockSize = THREAD_CACHE_SIZE_CLASSES[sizeClass] + sizeof(u64);
+
+  lock(data->SharedMutex);
+  defer(unlock(data->SharedMutex));
+
+  while (c->Head && count--) {
+    auto *b = c->Head;
+    c->Head = b->Next;
+    c->Count -= 1;
+
+    data->Shared.Function(allocator_mode::FREE, data->Shared.Context, 0,
+                          thread_cache_tag(b), blockSize, 0);
+  }
+}
+
+// Returns null if this thread ran out of cache slots
+static thread_cache *thread_cache_get(thread_cache_allocator_data *data) {
+  thread_cache **emptySlot = null;
+  For(range(THREAD_CACHE_MAX_ALLOCATORS)) {
+    auto *cache = ThreadCaches[it];
+    if (cache && cache->Owner == data) return cache;
+    if (!cache && !emptySlot) emptySlot = &ThreadCaches[it];
+  }
+  if (!emptySlot) return null;
+
+  // Try to adopt a cache whose thread has exited
+  auto *cache = atomic_compare_and_swap(&data->Caches, (thread_cache *)null,
+                                        (thread_cache *)null);
+  while (cache) {
+    if (atomic_compare_and_swap(&cache->Orphaned, 1, 0) == 1) {
+      thread_cache_collect_remote_frees(cache);
+      *emptySlot = cache;
+      return cache;
+    }
+    cache = cache->NextCache;
+  }
+
+  // Allocate a new one, the caches need to be aligned to 64 bytes for the tag
+  void *raw = data->Shared.Function(allocator_mode::ALLOCATE,
+                                    data->Shared.Context,
+                                    sizeof(thread_cache) + 63, null, 0, 0);
+  if (!raw) return null;
+
+  cache = (thread_cache *)((byte *)raw + calculate_padding_for_pointer(raw, 64));
+  memset0(cache, sizeof(thread_cache));
+  cache->Owner = data;
+
+  auto *head = data->Caches;
+  while (true) {
+    cache->NextCache = head;
+    auto *old = atomic_compare_and_swap(&data->Caches, head, cache);
+    if (old == head) break;
+    head = old;
+  }
+
+  *emptySlot = cache;
+  return cache;
+}
+
+void *thread_cache_allocator(allocator_mode mode, void *context, s64 size,
+                             void *oldMemory, s64 oldSize, u64 options) {
+  auto *data = (thread_cache_allocator_data *)context;
+  auto shared = data->Shared;
+
+  switch (mode) {
+    case allocator_mode::ALLOCATE: {
+      s64 sizeClass = thread_cache_size_class(size);
+
+      // Cached blocks were allocated without options, so when the caller
+      // passes any (besides LEAK, which we don't care about) we go to the
+      // shared allocator directly.
+      thread_cache *cache = null;
+      if (sizeClass != -1 && !(options & ~LEAK)) cache = thread_cache_get(data);
+
+      if (cache) {
+        auto *c = &cache->Classes[sizeClass];
+        if (!c->Head) thread_cache_collect_remote_frees(cache);
+        if (!c->Head) thread_cache_refill(cache, sizeClass);
+        if (!c->Head) return null;
+
+        auto *b = c->Head;
+        c->Head = b->Next;
+        c->Count -= 1;
+        return b;
+      }
+
+      // Large block (or no cache available), tag it with 0
+      auto *raw = (u64 *)shared.Function(allocator_mode::ALLOCATE,
+                                         shared.Context, size + sizeof(u64),
+                                         null, 0, options);
+      if (!raw) return null;
+
+      *raw = 0;
+      return raw + 1;
+    }
+    case allocator_mode::RESIZE: {
+      u64 tag = *thread_cache_tag(oldMemory);
+      if (tag) {
+        // Cached blocks can only be resized within their size class
+        return size <= THREAD_CACHE_SIZE_CLASSES[(tag & 63) - 1] ? oldMemory
+                                                                 : null;
+      }
+
+      void *raw = thread_cache_tag(oldMemory);
+      if (!shared.Function(allocator_mode::RESIZE, shared.Context,
+                           size + sizeof(u64), raw, oldSize + sizeof(u64),
+                           options)) {
+        return null;
+      }
+      return oldMemory;
+    }
+    case allocator_mode::FREE: {
+      u64 tag = *thread_cache_tag(oldMemory);
+      if (!tag) {
+        shared.Function(allocator_mode::FREE, shared.Context, 0,
+                        thread_cache_tag(oldMemory), oldSize + sizeof(u64),
+                        options);
+        return null;
+      }
+
+      auto *owner = (thread_cache *)(tag & ~63ull);
+      s64 sizeClass = (tag & 63) - 1;
+
+      bool ours = false;
+      For(range(THREAD_CACHE_MAX_ALLOCATORS)) {
+        if (ThreadCaches[it] == owner) ours = true;
+      }
+
+      if (!ours) {
+        // Cross-thread free, give the block back to the owning cache
+        auto *b = (thread_cache::free_block *)oldMemory;
+        auto *head = owner->RemoteFrees;
+        while (true) {
+          b->Next = head;
+          auto *old = atomic_compare_and_swap(&owner->RemoteFrees, head, b);
+          if (old == head) break;
+          head = old;
+        }
+        return null;
+      }
+
+      thread_cache_push(owner, sizeClass, oldMemory);
+
+      s64 batch = thread_cache_batch_count(sizeClass);
+      if (owner->Classes[sizeClass].Count > 2 * batch) {
+        thread_cache_drain(owner, sizeClass, batch);
+      }
+      return null;
+    }
+    case allocator_mode::FREE_ALL: {
+      assert(false);  // Some allocators can't support this by design
+      return null;
+    }
+    case allocator_mode::TRIM: {
+      // Give this thread's cached blocks back first, so the shared allocator
+      // sees more empty space
+      For(range(THREAD_CACHE_MAX_ALLOCATORS)) {
+        auto *cache = ThreadCaches[it];
+        if (!cache || cache->Owner != data) continue;
+
+        thread_cache_collect_remote_frees(cache);
+        For_as(sizeClass, range(THREAD_CACHE_CLASS_COUNT)) {
+          thread_cache_drain(cache, sizeClass, cache->Classes[sizeClass].Count);
+        }
+      }
+
+      lock(data->SharedMutex);
+      defer(unlock(data->SharedMutex));
+      return shared.Function(mode, shared.Context, 0, null, 0, options);
+    }
+    case allocator_mode::QUERY_STATS: {
+      lock(data->SharedMutex);
+      defer(unlock(data->SharedMutex));
+
+      auto *stats = (allocator_stats *)shared.Function(
+          mode, shared.Context, 0, oldMemory, 0, options);
+      if (!stats) return null;
+
+      // Blocks sitting in the caches are used as far as the shared allocator
+      // is concerned, but nobody has them. Other threads may be changing
+      // their counts while we read them, so this is approximate. Blocks on
+      // the remote free lists aren't counted.
+      s64 cached = 0;
+      for (auto *cache = data->Caches; cache; cache = cache->NextCache) {
+        For(range(THREAD_CACHE_CLASS_COUNT)) {
+          s64 blockSize = THREAD_CACHE_SIZE_CLASSES[it] + sizeof(u64);
+          cached += cache->Classes[it].Count * blockSize;
+        }
+      }
+      stats->Used = max(stats->Used - cached, (s64)0);
+      return stats;
+    }
+  }
+  return null;
+}
+
+void thread_caches_release() {
+  For(range(THREAD_CACHE_MAX_ALLOCATORS)) {
+    auto *cache = ThreadCaches[it];
+    if (!cache) continue;
+
+    thread_cache_collect_remote_frees(cache);
+    For_as(sizeClass, range(THREAD_CACHE_CLASS_COUNT)) {
+      thread_cache_drain(cache, sizeClass, cache->Classes[sizeClass].Count);
+    }
+
+    ThreadCaches[it] = null;
+    atomic_swap(&cache->Orphaned, 1);
+  }
+}
+
 void platform_init_allocators() {
-  S->TempAllocMutex = create_mutex();
   S->PersistentAllocMutex = create_mutex();
 
-  S->TempAlloc = {platform_temp_alloc, &S->TempAllocData};
-
-  S->TempAllocData.Block = null;
+  // The ring is allocated on each thread's first temporary allocation
+  S->TempAlloc = {platform_temp_alloc, null};
 
-  create_new_temp_storage_block(PLATFORM_TEMPORARY_STORAGE_STARTING_SIZE);
+  S->PersistentAllocData = {};
+  S->PersistentAllocLargePages = null;
 
-  S->PersistentAllocBasePage = null;
-  S->PersistentAlloc = {platform_persistent_alloc, &S->PersistentAllocData};
+  S->PersistentAllocCache.Shared = {platform_persistent_alloc,
+                                    &S->PersistentAllocData};
+  S->PersistentAllocCache.SharedMutex = &S->PersistentAllocMutex;
+  S->PersistentAllocCache.Caches = null;
+  S->PersistentAlloc = {thread_cache_allocator, &S->PersistentAllocCache};
 
-  void *block =
-      create_persistent_alloc_page(PLATFORM_PERSISTENT_STORAGE_STARTING_SIZE);
-  tlsf_allocator_add_pool(&S->PersistentAllocData, block,
-                          PLATFORM_PERSISTENT_STORAGE_STARTING_SIZE);
+  tlsf_allocator_add_pool(&S->PersistentAllocData,
+                          PLATFORM_PERSISTENT_STORAGE_STARTING_SIZE,
+                          PLATFORM_MEMORY_OPTIONS);
 }
 
 LSTD_END_NAMESPACE
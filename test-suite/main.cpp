@@ -9,9 +9,13 @@ u32 g_AllTestsCount = 0;
 #include "tests/bits.cpp"
 #include "tests/file.cpp"
 #include "tests/fmt.cpp"
+#include "tests/hash.cpp"
+#include "tests/intern_table.cpp"
+#include "tests/memory.cpp"
 #include "tests/parse.cpp"
 #include "tests/range.cpp"
 #include "tests/signal.cpp"
+#include "tests/slot_map.cpp"
 #include "tests/storage.cpp"
 #include "tests/string.cpp"
 #include "tests/thread.cpp"
@@ -0,0 +1,256 @@
+#include "../test.h"
+
+// Small SMHasher-style checks of get_hash_bytes(), they catch broken mixing
+// (e.g. bytes which don't affect the result) rather than measure quality.
+
+static u64 hash_test_random(u64 ref state) {
+  u64 z = (state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static const s64 HASH_TEST_LENGTHS[] = {1, 3, 4, 7, 8, 15, 16, 17, 33, 48, 49, 100, 511, 512, 1000, 3000};
+
+// Runs _body_ once with every implementation of get_hash_long() the CPU supports
+template <typename F>
+void for_each_hash_functions_impl(F body) {
+  auto best = hash_functions_set_impl(hash_functions_impl::AVX2);
+  For(range((s32) best + 1)) {
+    hash_functions_set_impl((hash_functions_impl) it);
+    body();
+  }
+  hash_functions_set_impl(best);
+}
+
+// Runs _body_ with get_hash_bytes() on long inputs using get_hash_rapid(),
+// and then get_hash_long() with every implementation. Which one it uses by
+// default depends on the CPU, this way both are tested everywhere.
+template <typename F>
+void for_each_hash_bytes_choice(F body) {
+  bool useLong = hash_bytes_set_use_long(false);
+  body();
+
+  hash_bytes_set_use_long(true);
+  for_each_hash_functions_impl(body);
+
+  hash_bytes_set_use_long(useLong);
+}
+
+TEST(hash_xxhash64_reads_every_block) {
+  // Used to read the 32 byte blocks at offsets 0, 4, 8... instead of 0, 32, 64...
+  byte a[96] = {}, b[96] = {};
+  b[70] = 1;
+  assert_true(get_hash_xxhash64(a, 96) != get_hash_xxhash64(b, 96));
+
+  b[70] = 0, b[40] = 1;
+  assert_true(get_hash_xxhash64(a, 96) != get_hash_xxhash64(b, 96));
+}
+
+TEST(hash_implementations_agree) {
+  byte data[5000];
+  u64 state = 1;
+  For(range(5000)) data[it] = (byte) hash_test_random(state);
+
+  s64 lengths[] = {65, 127, 128, 129, 1023, 1024, 1025, 2048, 4999};
+  u64 expected[9][2];
+
+  hash_functions_set_impl(hash_functions_impl::SCALAR);
+  For(range(9)) {
+    expected[it][0] = get_hash_long(data, lengths[it]);
+    expected[it][1] = get_hash_long(data, lengths[it], 12345);
+  }
+
+  for_each_hash_functions_impl([&]() {
+    bool ok = true;
+    For(range(9)) {
+      ok = ok && get_hash_long(data, lengths[it]) == expected[it][0];
+      ok = ok && get_hash_long(data, lengths[it], 12345) == expected[it][1];
+    }
+    assert_true(ok);
+  });
+}
+
+TEST(hash_avalanche) {
+  // Flipping any input bit should flip every output bit half of the time
+  byte key[3000];
+  u64 state = 2;
+
+  For_as(len, HASH_TEST_LENGTHS) {
+    // 1 byte keys only have 2048 different flips, too few to measure
+    if (len == 1) continue;
+
+    // Short keys get every bit flipped, long keys 64 bits spread over the
+    // whole key (including the last one), so every length gets 2560 trials
+    s64 bits = min(len * 8, 64ll);
+    s64 flips[64] = {};
+    s64 trials = 0;
+
+    For(range(2560 / bits)) {
+      For_as(i, range(len)) key[i] = (byte) hash_test_random(state);
+      u64 h = get_hash_bytes(key, len);
+
+      For_as(j, range(bits)) {
+        s64 bit = j;
+        if (bits < len * 8) {
+          bit = j == bits - 1 ? len * 8 - 1 : (s64) (hash_test_random(state) % (u64) (len * 8));
+        }
+        key[bit / 8] ^= (byte) (1 << (bit % 8));
+        u64 diff = h ^ get_hash_bytes(key, len);
+        key[bit / 8] ^= (byte) (1 << (bit % 8));
+
+        For_as(k, range(64)) flips[k] += (diff >> k) & 1;
+        ++trials;
+      }
+    }
+
+    // The bounds are about 5 standard deviations
+    s64 worst = 0;
+    For(range(64)) worst = max(worst, abs(flips[it] * 2 - trials));
+    assert_true(worst < trials / 10);
+  }
+}
+
+TEST(hash_no_collisions) {
+  // Sequential keys, as strings and as raw integers
+  hash_set<u64> seen;
+  defer(free(seen));
+
+  For(range(50000)) {
+    string s = sprint("key{}", it);
+    defer(free(s));
+    assert_true(add(seen, get_hash(s)));
+
+    u64 n = it;
+    assert_true(add(seen, get_hash_bytes((const byte *) &n, sizeof(n))));
+  }
+
+  // Sparse keys: all zeros except for one or two bits, of a few lengths.
+  // Some of these are the same bytes as the integers above.
+  free(seen);
+  byte key[600] = {};
+  For_as(len, range(8, 600, 37)) {
+    For_as(a, range(len * 8)) {
+      key[a / 8] ^= (byte) (1 << (a % 8));
+      assert_true(add(seen, get_hash_bytes(key, len)));
+
+      if (len <= 16) {
+        For_as(b, range(a + 1, len * 8)) {
+          key[b / 8] ^= (byte) (1 << (b % 8));
+          assert_true(add(seen, get_hash_bytes(key, len)));
+          key[b / 8] ^= (byte) (1 << (b % 8));
+        }
+      }
+      key[a / 8] ^= (byte) (1 << (a % 8));
+    }
+  }
+
+  // Same bytes, different lengths
+  memset(key, 0xAB, sizeof(key));
+  For(range(600)) assert_true(add(seen, get_hash_bytes(key, it)));
+}
+
+TEST(hash_seeds) {
+  byte key[1000];
+  For(range(1000)) key[it] = (byte) it;
+
+  For_as(len, HASH_TEST_LENGTHS) {
+    if (len > 1000) continue;
+    u64 a = get_hash_bytes(key, len, 1), b = get_hash_bytes(key, len, 2);
+    assert_true(a != b);
+    assert_true(a != get_hash_bytes(key, len));
+    assert_eq(a, get_hash_bytes(key, len, 1));
+  }
+}
+
+TEST(hash_strings_and_arrays) {
+  string s = "Hello, world!";
+  assert_eq(get_hash(s), get_hash_bytes((const byte *) s.Data, s.Count));
+  assert_eq(get_hash(s), get_hash(string("Hello, world!")));
+
+  array<s32> a;
+  defer(free(a));
+  add(a, {1, 2, 3, 4});
+  assert_eq(get_hash(a), get_hash_bytes((const byte *) a.Data, 16));
+}
+
+TEST(hash_state_chunk_boundaries) {
+  byte data[5000];
+  u64 state = 3;
+  For(range(5000)) data[it] = (byte) hash_test_random(state);
+
+  s64 lengths[] = {0, 1, 17, 100, 1023, 1024, 1025, 2047, 2048, 2049, 2100, 3000, 5000};
+  s64 chunks[] = {1, 7, 48, 64, 100, 1000, 1025, 5000};
+
+  for_each_hash_bytes_choice([&]() {
+    bool ok = true;
+    For_as(len, lengths) {
+      For_as(seed, range(2)) {
+        u64 expected = get_hash_bytes(data, len, seed * 12345);
+
+        For_as(chunk, chunks) {
+          hash_state h;
+          hash_init(h, seed * 12345);
+          for (s64 i = 0; i < len; i += chunk) hash_update(h, data + i, min(chunk, len - i));
+          ok = ok && hash_finalize(h) == expected;
+        }
+
+        // Chunks of varying sizes
+        hash_state h;
+        hash_init(h, seed * 12345);
+        for (s64 i = 0, n = 0; i < len; i += n) {
+          n = min((s64) (hash_test_random(state) % 200), len - i);
+          hash_update(h, data + i, n);
+        }
+        ok = ok && hash_finalize(h) == expected;
+      }
+    }
+    assert_true(ok);
+  });
+}
+
+TEST(hash_state_finalize_and_continue) {
+  byte data[3000];
+  For(range(3000)) data[it] = (byte) (it * 13);
+
+  for_each_hash_bytes_choice([&]() {
+    hash_state h;
+    hash_init(h);
+    hash_update(h, data, 2000);
+    assert_eq(hash_finalize(h), get_hash_bytes(data, 2000));
+
+    hash_update(h, data + 2000, 1000);
+    assert_eq(hash_finalize(h), get_hash_bytes(data, 3000));
+  });
+}
+
+TEST(hash_bytes_use_long) {
+  byte data[3000];
+  For(range(3000)) data[it] = (byte) (it * 7);
+
+  bool useLong = hash_bytes_set_use_long(false);
+  assert_eq(get_hash_bytes(data, 3000, 5), get_hash_rapid(data, 3000, 5));
+
+  hash_bytes_set_use_long(true);
+  assert_eq(get_hash_bytes(data, 3000, 5), get_hash_long(data, 3000, 5));
+
+  hash_bytes_set_use_long(useLong);
+  assert_eq(hash_bytes_get_use_long(), useLong);
+}
+
+TEST(hash_string_builder) {
+  string_builder builder;
+  defer(free(builder));
+
+  // Spans the stack chunk and a few allocated ones
+  For(range(500)) add(builder, "Hello, world! ");
+
+  string flat = builder_to_string(builder);
+  defer(free(flat));
+  assert_eq(get_hash(builder), get_hash(flat));
+
+  string_builder small;
+  defer(free(small));
+  add(small, "abc");
+  assert_eq(get_hash(small), get_hash(string("abc")));
+}
@@ -0,0 +1,83 @@
+#include "../test.h"
+
+#include "lstd/intern_table.h"
+
+TEST(intern_table) {
+  intern_table names;
+  defer(free(names));
+
+  u32 foo = intern(names, "foo");
+  u32 bar = intern(names, "bar");
+  assert_eq(foo, 0);
+  assert_eq(bar, 1);
+  assert_eq(intern_count(names), 2);
+
+  // Interning an equal string (from a different buffer) gives the same atom
+  char buffer[] = "foo";
+  assert_eq(intern(names, string(buffer, 3)), foo);
+  buffer[0] = 'g';
+  assert_eq_str(intern_get(names, foo), "foo");
+
+  assert_eq(intern_search(names, "bar"), bar);
+  assert_eq(intern_search(names, "baz"), -1);
+  assert_eq(intern_count(names), 2);
+
+  // Enough strings to span many chunks, the old ones don't move
+  string first = intern_get(names, foo);
+  For(range(5000)) {
+    string s = sprint("name_{}", it);
+    assert_eq(intern(names, s), it + 2);
+    free(s);
+  }
+  assert_true(intern_get(names, foo).Data == first.Data);
+
+  For(range(5000)) {
+    string s = sprint("name_{}", it);
+    assert_eq_str(intern_get(names, (u32) it + 2), s);
+    assert_eq(intern(names, s), it + 2);
+    free(s);
+  }
+  assert_eq(intern_count(names), 5002);
+}
+
+static concurrent_intern_table SharedNames;
+static array<string> SharedNamesInput;
+static s32 SharedNamesErrors = 0;
+
+// Every thread interns the same names, they must all agree on the atoms
+static void thread_intern_names(void *) {
+  For(SharedNamesInput) {
+    u32 atom = intern(SharedNames, it);
+    if (!strings_match(intern_get(SharedNames, atom), it)) {
+      atomic_inc(&SharedNamesErrors);
+    }
+  }
+}
+
+TEST(concurrent_intern_table) {
+  SharedNamesErrors = 0;
+  defer(free(SharedNames));
+
+  // Made here, threads don't share our allocator
+  SharedNamesInput = {};
+  For(range(1000)) add(SharedNamesInput, sprint("name_{}", it));
+  defer({
+    For(SharedNamesInput) free(it);
+    free(SharedNamesInput);
+  });
+
+  array<thread> threads;
+  defer(free(threads.Data));
+
+  For(range(8)) add(threads, create_and_launch_thread(thread_intern_names));
+  For(threads) { wait(it); }
+
+  assert_eq(SharedNamesErrors, 0);
+  assert_eq(intern_count(SharedNames), 1000);
+
+  // Atoms are dense and each maps back to its string
+  For(range(1000)) {
+    string name = intern_get(SharedNames, (u32) it);
+    assert_eq(intern_search(SharedNames, name), it);
+  }
+}
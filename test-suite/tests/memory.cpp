@@ -0,0 +1,1012 @@
+#include "../test.h"
+
+#if OS != WINDOWS
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+
+TEST(thread_cache_reuse) {
+  auto *a = malloc<byte>({.Count = 40, .Alloc = platform_get_persistent_allocator()});
+  free(a);
+
+  // The block goes back to this thread's cache, so we get it again
+  auto *b = malloc<byte>({.Count = 40, .Alloc = platform_get_persistent_allocator()});
+  assert_eq((void *)a, (void *)b);
+  free(b);
+
+  // Large blocks bypass the cache
+  auto *c = malloc<byte>({.Count = 4_KiB, .Alloc = platform_get_persistent_allocator()});
+  c[0] = 1;
+  c[4_KiB - 1] = 2;
+  free(c);
+}
+
+static thread_cache_allocator_data *TestCache;
+static void *TestCacheBlocks[100];
+
+static void thread_cache_free_remote(void *) {
+  // Calls the allocator directly because in DEBUG_MEMORY general_free
+  // doesn't allow freeing blocks of other threads.
+  For(TestCacheBlocks) {
+    thread_cache_allocator(allocator_mode::FREE, TestCache, 0, it, 64, 0);
+  }
+}
+
+TEST(thread_cache_cross_thread_free) {
+  TestCache = &((platform_memory_state *)PlatformMemoryState)->PersistentAllocCache;
+
+  For(TestCacheBlocks) {
+    it = thread_cache_allocator(allocator_mode::ALLOCATE, TestCache, 64, null, 0, 0);
+    assert_true(it != null);
+  }
+
+  thread t = create_and_launch_thread(thread_cache_free_remote);
+  wait(t);
+
+  thread_cache *ours = null;
+  For(ThreadCaches) {
+    if (it && it->Owner == TestCache) ours = it;
+  }
+  assert_true(ours != null);
+
+  // All blocks should have been pushed to our remote free list
+  s64 remote = 0;
+  for (auto *b = ours->RemoteFrees; b; b = b->Next) ++remote;
+  assert_eq(remote, 100);
+
+  // .. and we should get them back once our local list runs dry
+  void *again[400];
+
+  s64 returned = 0;
+  For(again) {
+    it = thread_cache_allocator(allocator_mode::ALLOCATE, TestCache, 64, null, 0, 0);
+    For_as(b, TestCacheBlocks) {
+      if (b == it) ++returned;
+    }
+  }
+  assert_eq(returned, 100);
+
+  For(again) {
+    thread_cache_allocator(allocator_mode::FREE, TestCache, 0, it, 64, 0);
+  }
+}
+
+TEST(thread_cache_stats) {
+  auto *cache = &((platform_memory_state *)PlatformMemoryState)->PersistentAllocCache;
+  allocator alloc = {thread_cache_allocator, cache};
+
+  allocator_stats before, during, after;
+  assert_true(query_stats(alloc, &before));
+
+  void *blocks[100];
+  For(blocks) it = thread_cache_allocator(allocator_mode::ALLOCATE, cache, 40, null, 0, 0);
+
+  assert_true(query_stats(alloc, &during));
+  assert_true(during.Used >= before.Used + 100 * 40);
+
+  // Freed blocks stay in the cache, but they aren't used anymore
+  For(blocks) thread_cache_allocator(allocator_mode::FREE, cache, 0, it, 40, 0);
+  assert_true(query_stats(alloc, &after));
+  assert_true(after.Used <= during.Used - 100 * 40);
+}
+
+static void thread_cache_stress(void *) {
+  PUSH_ALLOC(platform_get_persistent_allocator()) {
+    array<byte *> blocks;
+    defer(free(blocks.Data));
+
+    For(range(2000)) {
+      auto *p = malloc<byte>({.Count = 16 + it % 700});
+      p[0] = (byte)it;
+      add(blocks, p);
+
+      if (it % 3 == 0) {
+        free(blocks[0]);
+        remove_unordered_at_index(blocks, 0);
+      }
+    }
+    For(blocks) free(it);
+  }
+}
+
+TEST(thread_cache_many_threads) {
+  array<thread> threads;
+  defer(free(threads.Data));
+
+  For(range(16)) { add(threads, create_and_launch_thread(thread_cache_stress)); }
+  For(threads) { wait(it); }
+}
+
+TEST(virtual_arena_grows_on_demand) {
+  arena_allocator_data data;
+  defer(arena_allocator_release(&data));
+
+  data.HighWaterMark = 256_KiB;
+
+  allocator alloc = {arena_allocator, &data};
+
+  // Allocate way past the first commit
+  auto *a = (byte *) alloc.Function(allocator_mode::ALLOCATE, &data, 3_MiB, null, 0, 0);
+  assert_true(a != null);
+  assert_true(data.Virtual);
+  assert_ge(data.Committed, 3_MiB);
+  a[0] = 1;
+  a[3_MiB - 1] = 2;
+
+  // Resizing the last allocation commits too
+  assert_eq((void *) alloc.Function(allocator_mode::RESIZE, &data, 5_MiB, a, 3_MiB, 0), (void *) a);
+  assert_ge(data.Committed, 5_MiB);
+  a[5_MiB - 1] = 3;
+
+  // free_all decommits down to the high-water mark
+  alloc.Function(allocator_mode::FREE_ALL, &data, 0, null, 0, 0);
+  assert_eq(data.Used, 0);
+  assert_eq(data.Committed, 256_KiB);
+
+  // .. and the memory is usable again
+  auto *b = (byte *) alloc.Function(allocator_mode::ALLOCATE, &data, 1_MiB, null, 0, 0);
+  assert_eq((void *) b, (void *) a);
+  b[1_MiB - 1] = 4;
+}
+
+TEST(virtual_arena_reserve_limit) {
+  arena_allocator_data data;
+  assert_true(arena_allocator_reserve(&data, 1_MiB));
+  defer(arena_allocator_release(&data));
+
+  assert_true(arena_allocator(allocator_mode::ALLOCATE, &data, 512_KiB, null, 0, 0) != null);
+  assert_true(arena_allocator(allocator_mode::ALLOCATE, &data, 1_MiB, null, 0, 0) == null);
+}
+
+TEST(os_block_page_options) {
+  // Huge pages are a hint, but the block is usable (and rounded up to whole
+  // huge pages) whether we got them or not
+  auto *a = (byte *) os_allocate_block(3_MiB, OS_ALLOCATE_HUGE_PAGES | OS_ALLOCATE_POPULATE);
+  assert_true(a != null);
+  assert_ge(os_block_size(a), 3_MiB);
+  a[0] = 1;
+  a[os_block_size(a) - 1] = 2;
+  os_free_block(a);
+
+  auto *b = (byte *) os_allocate_block(64_KiB, OS_ALLOCATE_POPULATE);
+  assert_true(b != null);
+  b[64_KiB - 1] = 3;
+  os_free_block(b);
+
+  tlsf_allocator_data tlsf;
+  assert_true(tlsf_allocator_add_pool(&tlsf, 1_MiB, OS_ALLOCATE_POPULATE));
+  assert_true(tlsf_allocator(allocator_mode::ALLOCATE, &tlsf, 512_KiB, null, 0, 0) != null);
+  tlsf_allocator_release(&tlsf);
+}
+
+TEST(os_block_decommit) {
+  auto *a = (byte *) os_allocate_block(256_KiB);
+  assert_ge(os_block_size(a), 256_KiB);
+  defer(os_free_block(a));
+
+  // Pages inside the block can be given back and recommitted, they come back zeroed
+  byte *pages = (byte *) (((u64) a + 64_KiB - 1) & -64_KiB);
+  pages[0] = 1;
+  os_decommit_block(pages, 64_KiB);
+  assert_true(os_recommit_block(pages, 64_KiB));
+  assert_eq(pages[0], 0);
+  pages[64_KiB - 1] = 2;
+}
+
+TEST(tlsf_trim) {
+  tlsf_allocator_data tlsf;
+  defer(tlsf_allocator_release(&tlsf));
+
+  assert_true(tlsf_allocator_add_pool(&tlsf, 256_KiB, 0));
+  assert_true(tlsf_allocator_add_pool(&tlsf, 256_KiB, 0));
+  assert_true(tlsf_allocator_add_pool(&tlsf, 256_KiB, 0));
+
+  auto count_pools = [&]() {
+    s64 count = 0;
+    for (auto *p = tlsf.OSPools; p; p = p->Next) ++count;
+    return count;
+  };
+
+  // Each of these needs a pool of its own, so no pool is empty
+  void *blocks[3];
+  For(range(3)) {
+    blocks[it] = tlsf_allocator(allocator_mode::ALLOCATE, &tlsf, 200_KiB, null, 0, 0);
+    assert_true(blocks[it] != null);
+  }
+
+  trim({tlsf_allocator, &tlsf});
+  assert_eq(count_pools(), 3);
+
+  For(range(3)) tlsf_allocator(allocator_mode::FREE, &tlsf, 0, blocks[it], 0, 0);
+
+  // All but the pool which holds the control structure go
+  trim({tlsf_allocator, &tlsf});
+  assert_eq(count_pools(), 1);
+
+  // Still usable
+  assert_true(tlsf_allocator(allocator_mode::ALLOCATE, &tlsf, 1_KiB, null, 0, 0) != null);
+}
+
+TEST(arena_trim) {
+  arena_allocator_data data;
+  defer(arena_allocator_release(&data));
+
+  data.HighWaterMark = 4_MiB;
+
+  assert_true(arena_allocator(allocator_mode::ALLOCATE, &data, 1_KiB, null, 0, 0) != null);
+
+  auto mark = arena_mark(&data);
+  assert_true(arena_allocator(allocator_mode::ALLOCATE, &data, 3_MiB, null, 0, 0) != null);
+  arena_restore(mark);
+
+  // The high-water mark keeps memory committed on free_all, but trim doesn't care
+  assert_ge(data.Committed, 3_MiB);
+  trim({arena_allocator, &data});
+  assert_eq(data.Committed, ARENA_COMMIT_GRANULARITY);
+}
+
+TEST(persistent_allocator_large_blocks) {
+  allocator alloc = platform_get_persistent_allocator();
+
+  // Large blocks go to the OS directly, freeing them mustn't touch the tlsf allocator
+  auto *a = malloc<byte>({.Count = 2_MiB, .Alloc = alloc});
+  a[2_MiB - 1] = 1;
+  auto *b = malloc<byte>({.Count = 3_MiB, .Alloc = alloc});
+  b[0] = 2;
+
+  a = realloc(a, {.NewCount = 4_MiB});
+  assert_eq(a[2_MiB - 1], 1);
+  a[4_MiB - 1] = 3;
+
+  free(a);
+  free(b);
+
+  trim(alloc);
+}
+
+TEST(virtual_arena_huge_pages) {
+  arena_allocator_data data;
+  data.PageOptions = OS_ALLOCATE_HUGE_PAGES | OS_ALLOCATE_POPULATE;
+  defer(arena_allocator_release(&data));
+
+  auto *a = (byte *) arena_allocator(allocator_mode::ALLOCATE, &data, 100, null, 0, 0);
+  assert_true(a != null);
+  assert_eq(data.Committed, OS_HUGE_PAGE_SIZE);
+  a[OS_HUGE_PAGE_SIZE - 1] = 1;
+}
+
+TEST(virtual_arena_huge_page_alignment) {
+  // Huge pages only back aligned ranges, so the arena has to start at one
+  arena_allocator_data data;
+  data.PageOptions = OS_ALLOCATE_HUGE_PAGES;
+  defer(arena_allocator_release(&data));
+
+  assert_true(arena_allocator_reserve(&data, 16_MiB));
+  assert_eq((u64)data.Block % OS_HUGE_PAGE_SIZE, 0);
+  assert_eq(data.Size, 16_MiB);
+  assert_true((byte *)data.Block + data.Size <= (byte *)data.ReservedBlock + data.ReservedSize);
+
+  auto *a = (byte *) arena_allocator(allocator_mode::ALLOCATE, &data, 100, null, 0, 0);
+  assert_true(a == data.Block);
+}
+
+TEST(platform_temp_ring) {
+  allocator temp = platform_get_temporary_allocator();
+
+  // Start from the beginning of the ring
+  free_all(temp);
+
+  auto *first = malloc<byte>({.Count = 100, .Alloc = temp});
+  u64 generation = platform_temp_generation();
+  assert_true(platform_temp_is_live(first, generation));
+
+  // Memory stays valid until the ring wraps around and reuses it, and the
+  // last allocation before wrapping survives the wrap
+  byte *beforeWrap = null, *last = first;
+  s64 made = 0;
+  while (platform_temp_generation() == generation) {
+    beforeWrap = last;
+    last = malloc<byte>({.Count = 1000, .Alloc = temp});
+    last[0] = 42;
+    ++made;
+  }
+  assert_true(made > 1);
+  assert_true(!platform_temp_is_live(first, generation));
+  assert_true(platform_temp_is_live(last, generation + 1));
+
+  assert_true(platform_temp_is_live(beforeWrap, generation));
+  assert_eq(beforeWrap[0], 42);
+}
+
+TEST(platform_temp_overflow) {
+  allocator temp = platform_get_temporary_allocator();
+
+  // Requests larger than the ring get their own block, which lives for
+  // two generations
+  auto *big = malloc<byte>({.Count = 1_MiB, .Alloc = temp});
+  u64 generation = platform_temp_generation();
+  big[1_MiB - 1] = 7;
+
+  auto *big2 = malloc<byte>({.Count = 1_MiB, .Alloc = temp});
+  assert_true(platform_temp_is_live(big, generation));
+  assert_true(platform_temp_is_live(big2, generation + 1));
+  assert_eq(big[1_MiB - 1], 7);
+
+  malloc<byte>({.Count = 1_MiB, .Alloc = temp});
+  assert_true(!platform_temp_is_live(big, generation));
+  assert_true(platform_temp_is_live(big2, generation + 1));
+}
+
+static s32 TestTempRingErrors;
+
+static void platform_temp_stress(void *) {
+  allocator temp = platform_get_temporary_allocator();
+
+  For(range(5000)) {
+    s64 count = 16 + it % 300;
+    auto *p = malloc<byte>({.Count = count, .Alloc = temp});
+    memset(p, (byte)it, count);
+
+    // Another thread writing to our memory would show up here
+    For_as(i, range(count)) {
+      if (p[i] != (byte)it) {
+        atomic_inc(&TestTempRingErrors);
+        break;
+      }
+    }
+  }
+}
+
+TEST(platform_temp_per_thread) {
+  array<thread> threads;
+  defer(free(threads.Data));
+
+  For(range(8)) { add(threads, create_and_launch_thread(platform_temp_stress)); }
+  For(threads) { wait(it); }
+
+  assert_eq(TestTempRingErrors, 0);
+}
+
+TEST(allocator_stats_tlsf) {
+  tlsf_allocator_data tlsf;
+  defer(tlsf_allocator_release(&tlsf));
+
+  assert_true(tlsf_allocator_add_pool(&tlsf, 256_KiB, 0));
+  allocator alloc = {tlsf_allocator, &tlsf};
+
+  allocator_stats stats;
+  assert_true(query_stats(alloc, &stats));
+  assert_eq(stats.Used, 0);
+  assert_true(stats.Committed >= 256_KiB - 4_KiB);
+  assert_eq(stats.FreeBlockCount, 1);
+  assert_eq(stats.LargestFreeBlock, stats.Committed);
+
+  void *blocks[10];
+  For(range(10)) blocks[it] = alloc.Function(allocator_mode::ALLOCATE, &tlsf, 1_KiB, null, 0, 0);
+
+  // Free every other block, which leaves holes
+  for (s64 i = 0; i < 10; i += 2) alloc.Function(allocator_mode::FREE, &tlsf, 0, blocks[i], 0, 0);
+
+  query_stats(alloc, &stats);
+  assert_true(stats.Used >= 5 * 1_KiB && stats.Used < 6 * 1_KiB);
+  assert_true(stats.PeakUsed >= 10 * 1_KiB);
+  assert_eq(stats.FreeBlockCount, 6);
+  assert_true(stats.LargestFreeBlock > stats.Committed - 10 * 1_KiB - 1_KiB);
+
+  for (s64 i = 1; i < 10; i += 2) alloc.Function(allocator_mode::FREE, &tlsf, 0, blocks[i], 0, 0);
+
+  query_stats(alloc, &stats);
+  assert_eq(stats.Used, 0);
+  assert_eq(stats.FreeBlockCount, 1);
+}
+
+TEST(allocator_stats_arena_and_pool) {
+  arena_allocator_data arena;
+  defer(arena_allocator_release(&arena));
+  allocator arenaAlloc = {arena_allocator, &arena};
+
+  allocator_stats stats;
+  assert_true(query_stats(arenaAlloc, &stats));
+  assert_eq(stats.Used, 0);
+
+  arena_allocator(allocator_mode::ALLOCATE, &arena, 100_KiB, null, 0, 0);
+  free_all(arenaAlloc);
+  arena_allocator(allocator_mode::ALLOCATE, &arena, 1_KiB, null, 0, 0);
+
+  query_stats(arenaAlloc, &stats);
+  assert_eq(stats.Used, 1_KiB);
+  assert_eq(stats.PeakUsed, 100_KiB);
+  assert_true(stats.Committed >= 100_KiB);
+  assert_eq(stats.FreeBlockCount, 1);
+
+  pool_allocator_data pool;
+  pool.ElementSize = 32;
+
+  byte storage[sizeof(pool_allocator_data::block) + 8 * 32];
+  pool_allocator_provide_block(&pool, storage, sizeof(storage));
+  allocator poolAlloc = {pool_allocator, &pool};
+
+  void *chunks[3];
+  For(range(3)) chunks[it] = pool_allocator(allocator_mode::ALLOCATE, &pool, 32, null, 0, 0);
+  pool_allocator(allocator_mode::FREE, &pool, 0, chunks[0], 32, 0);
+
+  assert_true(query_stats(poolAlloc, &stats));
+  assert_eq(stats.Used, 2 * 32);
+  assert_eq(stats.PeakUsed, 3 * 32);
+  assert_eq(stats.Committed, 8 * 32);
+  assert_eq(stats.FreeBlockCount, 6);
+  assert_eq(stats.LargestFreeBlock, 32);
+}
+
+TEST(allocator_stats_platform) {
+  allocator_stats stats;
+
+  // The persistent allocator always has at least the stats of its first pool
+  assert_true(query_stats(platform_get_persistent_allocator(), &stats));
+  assert_true(stats.Committed >= stats.Used);
+  assert_true(stats.PeakUsed >= stats.Used);
+  assert_true(stats.LargestFreeBlock > 0);
+
+  allocator temp = platform_get_temporary_allocator();
+  free_all(temp);
+  malloc<byte>({.Count = 500, .Alloc = temp});
+
+  assert_true(query_stats(temp, &stats));
+  assert_true(stats.Used >= 500);
+  assert_true(stats.Committed > stats.Used);
+
+  // No stats for the concurrent pool
+  concurrent_pool_allocator_data concurrentPool;
+  assert_true(!query_stats({concurrent_pool_allocator, &concurrentPool}, &stats));
+}
+
+TEST(electric_fence_allocator) {
+  electric_fence_allocator_data fence;
+  defer(electric_fence_allocator_release(&fence));
+
+  s64 pageSize = os_get_page_size();
+
+  // Alternates between ending right before the guard page and starting right
+  // after it
+  s64 flushEnds = 0, flushStarts = 0;
+  For(range(4)) {
+    auto *p = (byte *)electric_fence_allocator(allocator_mode::ALLOCATE, &fence, 100, null, 0, 0);
+    assert_true(p != null);
+    memset(p, 0xAB, 100);
+
+    if (((u64)p & (pageSize - 1)) == 0) {
+      ++flushStarts;
+    } else if (((u64)(p + 100) & (pageSize - 1)) == 0) {
+      ++flushEnds;
+    }
+    electric_fence_allocator(allocator_mode::FREE, &fence, 0, p, 100, 0);
+  }
+  assert_eq(flushEnds, 2);
+  assert_eq(flushStarts, 2);
+
+  // Many live blocks at once, freed out of order
+  byte *blocks[600];
+  For(range(600)) {
+    blocks[it] = (byte *)electric_fence_allocator(allocator_mode::ALLOCATE, &fence, it + 1, null, 0, 0);
+    blocks[it][it] = (byte)it;
+  }
+  For(range(600)) {
+    s64 i = (it * 7) % 600;
+    assert_eq(blocks[i][i], (byte)i);
+    electric_fence_allocator(allocator_mode::FREE, &fence, 0, blocks[i], i + 1, 0);
+  }
+  assert_eq(fence.LiveCount, 0);
+
+  // Works through the general allocation functions
+  PUSH_ALLOC(allocator(electric_fence_allocator, &fence)) {
+    array<s64> numbers;
+    For(range(1000)) add(numbers, it);
+    assert_eq(numbers[999], 999);
+
+    allocator_stats stats;
+    assert_true(query_stats(allocator(electric_fence_allocator, &fence), &stats));
+    assert_true(stats.Used >= 1000 * (s64)sizeof(s64));
+
+    free(numbers.Data);
+
+    query_stats(allocator(electric_fence_allocator, &fence), &stats);
+    assert_eq(stats.Used, 0);
+    assert_eq(stats.Committed, 0);
+  }
+}
+
+TEST(electric_fence_quarantine) {
+  electric_fence_allocator_data fence;
+  fence.QuarantineSize = 4;
+  defer(electric_fence_allocator_release(&fence));
+
+  // Wraps around the ring, evicting the oldest blocks
+  For(range(10)) {
+    auto *p = electric_fence_allocator(allocator_mode::ALLOCATE, &fence, 64, null, 0, 0);
+    electric_fence_allocator(allocator_mode::FREE, &fence, 0, p, 64, 0);
+  }
+  assert_true(fence.Quarantine != null);
+  assert_eq(fence.QuarantineNext, 10 % 4);
+
+  // TRIM releases the quarantine, the next free starts a new one
+  electric_fence_allocator(allocator_mode::TRIM, &fence, 0, null, 0, 0);
+  assert_true(fence.Quarantine == null);
+
+  auto *p = electric_fence_allocator(allocator_mode::ALLOCATE, &fence, 64, null, 0, 0);
+  electric_fence_allocator(allocator_mode::FREE, &fence, 0, p, 64, 0);
+  assert_true(fence.Quarantine != null);
+  assert_eq(fence.QuarantineNext, 1);
+}
+
+#if OS != WINDOWS
+TEST(electric_fence_one_byte_overflow) {
+  electric_fence_allocator_data fence;
+  fence.Guard = electric_fence_guard::AFTER;
+  defer(electric_fence_allocator_release(&fence));
+
+  // Not a multiple of 16 (or 8), the block still ends right at the guard
+  auto *p = (byte *)electric_fence_allocator(allocator_mode::ALLOCATE, &fence, 37, null, 0, 0);
+  p[36] = 1;
+
+  // Write one byte past the end in a child process, it should die
+  pid_t child = fork();
+  if (child == 0) {
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGBUS, SIG_DFL);
+    ((volatile byte *)p)[37] = 1;
+    _exit(0);
+  }
+
+  int status = 0;
+  waitpid(child, &status, 0);
+  assert_true(WIFSIGNALED(status));
+
+  electric_fence_allocator(allocator_mode::FREE, &fence, 0, p, 37, 0);
+}
+#endif
+
+TEST(arena_checkpoints) {
+  arena_allocator_data data;
+  defer(arena_allocator_release(&data));
+
+  allocator alloc = {arena_allocator, &data};
+  defer(free_all(alloc));
+
+  auto *outer = malloc<s64>({.Alloc = alloc});
+  *outer = 42;
+
+  s64 usedBefore = data.Used;
+
+  byte *first;
+  {
+    PUSH_ARENA_SCOPE(&data);
+    first = malloc<byte>({.Count = 1000, .Alloc = alloc});
+    malloc<byte>({.Count = 2000, .Alloc = alloc});
+    assert_gt(data.Used, usedBefore);
+  }
+  assert_eq(data.Used, usedBefore);
+
+  // The popped memory is handed out again (and DEBUG_MEMORY doesn't complain
+  // about it still being live)
+  auto *again = malloc<byte>({.Count = 1000, .Alloc = alloc});
+  assert_eq((void *)again, (void *)first);
+  assert_eq(*outer, 42);
+}
+
+static string scratch_make_result(allocator out) {
+  PUSH_SCRATCH(scratch, out);
+  assert_true(scratch.Alloc != out);
+
+  // Temporaries go in the scratch arena, the result in _out_
+  string temp;
+  PUSH_ALLOC(scratch.Alloc) {
+    For(range(100)) add(temp, 'a');
+  }
+
+  string result;
+  PUSH_ALLOC(out) { result = clone(temp); }
+  return result;
+}
+
+TEST(scratch_arenas_dont_alias) {
+  PUSH_SCRATCH(outer);
+
+  // The callee gets the other scratch arena, so popping its temporaries
+  // doesn't free our result
+  string result = scratch_make_result(outer.Alloc);
+  assert_eq(length(result), 100);
+  assert_eq(result[99], 'a');
+
+  auto *inner = (arena_allocator_data *)outer.Alloc.Context;
+  assert_gt(inner->Used, outer.Checkpoint.Used);
+}
+
+TEST(allocation_header_round_trip) {
+  arena_allocator_data data;
+  defer(arena_allocator_release(&data));
+
+  allocator alloc = {arena_allocator, &data};
+  defer(free_all(alloc));
+
+  auto *a = malloc<byte>({.Count = 24, .Alloc = alloc});
+  assert_eq(allocation_get_size(a), 24);
+  assert_true(allocation_get_allocator(a) == alloc);
+
+  auto *b = malloc<byte>({.Count = 70000, .Alloc = alloc});
+  assert_eq(allocation_get_size(b), 70000);
+  assert_true(allocation_get_allocator(b) == alloc);
+
+  auto *c = malloc<byte>({.Count = 100, .Alloc = alloc, .Alignment = 64});
+  assert_eq((u64)c % 64, 0);
+  assert_eq(allocation_get_size(c), 100);
+  assert_true(allocation_get_allocator(c) == alloc);
+
+#if !defined DEBUG_MEMORY
+  // Small blocks get a compact header, see :CompactHeader:
+  s64 usedBefore = data.Used;
+  malloc<byte>({.Count = 24, .Alloc = alloc, .Alignment = 8});
+  assert_le(data.Used - usedBefore, 24 + 2 + 1 + 7);
+#endif
+}
+
+TEST(allocator_registry_reuses_released_slots) {
+  // More short-lived allocators than the registry has slots
+  byte buffer[64];
+  arena_allocator_data datas[ALLOCATOR_REGISTRY_SIZE * 2];
+
+  s32 firstIndex = -1;
+  For_as(data, datas) {
+    data.Block = buffer;
+    data.Size = sizeof(buffer);
+
+    allocator alloc = {arena_allocator, &data};
+    s32 index = allocator_registry_index(alloc);
+    assert_true(index != -1);
+    assert_true(allocator_registry_get(index) == alloc);
+    if (firstIndex == -1) firstIndex = index;
+
+    arena_allocator_release(&data);
+  }
+
+  // The first one was cached by this thread, its slot has been reused since
+  allocator first = {arena_allocator, &datas[0]};
+  s32 index = allocator_registry_index(first);
+  assert_true(allocator_registry_get(index) == first);
+  allocator_registry_remove(&datas[0]);
+}
+
+TEST(allocation_header_realloc_across_sizes) {
+  auto *p = malloc<byte>({.Count = 200});
+  For(range(200)) p[it] = (byte)it;
+
+  // The size needs more bytes in the header each time
+  p = realloc(p, {.NewCount = 300});
+  assert_eq(allocation_get_size(p), 300);
+  p = realloc(p, {.NewCount = 70000});
+  assert_eq(allocation_get_size(p), 70000);
+  For(range(200)) assert_eq(p[it], (byte)it);
+
+  p = realloc(p, {.NewCount = 100});
+  assert_eq(allocation_get_size(p), 100);
+  For(range(100)) assert_eq(p[it], (byte)it);
+
+  free(p);
+}
+
+TEST(slab_size_classes) {
+  For(range(1, SLAB_MAX_SIZE + 1)) {
+    s64 c = slab_size_class(it);
+    assert_ge(SLAB_SIZE_CLASSES[c], it);
+    if (c) assert_lt(SLAB_SIZE_CLASSES[c - 1], it);
+  }
+}
+
+TEST(slab_allocator) {
+  slab_allocator_data data;
+  data.Backing = platform_get_persistent_allocator();
+  defer(slab_allocator_release(&data));
+
+  allocator alloc = {slab_allocator, &data};
+
+  // Same size class comes from the same slab, freed blocks are reused
+  auto *a = (byte *)alloc.Function(allocator_mode::ALLOCATE, &data, 40, null, 0, 0);
+  auto *b = (byte *)alloc.Function(allocator_mode::ALLOCATE, &data, 48, null, 0, 0);
+  assert_eq(b - a, 48);
+
+  alloc.Function(allocator_mode::FREE, &data, 0, a, 40, 0);
+  assert_eq(alloc.Function(allocator_mode::ALLOCATE, &data, 33, null, 0, 0), (void *)a);
+
+  // Resizing works within a size class
+  assert_eq(alloc.Function(allocator_mode::RESIZE, &data, 45, a, 33, 0), (void *)a);
+  assert_true(alloc.Function(allocator_mode::RESIZE, &data, 100, a, 45, 0) == null);
+
+  // Classes grow by pulling more slabs
+  array<byte *> blocks;
+  defer(free(blocks.Data));
+
+  For(range(2000)) {
+    auto *p = (byte *)alloc.Function(allocator_mode::ALLOCATE, &data, 500, null, 0, 0);
+    assert_eq((u64)p % 16, 0);
+    p[0] = (byte)it;
+    p[499] = (byte)it;
+    add(blocks, p);
+  }
+  For(range(2000)) assert_eq(blocks[it][499], (byte)it);
+  For(blocks) alloc.Function(allocator_mode::FREE, &data, 0, it, 500, 0);
+
+  // Large blocks go to the backing allocator
+  auto *big = (byte *)alloc.Function(allocator_mode::ALLOCATE, &data, 10_KiB, null, 0, 0);
+  big[10_KiB - 1] = 1;
+  alloc.Function(allocator_mode::FREE, &data, 0, big, 10_KiB, 0);
+
+  // Through the general allocation functions
+  PUSH_ALLOC(alloc) {
+    string s;
+    defer(free(s));
+    For(range(5000)) add(s, 'a' + it % 26);
+    assert_eq(s[4999], 'a' + 4999 % 26);
+  }
+}
+
+static concurrent_pool_allocator_data TestConcurrentPool;
+static s64 TestConcurrentPoolErrors;
+
+static void concurrent_pool_stress(void *) {
+  s64 id = (s64)Context.ThreadID;
+
+  For(range(20000)) {
+    s64 *blocks[8];
+    For_as(b, blocks) {
+      b = (s64 *)concurrent_pool_allocator(allocator_mode::ALLOCATE, &TestConcurrentPool, 32, null, 0, 0);
+      if (b) *b = id;
+    }
+
+    // If two threads got the same chunk one of them sees the other's id
+    For_as(b, blocks) {
+      if (!b) continue;
+      if (*b != id) atomic_inc(&TestConcurrentPoolErrors);
+      concurrent_pool_allocator(allocator_mode::FREE, &TestConcurrentPool, 0, b, 32, 0);
+    }
+  }
+}
+
+TEST(concurrent_pool_allocator) {
+  TestConcurrentPool.ElementSize = 32;
+
+  // Fewer chunks than the threads want at once, so some run dry
+  s64 blockSize = sizeof(pool_allocator_data::block) + 48 * 32;
+  auto *block = malloc<byte>({.Count = blockSize});
+  defer(free(block));
+  concurrent_pool_allocator_provide_block(&TestConcurrentPool, block, blockSize);
+
+  array<thread> threads;
+  defer(free(threads.Data));
+
+  For(range(8)) { add(threads, create_and_launch_thread(concurrent_pool_stress)); }
+  For(threads) { wait(it); }
+
+  assert_eq(TestConcurrentPoolErrors, 0);
+
+  // Every chunk made it back to the free list
+  s64 count = 0;
+  for (auto *c = concurrent_pool_untag(TestConcurrentPool.FreeList); c; c = c->Next) ++count;
+  assert_eq(count, 48);
+}
+
+#if defined DEBUG_MEMORY
+TEST(debug_memory_many_live_blocks) {
+  // With the old sorted list this took quadratic time
+  s64 count = 100000;
+
+  auto **blocks = malloc<s64 *>({.Count = count});
+  defer(free(blocks));
+
+  For(range(count)) {
+    blocks[it] = malloc<s64>({.Alloc = platform_get_persistent_allocator()});
+    *blocks[it] = it;
+  }
+
+  // Free every other block, the rest must still be found
+  For(range(0, count, 2)) free(blocks[it]);
+  For(range(1, count, 2)) {
+    assert_true(debug_memory_list_contains((allocation_header *)blocks[it] - 1));
+  }
+  assert_false(debug_memory_list_contains((allocation_header *)blocks[0] - 1));
+
+  For(range(1, count, 2)) free(blocks[it]);
+  debug_memory_verify_heap();
+}
+#endif
+
+static allocation_site_stats *find_profiled_site(allocation_profile profile, u32 line) {
+  For(profile.Sites) {
+    if (it.Line == line) return &it;
+  }
+  return null;
+}
+
+TEST(allocation_profiler) {
+  allocation_profiler_reset();
+
+  array<byte *> kept;
+  defer(free(kept));
+
+  u32 keptLine, tempLine;
+
+  auto newContext = Context;
+  newContext.ProfileAllocations = true;
+  PUSH_CONTEXT(newContext) {
+    For(range(10)) {
+      keptLine = __LINE__ + 1;
+      auto *p = malloc<byte>({.Count = 100});
+      add(kept, p);
+
+      tempLine = __LINE__ + 1;
+      auto *t = malloc<byte>({.Count = 30});
+      free(t);
+    }
+  }
+
+  auto before = allocation_profile_snapshot();
+  defer(free(before.Sites));
+
+  auto *keptSite = find_profiled_site(before, keptLine);
+  assert_true(keptSite != null);
+  assert_eq(keptSite->Allocations, 10);
+  assert_eq(keptSite->LiveBytes, 1000);
+  assert_eq(keptSite->LiveCount, 10);
+  assert_eq(keptSite->PeakLiveBytes, 1000);
+
+  auto *tempSite = find_profiled_site(before, tempLine);
+  assert_true(tempSite != null);
+  assert_eq(tempSite->Frees, 10);
+  assert_eq(tempSite->LiveBytes, 0);
+  assert_eq(tempSite->PeakLiveBytes, 30);
+  assert_eq(tempSite->Lifetimes[0], 10);  // Freed right away
+
+  // Sorted by live bytes
+  assert_true(before.Sites[0].LiveBytes >= before.Sites[before.Sites.Count - 1].LiveBytes);
+
+  // Growing reallocations are counted toward the original call site,
+  // blocks which aren't profiled are ignored
+  PUSH_CONTEXT(newContext) {
+    For(kept) it = realloc(it, {.NewCount = 200});
+  }
+  For(range(5)) free(kept[it]);
+
+  auto after = allocation_profile_snapshot();
+  defer(free(after.Sites));
+
+  auto diff = allocation_profile_diff(before, after);
+  defer(free(diff.Sites));
+
+  assert_eq(diff.Sites.Count, 1);
+  assert_eq(diff.Sites[0].Line, keptLine);
+  assert_eq(diff.Sites[0].Reallocations, 10);
+  assert_eq(diff.Sites[0].Frees, 5);
+  assert_eq(diff.Sites[0].LiveBytes, 10 * 100 - 5 * 200);  // Grew by 100 each, then freed half
+  assert_eq(diff.Sites[0].PeakLiveBytes, 2000);
+
+  string encoded = allocation_profile_encode(diff);
+  defer(free(encoded));
+  assert_true(length(encoded) > 5);
+  assert_eq(encoded[0], 'L');
+  assert_eq(encoded[3], 'P');
+  assert_eq(encoded[4], ALLOCATION_PROFILE_VERSION);
+
+  For(range(5, 10)) free(kept[it]);
+  allocation_profiler_reset();
+  assert_eq(ProfiledBlockCount, 0);
+}
+
+// Runs _body_ once with every implementation of the memory functions the CPU supports
+template <typename F>
+void for_each_memory_functions_impl(F body) {
+  auto best = memory_functions_set_impl(memory_functions_impl::AVX2);
+  For(range((s32) best + 1)) {
+    memory_functions_set_impl((memory_functions_impl) it);
+    body();
+  }
+  memory_functions_set_impl(best);
+}
+
+TEST(memory_functions_copy) {
+  byte src[512], dst[512], expected[512];
+  For(range(512)) src[it] = (byte) (it * 7 + 3);
+
+  for_each_memory_functions_impl([&]() {
+    bool ok = true;
+    For_as(size, range(300)) {
+      For_as(offset, range(0, 40, 3)) {
+        For(range(512)) dst[it] = expected[it] = 0xCC;
+        For(range(size)) expected[offset + it] = src[it + 5];
+
+        lstd_memcpy(dst + offset, src + 5, size);
+        For(range(512)) ok = ok && dst[it] == expected[it];
+      }
+    }
+    assert_true(ok);
+  });
+}
+
+TEST(memory_functions_move_overlapping) {
+  byte buffer[600], expected[600];
+
+  for_each_memory_functions_impl([&]() {
+    bool ok = true;
+    For_as(size, range(0, 300, 7)) {
+      For_as(shift, range(-70, 71, 3)) {
+        For(range(600)) buffer[it] = expected[it] = (byte) (it * 13 + 1);
+
+        s64 from = 150, to = 150 + shift;
+        if (shift > 0) {
+          For(range(size - 1, -1, -1)) expected[to + it] = expected[from + it];
+        } else {
+          For(range(size)) expected[to + it] = expected[from + it];
+        }
+
+        lstd_memmove(buffer + to, buffer + from, size);
+        For(range(600)) ok = ok && buffer[it] == expected[it];
+      }
+    }
+    assert_true(ok);
+  });
+}
+
+TEST(memory_functions_set_and_compare) {
+  byte a[512], b[512];
+
+  for_each_memory_functions_impl([&]() {
+    bool ok = true;
+    For_as(size, range(300)) {
+      For_as(offset, range(0, 40, 5)) {
+        For(range(512)) a[it] = 0x11;
+        lstd_memset(a + offset, 0xAB, size);
+        For(range(512)) {
+          bool inside = it >= offset && it < offset + size;
+          ok = ok && a[it] == (inside ? 0xAB : 0x11);
+        }
+
+        For(range(512)) b[it] = a[it];
+        ok = ok && lstd_memcmp(a + offset, b + offset, size) == 0;
+
+        // Every position of the first difference
+        For_as(diff, range(0, size, 11)) {
+          b[offset + diff] = 0xAC;
+          ok = ok && lstd_memcmp(a + offset, b + offset, size) < 0;
+          ok = ok && lstd_memcmp(b + offset, a + offset, size) > 0;
+          b[offset + diff] = 0xAB;
+        }
+      }
+    }
+    assert_true(ok);
+  });
+}
+
+TEST(memory_functions_large) {
+  // Past MEMORY_NON_TEMPORAL_THRESHOLD, unaligned on purpose
+  s64 size = MEMORY_NON_TEMPORAL_THRESHOLD + 12345;
+  auto *a = (byte *) os_allocate_block(size + 64);
+  auto *b = (byte *) os_allocate_block(size + 64);
+  defer(os_free_block(a));
+  defer(os_free_block(b));
+
+  for_each_memory_functions_impl([&]() {
+    lstd_memset(a + 3, 0x5A, size);
+    assert_eq(a[3], 0x5A);
+    assert_eq(a[size + 2], 0x5A);
+
+    For(range(0, size, 4096)) a[3 + it] = (byte) it;
+    lstd_memcpy(b + 17, a + 3, size);
+    assert_eq(lstd_memcmp(b + 17, a + 3, size), 0);
+
+    b[17 + size - 1] ^= 1;
+    assert_nq(lstd_memcmp(b + 17, a + 3, size), 0);
+
+    // Overlapping, forwards and backwards
+    lstd_memmove(a + 40, a + 3, size);
+    assert_eq(lstd_memcmp(a + 40, b + 17, size - 1), 0);
+    lstd_memmove(a + 1, a + 40, size);
+    assert_eq(lstd_memcmp(a + 1, b + 17, size - 1), 0);
+  });
+}
@@ -0,0 +1,97 @@
+#include "../test.h"
+
+#include "lstd/slot_map.h"
+
+TEST(slot_map_add_get_remove) {
+  slot_map<s64> map;
+  defer(free(map));
+
+  slot_map_handle nullHandle = {};
+  assert_false((bool) nullHandle);
+  assert_true(get(map, nullHandle) == null);
+
+  auto a = add(map, 1);
+  auto b = add(map, 2);
+  auto c = add(map, 3);
+  assert_true((bool) a);
+  assert_eq(map.Values.Count, 3);
+  assert_eq(*get(map, a), 1);
+  assert_eq(*get(map, b), 2);
+  assert_eq(*get(map, c), 3);
+
+  // Removing moves the last element into the hole, handles keep working
+  assert_true(remove(map, a));
+  assert_false(remove(map, a));
+  assert_false(has(map, a));
+  assert_eq(map.Values.Count, 2);
+  assert_eq(*get(map, b), 2);
+  assert_eq(*get(map, c), 3);
+
+  // The freed slot is reused, but the old handle stays dead
+  auto d = add(map, 4);
+  assert_eq(d.Index, a.Index);
+  assert_true(d.Generation != a.Generation);
+  assert_false(has(map, a));
+  assert_eq(*get(map, d), 4);
+
+  assert_true(remove(map, c));
+  assert_true(remove(map, b));
+  assert_eq(*get(map, d), 4);
+  assert_true(remove(map, d));
+  assert_eq(map.Values.Count, 0);
+}
+
+TEST(slot_map_growth_is_stable) {
+  slot_map<s64> map;
+  defer(free(map));
+
+  // Pointers into the map survive growth (only remove() moves elements)
+  auto first = add(map, 0);
+  s64 *firstPtr = get(map, first);
+
+  array<slot_map_handle> handles;
+  defer(free(handles));
+  For(range(1, 5000)) add(handles, add(map, it));
+
+  assert_true(get(map, first) == firstPtr);
+  For(range(handles.Count)) assert_eq(*get(map, handles[it]), it + 1);
+
+  // Remove every other element and check the survivors and visit order
+  For(range(0, handles.Count, 2)) remove(map, handles[it]);
+  assert_eq(map.Values.Count, 5000 - 2500);
+
+  s64 sum = 0, visited = 0;
+  slot_map_visit(map, [&](s64 *value, slot_map_handle handle) {
+    assert_true(get(map, handle) == value);
+    sum += *value, visited++;
+    return true;
+  });
+  assert_eq(visited, map.Values.Count);
+
+  s64 expected = 0;
+  For(range(1, handles.Count, 2)) expected += it + 1;
+  assert_eq(sum, expected);
+}
+
+TEST(slot_map_reset_and_allocator) {
+  arena_allocator_data arena;
+  defer(arena_allocator_release(&arena));
+
+  slot_map<s64> map;
+  map.Alloc = {arena_allocator, &arena};
+  defer(free_all(map.Alloc));  // Frees the map, runs before the release
+  reserve(map, 100);
+  assert_true(arena.Used > 0);
+
+  auto a = add(map, 1);
+  auto b = add(map, 2);
+  reset(map);
+  assert_eq(map.Values.Count, 0);
+  assert_false(has(map, a));
+  assert_false(has(map, b));
+
+  // Slots are reused after a reset, with fresh generations
+  auto c = add(map, 3);
+  assert_false(has(map, a) || has(map, b));
+  assert_eq(*get(map, c), 3);
+}
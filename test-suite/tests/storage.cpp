@@ -124,6 +124,223 @@ TEST(hash_table_clone) {
   assert_eq(copy.Count, 4);
 }
 
+TEST(hash_table_remove) {
+  hash_table<s64, s64> t;
+  defer(free(t));
+
+  // Keys 0 and 1 hash to values which are adjusted to valid hashes
+  For(range(1000)) add(t, it, it * 2);
+  assert_eq(*search(t, 0).Value, 0);
+  assert_eq(*search(t, 1).Value, 2);
+
+  For(range(0, 1000, 2)) assert_true(remove(t, it));
+  assert_false(remove(t, 0));
+  assert_eq(t.Count, 500);
+  For(range(1000)) assert_eq(has(t, it), (it & 1) == 1);
+
+  // No tombstones, so adding and removing over and over doesn't grow
+  s64 allocated = t.Allocated;
+  For(range(10000)) {
+    add(t, 5000 + it, it);
+    assert_true(remove(t, 5000 + it));
+  }
+  assert_eq(t.Allocated, allocated);
+  For(range(1, 1000, 2)) assert_eq(*search(t, it).Value, it * 2);
+
+  s64 loopIterations = 0;
+  for (auto [key, value] : t) {
+    assert_eq(*value, *key * 2);
+    ++loopIterations;
+  }
+  assert_eq(loopIterations, 500);
+}
+
+TEST(hash_table_probe_stats) {
+  hash_table<s64, s64> t;
+  defer(free(t));
+
+  // Sequential keys with the trivial hash don't collide at all (0 would
+  // collide with 1, see FIRST_VALID_HASH)
+  For(range(1, 101)) add(t, it, it);
+  auto stats = get_probe_stats(t);
+  assert_eq(stats.Count, 100);
+  assert_eq(stats.MaxProbeLength, 0);
+  assert_eq(stats.Histogram[0], 100);
+
+  // Keys that all map to the same slot form one cluster
+  reset(t);
+  For(range(1, 11)) add(t, it * t.Allocated, it);
+  stats = get_probe_stats(t);
+  assert_eq(stats.MaxProbeLength, 9);
+  assert_eq(stats.AverageProbeLength, 4.5);
+
+  // Removing from the middle shifts the rest of the cluster back
+  remove(t, 4 * t.Allocated);
+  stats = get_probe_stats(t);
+  assert_eq(stats.MaxProbeLength, 8);
+  For(range(1, 11)) assert_eq(has(t, it * t.Allocated), it != 4);
+}
+
+TEST(hash_table_incremental) {
+  hash_table<s64, s64> t;
+  t.Incremental = true;
+  defer(free(t));
+
+  // Growing leaves most entries in the old array, every add moves a few
+  s64 migrations = 0;
+  For(range(30000)) {
+    s64 allocated = t.Allocated;
+    add(t, it, it * 2);
+    if (t.Allocated != allocated && allocated) {
+      assert_true(t.Migration.Count > 0);
+      ++migrations;
+
+      // The new array was prepared before it was needed
+      assert_eq(t.NextEntries.Allocated, 0);
+
+      // Everything can be found while migrating
+      For_as(key, range(it + 1)) assert_eq(*search(t, key).Value, key * 2);
+    }
+  }
+  assert_true(migrations > 0);
+  assert_eq(t.Count, 30000);
+
+  // Halfway to growing again, the next array is being prepared
+  assert_eq(t.NextEntries.Allocated, t.Allocated * 2);
+
+  // Removing during a migration, from both arrays
+  while (!t.Migration.Count) add(t, t.Count, t.Count * 2);
+  s64 count = t.Count;
+  For(range(0, count, 3)) assert_true(remove(t, it));
+  For(range(count)) assert_eq(has(t, it), it % 3 != 0);
+
+  s64 loopIterations = 0;
+  for (auto [key, value] : t) {
+    assert_eq(*value, *key * 2);
+    ++loopIterations;
+  }
+  assert_eq(loopIterations, t.Count);
+
+  // A normal resize finishes the migration
+  while (!t.Migration.Count) add(t, count++, 0);
+  resize(t, t.Allocated * 2);
+  assert_eq(t.Migration.Count, 0);
+  assert_eq(t.Migration.Allocated, 0);
+
+  // Copies grow incrementally too
+  auto copy = clone(t);
+  defer(free(copy));
+  assert_true(copy.Incremental);
+  assert_true(copy == t);
+}
+
+TEST(hash_table_batch) {
+  hash_table<s64, s64> t;
+  t.Incremental = true;
+  defer(free(t));
+
+  // Stop in the middle of a migration so both arrays get looked at
+  s64 count = 0;
+  while (count < 1000 || !t.Migration.Count) {
+    add(t, count, count * 2);
+    ++count;
+  }
+
+  // Not a multiple of the batch size, every other key is missing
+  s64 keysCount = 2 * HASH_TABLE_BATCH_SIZE * 10 + 3;
+  array<s64> keys;
+  defer(free(keys));
+  For(range(keysCount)) add(keys, (it & 1) ? count + it : it * 7 % count);
+
+  array<key_value_pair<hash_table<s64, s64>>> results;
+  defer(free(results));
+  reserve(results, keysCount);
+  results.Count = keysCount;
+
+  search_batch(t, keys, results);
+  For(range(keysCount)) {
+    auto [key, value] = search(t, keys[it]);
+    assert_true(results[it].Value == value);
+    if (value) assert_eq(*results[it].Value, keys[it] * 2);
+  }
+
+  array<bool> found;
+  defer(free(found));
+  reserve(found, keysCount);
+  found.Count = keysCount;
+
+  assert_eq(has_batch(t, keys, found), keysCount / 2 + 1);
+  For(range(keysCount)) assert_eq(found[it], (it & 1) == 0);
+}
+
+TEST(hash_set) {
+  hash_set<string> s;
+  defer(free(s));
+
+  assert_true(add(s, "a"));
+  assert_true(add(s, "b"));
+  assert_false(add(s, "a"));
+  assert_eq(s.Count, 2);
+  assert_true(has(s, "a"));
+  assert_false(has(s, "c"));
+
+  s64 loopIterations = 0;
+  for (auto key : s) {
+    assert_true(strings_match(key, "a") || strings_match(key, "b"));
+    ++loopIterations;
+  }
+  assert_eq(loopIterations, 2);
+
+  assert_true(remove(s, "a"));
+  assert_false(remove(s, "a"));
+  assert_false(has(s, "a"));
+  assert_eq(s.Count, 1);
+}
+
+TEST(hash_set_algebra) {
+  // 32-bit stored hashes make the entries half the size
+  static_assert(sizeof(hash_set<s32, u32>::entry) == 8);
+
+  hash_set<s32, u32> evens, threes;
+  defer(free(evens));
+  defer(free(threes));
+
+  For(range(0, 1000, 2)) add(evens, (s32) it);
+  For(range(0, 1000, 3)) add(threes, (s32) it);
+
+  auto u = set_union(evens, threes);
+  auto i = set_intersection(evens, threes);
+  auto d = set_difference(evens, threes);
+  defer(free(u));
+  defer(free(i));
+  defer(free(d));
+
+  s64 unionCount = 0, intersectionCount = 0, differenceCount = 0;
+  For(range(1000)) {
+    bool even = it % 2 == 0, three = it % 3 == 0;
+    unionCount += even || three;
+    intersectionCount += even && three;
+    differenceCount += even && !three;
+
+    assert_eq(has(u, (s32) it), even || three);
+    assert_eq(has(i, (s32) it), even && three);
+    assert_eq(has(d, (s32) it), even && !three);
+  }
+  assert_eq(u.Count, unionCount);
+  assert_eq(i.Count, intersectionCount);
+  assert_eq(d.Count, differenceCount);
+
+  auto copy = clone(evens);
+  defer(free(copy));
+  assert_true(copy == evens);
+
+  retain_all(copy, threes);
+  assert_true(copy == i);
+
+  add_all(copy, d);
+  assert_true(copy == evens);
+}
+
 struct v2 {
   f32 x, y;
 };
@@ -136,6 +353,28 @@ u64 get_hash(v2) {
   return 10;  // Ha-hA
 }
 
+static constexpr static_perfect_map_item<s32> NUMBER_ITEMS[] = {
+    {"zero", 0}, {"one", 1},   {"two", 2},   {"three", 3}, {"four", 4},
+    {"five", 5}, {"six", 6},   {"seven", 7}, {"eight", 8}, {"nine", 9},
+    {"ten", 10}, {"", -1},
+};
+static constexpr auto NUMBERS = make_static_perfect_map(NUMBER_ITEMS);
+
+TEST(static_perfect_map) {
+  static_assert(NUMBERS.SLOTS >= 2 * NUMBERS.N);
+
+  For(NUMBER_ITEMS) {
+    auto *value = search(NUMBERS, it.Key);
+    assert_true(value != null);
+    assert_eq(*value, it.Value);
+  }
+
+  assert_true(search(NUMBERS, "eleven") == null);
+  assert_true(search(NUMBERS, "Seven") == null);
+  assert_true(search(NUMBERS, "seve") == null);
+  assert_true(search(NUMBERS, "sevenn") == null);
+}
+
 TEST(hash_table_alignment) {
   // This test uses SIMD types which require a 16 byte alignment or otherwise
   // crash. It tests if the block allocation in the table handles alignment of
@@ -148,6 +387,99 @@ TEST(hash_table_alignment) {
   add(simdTable, {1, 3}, {4, 7, 9});
 }
 
+TEST(swiss_table) {
+  swiss_table<string, s32> t;
+  defer(free(t));
+
+  set(t, "1", 1);
+  set(t, "4", 4);
+  set(t, "9", 10101);
+
+  assert_eq(*search(t, "1").Value, 1);
+  assert_eq(*search(t, "4").Value, 4);
+  assert_eq(*search(t, "9").Value, 10101);
+  assert_false(has(t, "5"));
+
+  set(t, "9", 9);
+  assert_eq(*search(t, "9").Value, 9);
+  assert_eq(t.Count, 3);
+
+  s64 loopIterations = 0;
+  for (auto [key, value] : t) {
+    string str = sprint("{}", *value);
+    assert_eq_str(*key, str);
+    free(str);
+
+    ++loopIterations;
+  }
+  assert_eq(loopIterations, t.Count);
+
+  assert_true(remove(t, "4"));
+  assert_false(remove(t, "4"));
+  assert_false(has(t, "4"));
+  assert_eq(t.Count, 2);
+
+  swiss_table<string, s32> empty;
+  for (auto [key, value] : empty) {
+    (void)key, (void)value;  // Unused variable
+    assert(false);
+  }
+}
+
+TEST(swiss_table_grow_and_remove) {
+  swiss_table<s64, s64> t;
+  defer(free(t));
+
+  // Keys that are multiples of a big power of two hash badly without mixing
+  For(range(10000)) add(t, it << 20, it);
+  assert_eq(t.Count, 10000);
+  assert_true(t.Count * 8 <= t.Allocated * 7);
+
+  For(range(10000)) {
+    auto *v = search(t, it << 20).Value;
+    assert_true(v && *v == it);
+  }
+  assert_false(has(t, 3));
+
+  // Removing and adding keys over and over shouldn't grow the table,
+  // DELETED slots get reused or cleaned up
+  For(range(0, 10000, 2)) assert_true(remove(t, it << 20));
+  s64 allocated = t.Allocated;
+  For(range(50000)) {
+    add(t, -it - 1, it);
+    remove(t, -it - 1);
+  }
+  assert_eq(t.Allocated, allocated);
+  assert_eq(t.Count, 5000);
+
+  For(range(10000)) assert_eq(has(t, it << 20), (it & 1) == 1);
+
+  auto copy = clone(t);
+  defer(free(copy));
+  assert_true(copy == t);
+  set(copy, 1, 1);
+  assert_true(copy != t);
+
+  reset(t);
+  assert_eq(t.Count, 0);
+  assert_false(has(t, 1 << 20));
+}
+
+bool operator==(v2 a, v2 b) { return a.x == b.x && a.y == b.y; }
+
+TEST(swiss_table_collisions) {
+  // Every key has the same hash (see get_hash(v2) above), so all of them
+  // share a probe sequence that spans many groups
+  swiss_table<v2, s32> t;
+  defer(free(t));
+
+  For(range(100)) add(t, {(f32) it, 0}, (s32) it);
+  For(range(100)) assert_eq(*search(t, v2{(f32) it, 0}).Value, it);
+
+  For(range(0, 100, 3)) remove(t, v2{(f32) it, 0});
+  For(range(100)) assert_eq(has(t, v2{(f32) it, 0}), it % 3 != 0);
+}
+
 TEST(array_empty_and_views)
 {
   array<s32> e;
@@ -168,3 +168,62 @@ TEST(context) {
   }
   assert_eq((void *)Context.Alloc.Function, (void *)old);
 }
+
+static concurrent_hash_table<s64, s64> ConcurrentTable;
+static s32 ConcurrentInserts = 0;
+static s32 ConcurrentErrors = 0;
+static s32 ConcurrentThreadIndex = 0;
+
+// Every thread inserts the same keys, only one of them should win each
+// key, and then everyone bumps the counters. Errors are counted and checked
+// by the test on the main thread.
+static void thread_concurrent_hash_table(void *) {
+  For(range(2000)) {
+    auto [value, inserted] =
+        get_or_insert(ConcurrentTable, it, [&]() { return it * 10; });
+    // Other threads may have bumped the value already
+    if (value < it * 10 || value > it * 10 + 8) atomic_inc(&ConcurrentErrors);
+    if (inserted) atomic_inc(&ConcurrentInserts);
+  }
+
+  For(range(2000)) update(ConcurrentTable, it, [](s64 *v) { ++*v; });
+
+  // Keys only this thread touches
+  s64 base = 1000000 * (s64) atomic_inc(&ConcurrentThreadIndex);
+  For(range(500)) {
+    if (!set(ConcurrentTable, base + it, it)) atomic_inc(&ConcurrentErrors);
+  }
+  For(range(500)) {
+    if (!remove(ConcurrentTable, base + it)) atomic_inc(&ConcurrentErrors);
+  }
+}
+
+TEST(concurrent_hash_table) {
+  ConcurrentInserts = ConcurrentErrors = ConcurrentThreadIndex = 0;
+  // Threads have their own temporary allocators, use a shared one
+  ConcurrentTable.Alloc = platform_get_persistent_allocator();
+  defer(free(ConcurrentTable));
+
+  array<thread> threads;
+  defer(free(threads.Data));
+
+  For(range(8)) {
+    add(threads, create_and_launch_thread(thread_concurrent_hash_table));
+  }
+  For(threads) { wait(it); }
+
+  assert_eq(ConcurrentErrors, 0);
+  assert_eq(ConcurrentInserts, 2000);
+  assert_eq(concurrent_hash_table_count(ConcurrentTable), 2000);
+
+  For(range(2000)) {
+    auto [value, found] = search(ConcurrentTable, it);
+    assert_true(found);
+    assert_eq(value, it * 10 + 8);
+  }
+  assert_false(has(ConcurrentTable, -1));
+
+  s64 visited = 0;
+  concurrent_hash_table_visit(ConcurrentTable, [&](s64 *, s64 *) { ++visited; });
+  assert_eq(visited, 2000);
+}